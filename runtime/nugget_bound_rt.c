@@ -0,0 +1,790 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Nugget Runtime Library - PhaseBoundPass markers
+//
+// PhaseBoundPass calls a marker hook every time a marker basic block runs
+// and passes the execution counts that define the region in nugget_init.
+// This runtime counts the hook calls and, when a marker reaches its count,
+// records the event and calls the matching weak callback. The markers are
+// ordered: start executions count only once warmup was reached (right away
+// when warmup_count is 0, i.e. there is no warmup marker) and end
+// executions only once start was reached. The callbacks let a program or a
+// simulator harness switch modes at the markers, e.g. with m5 ops:
+//
+//   void nugget_on_warmup(void);   // warmup_marker_count reached
+//   void nugget_on_start(void);    // start_marker_count reached
+//   void nugget_on_end(void);      // end_marker_count reached
+//
+// With markers_file the pass instruments any number of regions instead and
+// calls nugget_init_regions with a table of their counts; the hooks then
+// take the region's index in that table. Every region is tracked
+// independently and reports through
+//
+//   void nugget_on_region_warmup(uint64_t region_id);
+//   void nugget_on_region_start(uint64_t region_id);
+//   void nugget_on_region_end(uint64_t region_id);
+//
+// With countdown=inline|atomic the pass counts the executions itself in
+// nugget_marker_countdowns and calls the hooks only when a countdown
+// reaches zero. nugget_init_countdown and nugget_init_regions_countdown
+// receive that array; the runtime arms the first marker of every region
+// with its count and each later marker once the one before it was reached,
+// so a hook call means "reached". Unarmed countdowns start at UINT64_MAX
+// and never reach zero.
+//
+// Configuration is read from the environment when nugget_init runs:
+//   NUGGET_MARKER_OUTPUT  File that receives one "<event> <ns>" line per
+//                         event, "<event> <region_id> <ns>" with regions
+//                         (default: none). A process created by fork
+//                         writes to <NUGGET_MARKER_OUTPUT>.<pid>.
+//   NUGGET_REGION         With regions: only track the region with this id,
+//                         so one binary serves one region per run
+//   NUGGET_VERBOSE        Also print the events to stderr when set to 1
+//   NUGGET_PERF_OUTPUT    Count hardware events over every region (see
+//                         below) and write them to this CSV file. A
+//                         process created by fork writes to
+//                         <NUGGET_PERF_OUTPUT>.<pid>.
+//   NUGGET_PERF_EVENTS    Comma-separated events to count (default:
+//                         cycles,instructions,cache-misses,branch-misses).
+//                         Names as in perf list, or rNNNN for raw events.
+//   NUGGET_FORK           Fork sampling when set to 1 (see below)
+//   NUGGET_FORK_JOBS      Maximum number of running fork sampling children
+//                         (default: number of online CPUs)
+//
+// Fork sampling measures every region in one execution: when the first
+// marker of a region (warmup, or start without a warmup marker) is reached,
+// the process forks. The child measures only that region and exits with
+// _exit(0) right after its end marker; the parent stops tracking the region
+// and fast-forwards to the next one, so the regions run in parallel on
+// different cores. Once NUGGET_FORK_JOBS children run, the parent waits for
+// the oldest before it forks again, and it waits for all of them at exit.
+// Only the thread that reached the marker exists in the child, so this
+// suits regions that run on a single thread.
+//
+// With NUGGET_PERF_OUTPUT the events are opened as one perf_event group
+// (user space only) when the first marker of a region is reached, counted
+// from the start marker to the end marker and written as one row
+//
+//   region_id,<event>...,time_enabled_ns,time_running_ns
+//
+// The counters belong to the thread that reached the first marker. When the
+// hardware events cannot be opened, e.g. in a VM without a virtual PMU, the
+// runtime warns and counts task-clock,page-faults,context-switches instead.
+//
+// The counters are shared by all threads and updated with relaxed atomics,
+// so a marker fires exactly once even when several threads execute it.
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE  // syscall
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUGGET_UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+void nugget_on_warmup(void) __attribute__((weak));
+void nugget_on_start(void) __attribute__((weak));
+void nugget_on_end(void) __attribute__((weak));
+void nugget_on_region_warmup(uint64_t region_id) __attribute__((weak));
+void nugget_on_region_start(uint64_t region_id) __attribute__((weak));
+void nugget_on_region_end(uint64_t region_id) __attribute__((weak));
+
+enum { WARMUP_MARKER, START_MARKER, END_MARKER, NUM_MARKERS };
+
+static const char *const marker_names[NUM_MARKERS] = {
+    [WARMUP_MARKER] = "warmup",
+    [START_MARKER] = "start",
+    [END_MARKER] = "end",
+};
+
+#define NUGGET_MAX_PERF_EVENTS 8
+
+struct nugget_marker {
+    uint64_t target;         // 0 = not used
+    _Atomic uint64_t count;
+    _Atomic int reached;
+};
+
+struct nugget_region {
+    uint64_t id;
+    _Atomic int enabled;
+    struct nugget_marker markers[NUM_MARKERS];
+    uint64_t *countdowns;    // Pass-owned [NUM_MARKERS], countdown mode only
+    int perf_fds[NUGGET_MAX_PERF_EVENTS];  // perf_fds[0] leads, -1 = closed
+};
+
+// Row of the table PhaseBoundPass passes to nugget_init_regions
+struct nugget_region_counts {
+    uint64_t region_id;
+    uint64_t warmup_count;
+    uint64_t start_count;
+    uint64_t end_count;
+};
+
+static struct nugget_region single_region;
+static struct nugget_region *regions;
+static uint64_t num_regions;
+static int use_regions;      // Initialized by nugget_init_regions
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *output;
+static char *output_path;
+static int verbose;
+
+// perf_event counting
+struct nugget_perf_event {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static const struct nugget_perf_event known_perf_events[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"ref-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES},
+    {"stalled-cycles-frontend", PERF_TYPE_HARDWARE,
+     PERF_COUNT_HW_STALLED_CYCLES_FRONTEND},
+    {"stalled-cycles-backend", PERF_TYPE_HARDWARE,
+     PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"cpu-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+};
+
+static const char *const default_perf_events =
+    "cycles,instructions,cache-misses,branch-misses";
+static const char *const fallback_perf_events =
+    "task-clock,page-faults,context-switches";
+
+static struct nugget_perf_event perf_events[NUGGET_MAX_PERF_EVENTS];
+static int num_perf_events;  // 0 = perf counting disabled
+static FILE *perf_output;
+static char *perf_output_path;
+
+// Fork sampling
+static int fork_regions;     // NUGGET_FORK=1
+static int is_fork_child;    // This process measures a single region
+static long fork_jobs;
+static pid_t *children;      // Running children, oldest first
+static long num_children;
+static pthread_mutex_t fork_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void finish(void);
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Parse a comma-separated event list into perf_events. Returns 0 on an
+// unknown or malformed event.
+static int parsePerfEvents(const char *list) {
+    static char *names;      // perf_events[].name points into it
+    free(names);
+    names = strdup(list);
+    num_perf_events = 0;
+    if (!names) {
+        return 0;
+    }
+    char *save = NULL;
+    for (char *name = strtok_r(names, ",", &save); name;
+         name = strtok_r(NULL, ",", &save)) {
+        if (num_perf_events == NUGGET_MAX_PERF_EVENTS) {
+            fprintf(stderr, "nugget: at most %d perf events are supported\n",
+                    NUGGET_MAX_PERF_EVENTS);
+            return 0;
+        }
+        struct nugget_perf_event *event = &perf_events[num_perf_events];
+        event->name = NULL;
+        if (name[0] == 'r' && name[1] != '\0') {
+            char *end;
+            event->config = strtoull(name + 1, &end, 16);
+            if (*end == '\0') {
+                event->name = name;
+                event->type = PERF_TYPE_RAW;
+            }
+        }
+        for (size_t i = 0; !event->name && i < sizeof(known_perf_events) /
+                                                sizeof(known_perf_events[0]);
+             i++) {
+            if (strcmp(name, known_perf_events[i].name) == 0) {
+                *event = known_perf_events[i];
+            }
+        }
+        if (!event->name) {
+            fprintf(stderr, "nugget: unknown perf event %s\n", name);
+            return 0;
+        }
+        num_perf_events++;
+    }
+    return num_perf_events > 0;
+}
+
+static void closePerfGroup(int *fds) {
+    for (int i = 0; i < NUGGET_MAX_PERF_EVENTS; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+// Open perf_events as a disabled group counting the calling thread.
+// Returns 0 and leaves fds closed if any event cannot be opened.
+static int openPerfGroup(int *fds) {
+    for (int i = 0; i < NUGGET_MAX_PERF_EVENTS; i++) {
+        fds[i] = -1;
+    }
+    for (int i = 0; i < num_perf_events; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.disabled = i == 0;  // The members follow the leader
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP |
+                           PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1,
+                              i == 0 ? -1 : fds[0], 0);
+        if (fds[i] < 0) {
+            fds[i] = -1;
+            closePerfGroup(fds);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void writePerfHeader(void) {
+    fputs("region_id", perf_output);
+    for (int i = 0; i < num_perf_events; i++) {
+        fprintf(perf_output, ",%s", perf_events[i].name);
+    }
+    fputs(",time_enabled_ns,time_running_ns\n", perf_output);
+    fflush(perf_output);
+}
+
+// Settle the event list with a test open of the group, falling back to
+// software events, and open NUGGET_PERF_OUTPUT
+static void initPerf(const char *path) {
+    const char *list = getenv("NUGGET_PERF_EVENTS");
+    int fds[NUGGET_MAX_PERF_EVENTS];
+    if (!parsePerfEvents(list && *list ? list : default_perf_events)) {
+        num_perf_events = 0;
+        return;
+    }
+    if (!openPerfGroup(fds)) {
+        fprintf(stderr, "nugget: cannot open perf events (%s), counting %s "
+                "instead\n", strerror(errno), fallback_perf_events);
+        parsePerfEvents(fallback_perf_events);
+        if (!openPerfGroup(fds)) {
+            perror("nugget: cannot open software perf events");
+            num_perf_events = 0;
+            return;
+        }
+    }
+    closePerfGroup(fds);
+    perf_output_path = strdup(path);
+    perf_output = fopen(perf_output_path, "w");
+    if (!perf_output) {
+        perror("nugget: cannot open perf output");
+        num_perf_events = 0;
+        return;
+    }
+    writePerfHeader();
+}
+
+// Count the region from its start marker to its end marker. The group is
+// opened at the first marker so that opening it stays out of the ROI.
+static void perfBeforeEvent(struct nugget_region *region, int kind) {
+    int *fds = region->perf_fds;
+    if (kind != END_MARKER && fds[0] < 0 && !openPerfGroup(fds)) {
+        perror("nugget: cannot open perf events");
+    }
+    if (kind == END_MARKER && fds[0] >= 0) {
+        ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+static void perfAfterEvent(struct nugget_region *region, int kind) {
+    int *fds = region->perf_fds;
+    if (fds[0] < 0) {
+        return;
+    }
+    if (kind == START_MARKER) {
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return;
+    }
+    if (kind != END_MARKER) {
+        return;
+    }
+    // nr, time_enabled, time_running, values[nr]
+    uint64_t data[3 + NUGGET_MAX_PERF_EVENTS];
+    ssize_t size = read(fds[0], data, sizeof(data));
+    closePerfGroup(fds);
+    if (size < (ssize_t)(3 * sizeof(uint64_t)) ||
+        data[0] != (uint64_t)num_perf_events) {
+        fprintf(stderr, "nugget: cannot read perf events of region %lu\n",
+                (unsigned long)region->id);
+        return;
+    }
+    pthread_mutex_lock(&output_lock);
+    if (perf_output) {
+        fprintf(perf_output, "%lu", (unsigned long)region->id);
+        for (int i = 0; i < num_perf_events; i++) {
+            fprintf(perf_output, ",%lu", (unsigned long)data[3 + i]);
+        }
+        fprintf(perf_output, ",%lu,%lu\n", (unsigned long)data[1],
+                (unsigned long)data[2]);
+        fflush(perf_output);
+    }
+    pthread_mutex_unlock(&output_lock);
+}
+
+static void recordEvent(const struct nugget_region *region, int kind) {
+    uint64_t ns = nowNs();
+    pthread_mutex_lock(&output_lock);
+    if (output) {
+        if (use_regions) {
+            fprintf(output, "%s %lu %lu\n", marker_names[kind],
+                    (unsigned long)region->id, (unsigned long)ns);
+        } else {
+            fprintf(output, "%s %lu\n", marker_names[kind], (unsigned long)ns);
+        }
+        // Events are rare; flush so a crash or _exit after them loses nothing
+        fflush(output);
+    }
+    if (verbose) {
+        fprintf(stderr, "nugget: region %lu %s marker reached after %lu "
+                "executions\n", (unsigned long)region->id, marker_names[kind],
+                (unsigned long)region->markers[kind].target);
+    }
+    pthread_mutex_unlock(&output_lock);
+
+    if (use_regions) {
+        void (*callback)(uint64_t) =
+            kind == WARMUP_MARKER ? nugget_on_region_warmup
+            : kind == START_MARKER ? nugget_on_region_start
+            : nugget_on_region_end;
+        if (callback) {
+            callback(region->id);
+        }
+    } else {
+        void (*callback)(void) =
+            kind == WARMUP_MARKER ? nugget_on_warmup
+            : kind == START_MARKER ? nugget_on_start
+            : nugget_on_end;
+        if (callback) {
+            callback();
+        }
+    }
+}
+
+static void armCountdown(struct nugget_region *region, int kind) {
+    __atomic_store_n(&region->countdowns[kind], region->markers[kind].target,
+                     __ATOMIC_RELAXED);
+}
+
+// Wait for children[index] and drop it from the list. Returns 0 if options
+// has WNOHANG and the child is still running.
+static int reapChild(long index, int options) {
+    int status;
+    pid_t pid = waitpid(children[index], &status, options);
+    if (pid == 0) {
+        return 0;
+    }
+    if (pid > 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+        fprintf(stderr, "nugget: fork sampling child %ld failed\n",
+                (long)pid);
+    }
+    memmove(children + index, children + index + 1,
+            (size_t)(num_children - index - 1) * sizeof(*children));
+    num_children--;
+    return 1;
+}
+
+static void waitForChildren(void) {
+    pthread_mutex_lock(&fork_lock);
+    while (num_children > 0) {
+        reapChild(0, 0);
+    }
+    pthread_mutex_unlock(&fork_lock);
+}
+
+// Hand region to a new child process. Returns 1 in the child, which goes
+// on to measure the region, and 0 in the parent. If fork fails the region
+// is measured in this process.
+static int forkRegion(struct nugget_region *region) {
+    pthread_mutex_lock(&fork_lock);
+    for (long i = 0; i < num_children;) {
+        if (!reapChild(i, WNOHANG)) {
+            i++;
+        }
+    }
+    if (num_children >= fork_jobs) {
+        reapChild(0, 0);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("nugget: cannot fork region");
+        pthread_mutex_unlock(&fork_lock);
+        return 1;
+    }
+    if (pid == 0) {
+        is_fork_child = 1;
+        num_children = 0;
+        pthread_mutex_unlock(&fork_lock);
+        for (uint64_t i = 0; i < num_regions; i++) {
+            if (&regions[i] != region) {
+                regions[i].enabled = 0;
+            }
+        }
+        return 1;
+    }
+    children[num_children++] = pid;
+    pthread_mutex_unlock(&fork_lock);
+    region->enabled = 0;
+    if (verbose) {
+        fprintf(stderr, "nugget: region %lu measured by pid %ld\n",
+                (unsigned long)region->id, (long)pid);
+    }
+    return 0;
+}
+
+// A marker reached its count: fork if it starts a sampled region, arm the
+// next countdown and report it
+static void markerReached(struct nugget_region *region, int kind) {
+    int first_marker = region->markers[WARMUP_MARKER].target
+                           ? WARMUP_MARKER : START_MARKER;
+    if (fork_regions && kind == first_marker && !forkRegion(region)) {
+        return;
+    }
+    if (region->countdowns && kind != END_MARKER) {
+        armCountdown(region, kind + 1);
+    }
+    if (num_perf_events) {
+        perfBeforeEvent(region, kind);
+    }
+    recordEvent(region, kind);
+    if (num_perf_events) {
+        perfAfterEvent(region, kind);
+    }
+    if (is_fork_child && kind == END_MARKER) {
+        finish();
+        _exit(0);
+    }
+}
+
+// A countdown reached zero. Racy inline countdowns can reach zero more than
+// once, so only the first call reports the marker.
+static void countdownReached(struct nugget_region *region, int kind) {
+    if (kind != WARMUP_MARKER &&
+        !atomic_load_explicit(&region->markers[kind - 1].reached,
+                              memory_order_acquire)) {
+        return;
+    }
+    if (atomic_exchange_explicit(&region->markers[kind].reached, 1,
+                                 memory_order_acq_rel)) {
+        return;
+    }
+    markerReached(region, kind);
+}
+
+static inline void markerHit(struct nugget_region *region, int kind) {
+    if (!region->enabled) {
+        return;
+    }
+    if (region->countdowns) {
+        countdownReached(region, kind);
+        return;
+    }
+    // Each marker waits for the one before it
+    if (kind != WARMUP_MARKER &&
+        !atomic_load_explicit(&region->markers[kind - 1].reached,
+                              memory_order_acquire)) {
+        return;
+    }
+    struct nugget_marker *marker = &region->markers[kind];
+    uint64_t count = atomic_fetch_add_explicit(&marker->count, 1,
+                                               memory_order_relaxed) + 1;
+    if (NUGGET_UNLIKELY(count == marker->target)) {
+        atomic_store_explicit(&marker->reached, 1, memory_order_release);
+        markerReached(region, kind);
+    }
+}
+
+static void setRegion(struct nugget_region *region, uint64_t id,
+                      uint64_t warmup_count, uint64_t start_count,
+                      uint64_t end_count) {
+    region->id = id;
+    region->enabled = 1;
+    region->markers[WARMUP_MARKER].target = warmup_count;
+    // Without a warmup marker the start marker counts from the beginning
+    atomic_store(&region->markers[WARMUP_MARKER].reached, warmup_count == 0);
+    region->markers[START_MARKER].target = start_count;
+    region->markers[END_MARKER].target = end_count;
+    for (int i = 0; i < NUGGET_MAX_PERF_EVENTS; i++) {
+        region->perf_fds[i] = -1;
+    }
+}
+
+// Arm the first marker of an enabled region; the others stay unarmed
+static void startCountdown(struct nugget_region *region,
+                           uint64_t *countdowns) {
+    region->countdowns = countdowns;
+    if (region->enabled) {
+        armCountdown(region, region->markers[WARMUP_MARKER].reached
+                                 ? START_MARKER : WARMUP_MARKER);
+    }
+}
+
+static void forkPrepare(void) {
+    pthread_mutex_lock(&output_lock);
+    if (output) {
+        fflush(output);
+    }
+    if (perf_output) {
+        fflush(perf_output);
+    }
+}
+
+static void forkParent(void) {
+    pthread_mutex_unlock(&output_lock);
+}
+
+// Replace the inherited *file with <path>.<pid>
+static void reopenForChild(FILE **file, const char *path, const char *what) {
+    fclose(*file);
+    char child_path[4096];
+    snprintf(child_path, sizeof(child_path), "%s.%ld", path,
+             (long)getpid());
+    *file = fopen(child_path, "w");
+    if (!*file) {
+        fprintf(stderr, "nugget: cannot open %s %s: %s\n", what, child_path,
+                strerror(errno));
+    }
+}
+
+static void forkChild(void) {
+    if (output) {
+        reopenForChild(&output, output_path, "marker output");
+    }
+    if (perf_output) {
+        reopenForChild(&perf_output, perf_output_path, "perf output");
+        if (perf_output) {
+            writePerfHeader();
+        }
+    }
+    pthread_mutex_unlock(&output_lock);
+}
+
+static void finish(void) {
+    pthread_mutex_lock(&output_lock);
+    if (output) {
+        fclose(output);
+        output = NULL;
+    }
+    if (perf_output) {
+        fclose(perf_output);
+        perf_output = NULL;
+    }
+    pthread_mutex_unlock(&output_lock);
+}
+
+// Returns 0 if nugget_init or nugget_init_regions already ran
+static int initOnce(void) {
+    static int initialized;
+    if (initialized++) {
+        fprintf(stderr, "nugget: nugget_init called more than once\n");
+        return 0;
+    }
+    const char *value = getenv("NUGGET_VERBOSE");
+    verbose = value && strcmp(value, "1") == 0;
+    value = getenv("NUGGET_MARKER_OUTPUT");
+    if (value && *value) {
+        output_path = strdup(value);
+        output = fopen(output_path, "w");
+        if (!output) {
+            perror("nugget: cannot open marker output");
+        }
+    }
+    value = getenv("NUGGET_PERF_OUTPUT");
+    if (value && *value) {
+        initPerf(value);
+    }
+    value = getenv("NUGGET_FORK");
+    fork_regions = value && strcmp(value, "1") == 0;
+    if (fork_regions) {
+        value = getenv("NUGGET_FORK_JOBS");
+        fork_jobs = value && *value ? atol(value)
+                                    : sysconf(_SC_NPROCESSORS_ONLN);
+        if (fork_jobs < 1) {
+            fork_jobs = 1;
+        }
+        children = calloc((size_t)fork_jobs, sizeof(*children));
+        if (!children) {
+            fprintf(stderr, "nugget: cannot allocate fork sampling state\n");
+            abort();
+        }
+        atexit(waitForChildren);
+    }
+    pthread_atfork(forkPrepare, forkParent, forkChild);
+    atexit(finish);
+    return 1;
+}
+
+// ============================================================================
+// PhaseBoundPass ABI
+// ============================================================================
+
+void nugget_init(uint64_t warmup_count, uint64_t start_count,
+                 uint64_t end_count) {
+    if (!initOnce()) {
+        return;
+    }
+    setRegion(&single_region, 0, warmup_count, start_count, end_count);
+}
+
+void nugget_init_countdown(uint64_t warmup_count, uint64_t start_count,
+                           uint64_t end_count, uint64_t *countdowns) {
+    if (!initOnce()) {
+        return;
+    }
+    setRegion(&single_region, 0, warmup_count, start_count, end_count);
+    startCountdown(&single_region, countdowns);
+}
+
+void nugget_warmup_marker_hook(void) {
+    markerHit(&single_region, WARMUP_MARKER);
+}
+
+void nugget_start_marker_hook(void) {
+    markerHit(&single_region, START_MARKER);
+}
+
+void nugget_end_marker_hook(void) {
+    markerHit(&single_region, END_MARKER);
+}
+
+static int initRegions(uint64_t count,
+                       const struct nugget_region_counts *table) {
+    if (!initOnce()) {
+        return 0;
+    }
+    regions = calloc(count, sizeof(*regions));
+    if (!regions) {
+        fprintf(stderr, "nugget: cannot allocate %lu marker regions\n",
+                (unsigned long)count);
+        abort();
+    }
+    int filter = 0;
+    uint64_t only_id = 0;
+    const char *only = getenv("NUGGET_REGION");
+    if (only && *only) {
+        char *end;
+        only_id = strtoull(only, &end, 0);
+        filter = *end == '\0';
+        if (!filter) {
+            fprintf(stderr, "nugget: ignoring invalid NUGGET_REGION=%s\n",
+                    only);
+        }
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        setRegion(&regions[i], table[i].region_id, table[i].warmup_count,
+                  table[i].start_count, table[i].end_count);
+        regions[i].enabled = !filter || table[i].region_id == only_id;
+    }
+    num_regions = count;
+    use_regions = 1;
+    return 1;
+}
+
+void nugget_init_regions(uint64_t count,
+                         const struct nugget_region_counts *table) {
+    initRegions(count, table);
+}
+
+void nugget_init_regions_countdown(uint64_t count,
+                                   const struct nugget_region_counts *table,
+                                   uint64_t *countdowns) {
+    if (!initRegions(count, table)) {
+        return;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        startCountdown(&regions[i], countdowns + NUM_MARKERS * i);
+    }
+}
+
+// The region hooks are only called with indices into the table passed to
+// nugget_init_regions; calls before it are ignored.
+void nugget_warmup_marker_region_hook(uint64_t region) {
+    if (region < num_regions) {
+        markerHit(&regions[region], WARMUP_MARKER);
+    }
+}
+
+void nugget_start_marker_region_hook(uint64_t region) {
+    if (region < num_regions) {
+        markerHit(&regions[region], START_MARKER);
+    }
+}
+
+void nugget_end_marker_region_hook(uint64_t region) {
+    if (region < num_regions) {
+        markerHit(&regions[region], END_MARKER);
+    }
+}
+
+__attribute__((weak)) void nugget_roi_end_(void) {
+    finish();
+}
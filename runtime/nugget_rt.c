@@ -0,0 +1,1372 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Nugget Runtime Library - basic block vector collection
+//
+// See nugget_rt.h for the interface, configuration and output format.
+//
+// Every thread collects its own basic block vector. In mode=call the vector
+// lives in the thread's nugget_thread; nugget_bb_hook only bumps a counter
+// and, the first time a block is seen in an interval, appends its id to a
+// dirty list, so closing an interval costs the number of distinct blocks
+// executed rather than the total number of blocks. In mode=inline the
+// counters belong to the pass (thread_local with threading=tls); with
+// touched=true the pass keeps the dirty list itself and calls
+// nugget_sparse_interval_hook, otherwise the counters are scanned once when
+// the interval closes.
+//
+// Closing an interval is the cold path: the thread sorts the interval's ids
+// and varint-encodes the record into its own scratch buffer, then appends it
+// to a single output buffer under a mutex, so threads only contend once per
+// interval for a memcpy. When the output buffer fills it is handed to a
+// background writer thread and appending continues in a free buffer, so
+// write(2) latency never shows up on an application thread unless the
+// writer falls behind by every buffer (NUGGET_BUFFER_COUNT).
+//
+// The per-interval metrics are read by the thread that closes the interval:
+// the timestamp counter directly, the perf counters from a group the thread
+// opens when it attaches. The record stores the increase since the thread's
+// previous interval.
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE  // syscall
+
+#include "nugget_rt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define NUGGET_DEFAULT_OUTPUT "nugget_bbv.bin"
+#define NUGGET_DEFAULT_BUFFER_SIZE (1u << 20)
+#define NUGGET_DEFAULT_BUFFER_COUNT 2
+#define NUGGET_MAX_BUFFERS 64
+
+#define NUGGET_UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+// Defined by PhaseAnalysisPass in mode=inline only
+extern void nugget_flush_interval(void) __attribute__((weak));
+// Defined by PhaseAnalysisPass in every mode, unless the module registers
+// itself (id_base)
+extern const uint64_t nugget_module_fingerprint __attribute__((weak));
+extern const struct nugget_bb_info __nugget_bb_table[] __attribute__((weak));
+extern const uint64_t __nugget_bb_table_size __attribute__((weak));
+extern const char *const __nugget_function_names[] __attribute__((weak));
+extern const uint64_t __nugget_num_functions __attribute__((weak));
+
+// Functions listed by NUGGET_VERBOSE
+#define NUGGET_TOP_FUNCTIONS 5
+
+// Longest unsigned LEB128 encoding of a uint64_t
+#define NUGGET_MAX_VARINT 10
+
+struct nugget_buffer {
+    char *data;
+    size_t used;
+};
+
+struct nugget_ring {
+    struct nugget_buffer *slots[NUGGET_MAX_BUFFERS];
+    _Atomic size_t head;     // Advanced by the consumer
+    _Atomic size_t tail;     // Advanced by the producer
+};
+
+struct nugget_thread {
+    uint64_t index;
+    // mode=call
+    uint64_t *counts;
+    uint32_t *dirty;
+    uint64_t num_dirty;
+    uint64_t inst_count;
+    // bb_ids counts and dirty have room for, and the rt.bb_table they were
+    // sized with. Modules registered after nugget_init grow both.
+    uint64_t num_counts;
+    const struct nugget_bb_info *bb_table;
+    // mode=inline: ids of the non-zero pass-owned counters
+    uint32_t *scratch;
+    uint64_t scratch_size;
+    // mode=inline: the pass-owned counters the thread last closed an
+    // interval of, read by finish()
+    uint64_t *inline_counts;
+    uint64_t num_inline;
+    // Encoded record of the interval being closed
+    unsigned char *record;
+    size_t record_size;
+    // Metric readings at the end of the previous interval, in bit order
+    uint64_t last_metrics[NUGGET_NUM_METRICS];
+    int perf_fds[NUGGET_NUM_METRICS];   // Group of the perf metrics, -1 = none
+    int discard;             // Drop the intervals it closes (forkChild)
+    struct nugget_thread *next;         // In rt.threads
+};
+
+static struct {
+    // Grows under rt.lock when a module registers after nugget_init
+    _Atomic uint64_t num_counters;
+    uint64_t init_counters;  // num_counters set by nugget_init
+    uint64_t interval_length;  // Threshold of nugget_bb_hook
+    // Tables of all modules, merged by nugget_init and indexed by bb_id.
+    // A module registered later replaces bb_table under rt.lock with a
+    // larger copy; the old one stays allocated for the threads still
+    // reading it.
+    const struct nugget_bb_info *bb_table;
+    uint64_t bb_table_size;
+    const char *const *function_names;
+    uint64_t num_functions;
+    // With NUGGET_VERBOSE: IR instructions per function_id of bb_table
+    _Atomic uint64_t *function_insts;
+    // Modules laid out by nugget_init, sorted by id_base, followed by those
+    // registered later (under rt.lock)
+    struct nugget_file_module *layout;
+    uint64_t num_layout;
+    int active;              // Between nugget_init and nugget_roi_end_
+    int verbose;
+    char *output_path;
+    uint64_t metrics;        // NUGGET_METRIC_* bits
+
+    pthread_mutex_t lock;    // Protects everything below
+    const struct nugget_module **modules;  // nugget_register_module
+    struct nugget_thread *threads;  // Attached and not exited
+    uint64_t num_modules;
+    uint64_t modules_capacity;
+    struct nugget_buffer *current;  // Buffer being appended to
+    size_t buffer_size;
+    uint64_t num_intervals;
+    uint64_t clock;
+    uint64_t stalls;         // Times every buffer was waiting to be written
+
+    // Owned by the writer thread while it has buffers in flight
+    int fd;
+    uint64_t bytes_written;
+} rt = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+// Background writer. Full buffers go from the rt.lock holder to the writer
+// through `full`, and come back written and empty through `free`. Both are
+// single-producer single-consumer rings: rt.lock serializes the
+// application threads. writer.lock and the condition variables are only
+// used to sleep when a ring is empty.
+enum {
+    NUGGET_WRITER_IDLE,      // Not started yet, or stopped
+    NUGGET_WRITER_RUNNING,
+    NUGGET_WRITER_FAILED,    // pthread_create failed: write synchronously
+};
+
+static struct {
+    struct nugget_ring full;
+    struct nugget_ring free;
+    _Atomic size_t in_flight;   // Buffers pushed to full and not yet back
+    _Atomic int idle;           // Writer is (about to be) waiting on wake
+    _Atomic int waiting;        // The rt.lock holder is waiting on done
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    int stop;
+    int state;                  // Protected by rt.lock
+    pthread_t thread;
+} writer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static _Atomic uint64_t next_thread;
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static __thread struct nugget_thread *current_thread;
+
+// ============================================================================
+// Output
+// ============================================================================
+
+static void disableOutput(const char *what) {
+    fprintf(stderr, "nugget: %s: %s, disabling output\n", what,
+            strerror(errno));
+    if (rt.fd >= 0) {
+        close(rt.fd);
+    }
+    rt.fd = -1;
+}
+
+// Called by the writer thread, or by the lock holder when there is none
+static void writeOut(struct nugget_buffer *buffer) {
+    size_t done = 0;
+    while (rt.fd >= 0 && done < buffer->used) {
+        ssize_t n = write(rt.fd, buffer->data + done, buffer->used - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            disableOutput("write failed");
+            break;
+        }
+        done += (size_t)n;
+    }
+    rt.bytes_written += done;
+    buffer->used = 0;
+}
+
+// The rings never fill: each holds at most NUGGET_MAX_BUFFERS buffers.
+static void ringPush(struct nugget_ring *ring, struct nugget_buffer *buffer) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    ring->slots[tail % NUGGET_MAX_BUFFERS] = buffer;
+    atomic_store(&ring->tail, tail + 1);
+}
+
+static struct nugget_buffer *ringPop(struct nugget_ring *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == atomic_load(&ring->tail)) {
+        return NULL;
+    }
+    struct nugget_buffer *buffer = ring->slots[head % NUGGET_MAX_BUFFERS];
+    atomic_store(&ring->head, head + 1);
+    return buffer;
+}
+
+// The sleeping flags and the ring indices are sequentially consistent, so a
+// side that publishes work and then finds the flag clear knows the other
+// side will see the work before it sleeps.
+static void *writerMain(void *arg) {
+    (void)arg;
+    for (;;) {
+        struct nugget_buffer *buffer = ringPop(&writer.full);
+        if (!buffer) {
+            pthread_mutex_lock(&writer.lock);
+            atomic_store(&writer.idle, 1);
+            while (!(buffer = ringPop(&writer.full)) && !writer.stop) {
+                pthread_cond_wait(&writer.wake, &writer.lock);
+            }
+            atomic_store(&writer.idle, 0);
+            pthread_mutex_unlock(&writer.lock);
+            if (!buffer) {
+                return NULL;
+            }
+        }
+        writeOut(buffer);
+        ringPush(&writer.free, buffer);
+        atomic_fetch_sub(&writer.in_flight, 1);
+        if (atomic_load(&writer.waiting)) {
+            pthread_mutex_lock(&writer.lock);
+            pthread_cond_broadcast(&writer.done);
+            pthread_mutex_unlock(&writer.lock);
+        }
+    }
+}
+
+// Caller holds rt.lock
+static void startWriter(void) {
+    writer.stop = 0;
+    writer.state = pthread_create(&writer.thread, NULL, writerMain, NULL) == 0
+                   ? NUGGET_WRITER_RUNNING : NUGGET_WRITER_FAILED;
+    if (writer.state == NUGGET_WRITER_FAILED) {
+        fprintf(stderr, "nugget: cannot start the writer thread, writing "
+                "synchronously\n");
+    }
+}
+
+// Caller holds rt.lock. Returns once the writer has returned every buffer.
+static void waitForWriter(void) {
+    pthread_mutex_lock(&writer.lock);
+    atomic_store(&writer.waiting, 1);
+    while (atomic_load(&writer.in_flight) != 0) {
+        pthread_cond_wait(&writer.done, &writer.lock);
+    }
+    atomic_store(&writer.waiting, 0);
+    pthread_mutex_unlock(&writer.lock);
+}
+
+// Caller holds rt.lock. Hand the current buffer to the writer thread and
+// continue in a free one; only if the writer has fallen behind by every
+// buffer does the caller wait for it.
+static void submitBuffer(void) {
+    if (rt.current->used == 0) {
+        return;
+    }
+    if (writer.state == NUGGET_WRITER_IDLE) {
+        startWriter();
+    }
+    if (writer.state != NUGGET_WRITER_RUNNING) {
+        writeOut(rt.current);
+        return;
+    }
+    atomic_fetch_add(&writer.in_flight, 1);
+    ringPush(&writer.full, rt.current);
+    if (atomic_load(&writer.idle)) {
+        pthread_mutex_lock(&writer.lock);
+        pthread_cond_signal(&writer.wake);
+        pthread_mutex_unlock(&writer.lock);
+    }
+    rt.current = ringPop(&writer.free);
+    if (NUGGET_UNLIKELY(!rt.current)) {
+        rt.stalls++;
+        pthread_mutex_lock(&writer.lock);
+        atomic_store(&writer.waiting, 1);
+        while (!(rt.current = ringPop(&writer.free))) {
+            pthread_cond_wait(&writer.done, &writer.lock);
+        }
+        atomic_store(&writer.waiting, 0);
+        pthread_mutex_unlock(&writer.lock);
+    }
+}
+
+// Caller holds rt.lock. Write out everything appended so far.
+static void flushOutput(void) {
+    submitBuffer();
+    if (writer.state == NUGGET_WRITER_RUNNING) {
+        waitForWriter();
+    }
+}
+
+// Caller holds rt.lock
+static void stopWriter(void) {
+    if (writer.state != NUGGET_WRITER_RUNNING) {
+        return;
+    }
+    pthread_mutex_lock(&writer.lock);
+    writer.stop = 1;
+    pthread_cond_signal(&writer.wake);
+    pthread_mutex_unlock(&writer.lock);
+    pthread_join(writer.thread, NULL);
+    writer.state = NUGGET_WRITER_IDLE;
+}
+
+// Caller holds rt.lock
+static void appendOutput(const void *data, size_t size) {
+    const char *bytes = data;
+    while (size > 0) {
+        if (rt.current->used == rt.buffer_size) {
+            submitBuffer();
+        }
+        size_t chunk = rt.buffer_size - rt.current->used;
+        if (chunk > size) {
+            chunk = size;
+        }
+        memcpy(rt.current->data + rt.current->used, bytes, chunk);
+        rt.current->used += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+// Caller holds rt.lock and the writer has no buffers
+static void openOutput(const char *path) {
+    rt.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (rt.fd < 0) {
+        disableOutput(path);
+        return;
+    }
+    size_t layout_size = rt.num_layout * sizeof(*rt.layout);
+    struct nugget_file_header header;
+    memcpy(header.magic, NUGGET_FILE_MAGIC, sizeof(header.magic));
+    header.version = NUGGET_FILE_VERSION;
+    header.header_size = (uint32_t)(sizeof(header) + layout_size);
+    header.fingerprint = rt.num_layout == 1 ? rt.layout[0].fingerprint : 0;
+    header.num_counters = rt.num_counters;
+    header.metrics = rt.metrics;
+    header.interval_length = rt.interval_length;
+    header.num_modules = rt.num_layout;
+    appendOutput(&header, sizeof(header));
+    appendOutput(rt.layout, layout_size);
+}
+
+// ============================================================================
+// Interval metrics
+// ============================================================================
+
+static const struct {
+    const char *name;
+    uint64_t bit;
+    uint64_t perf_config;    // PERF_TYPE_HARDWARE event, unused for tsc
+} metric_types[NUGGET_NUM_METRICS] = {
+    {"tsc", NUGGET_METRIC_TSC, 0},
+    {"cycles", NUGGET_METRIC_CYCLES, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", NUGGET_METRIC_INSTRUCTIONS, PERF_COUNT_HW_INSTRUCTIONS},
+    {"llc-misses", NUGGET_METRIC_LLC_MISSES, PERF_COUNT_HW_CACHE_MISSES},
+};
+
+#define NUGGET_PERF_METRICS (NUGGET_METRIC_CYCLES | \
+                             NUGGET_METRIC_INSTRUCTIONS | \
+                             NUGGET_METRIC_LLC_MISSES)
+
+static uint64_t readTimestamp(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static void closePerfGroup(int *fds) {
+    for (int i = 0; i < NUGGET_NUM_METRICS; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+        fds[i] = -1;
+    }
+}
+
+// Open the perf metrics of rt.metrics as an enabled group counting the
+// calling thread in user space. Returns 0 and leaves fds closed on failure.
+static int openPerfGroup(int *fds) {
+    for (int i = 0; i < NUGGET_NUM_METRICS; i++) {
+        fds[i] = -1;
+    }
+    int leader = -1;
+    for (int i = 0; i < NUGGET_NUM_METRICS; i++) {
+        if (!(rt.metrics & metric_types[i].bit & NUGGET_PERF_METRICS)) {
+            continue;
+        }
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = metric_types[i].perf_config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader,
+                              PERF_FLAG_FD_CLOEXEC);
+        if (fds[i] < 0) {
+            fds[i] = -1;
+            closePerfGroup(fds);
+            return 0;
+        }
+        if (leader < 0) {
+            leader = fds[i];
+        }
+    }
+    return 1;
+}
+
+// Current reading of every metric in rt.metrics, in bit order. Returns the
+// number of values.
+static int readMetrics(struct nugget_thread *thread, uint64_t *values) {
+    // nr, then one value per group member in bit order
+    uint64_t perf[1 + NUGGET_NUM_METRICS] = {0};
+    int leader = -1;
+    for (int i = 0; i < NUGGET_NUM_METRICS && leader < 0; i++) {
+        leader = thread->perf_fds[i];
+    }
+    if (leader >= 0 && read(leader, perf, sizeof(perf)) < 0) {
+        memset(perf, 0, sizeof(perf));
+    }
+    int num_values = 0;
+    int num_perf = 0;
+    for (int i = 0; i < NUGGET_NUM_METRICS; i++) {
+        if (!(rt.metrics & metric_types[i].bit)) {
+            continue;
+        }
+        if (metric_types[i].bit == NUGGET_METRIC_TSC) {
+            values[num_values++] = readTimestamp();
+        } else {
+            values[num_values++] = perf[1 + num_perf++];
+        }
+    }
+    return num_values;
+}
+
+// Start the calling thread's metrics from their current readings
+static void startMetrics(struct nugget_thread *thread) {
+    if ((rt.metrics & NUGGET_PERF_METRICS) &&
+        !openPerfGroup(thread->perf_fds)) {
+        fprintf(stderr, "nugget: cannot open the perf metrics of thread "
+                "%lu: %s\n", (unsigned long)thread->index, strerror(errno));
+    }
+    readMetrics(thread, thread->last_metrics);
+}
+
+// Parse NUGGET_METRICS into rt.metrics and drop the perf metrics if this
+// machine cannot count them
+static void initMetrics(void) {
+    const char *list = getenv("NUGGET_METRICS");
+    if (!list || !*list) {
+        list = "tsc";
+    }
+    rt.metrics = 0;
+    char *names = strdup(list);
+    char *save = NULL;
+    for (char *name = names ? strtok_r(names, ",", &save) : NULL; name;
+         name = strtok_r(NULL, ",", &save)) {
+        int known = strcmp(name, "none") == 0;
+        for (int i = 0; i < NUGGET_NUM_METRICS; i++) {
+            if (strcmp(name, metric_types[i].name) == 0) {
+                rt.metrics |= metric_types[i].bit;
+                known = 1;
+            }
+        }
+        if (!known) {
+            fprintf(stderr, "nugget: ignoring unknown metric %s\n", name);
+        }
+    }
+    free(names);
+    int fds[NUGGET_NUM_METRICS];
+    if ((rt.metrics & NUGGET_PERF_METRICS) && !openPerfGroup(fds)) {
+        fprintf(stderr, "nugget: cannot open perf events (%s), recording "
+                "no perf metrics\n", strerror(errno));
+        rt.metrics &= ~(uint64_t)NUGGET_PERF_METRICS;
+    }
+    closePerfGroup(fds);
+}
+
+static unsigned char *appendVarint(unsigned char *out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+static int compareIds(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Encode one interval into thread->record and zero its counters. ids lists
+// every non-zero entry of counts exactly once; it is sorted in place.
+// Returns the size of the record.
+static size_t encodeInterval(struct nugget_thread *thread, uint64_t *counts,
+                             uint32_t *ids, uint64_t num_ids,
+                             uint64_t inst_count) {
+    size_t needed = (3 + NUGGET_NUM_METRICS + 2 * num_ids) *
+                    NUGGET_MAX_VARINT;
+    if (thread->record_size < needed) {
+        free(thread->record);
+        thread->record = malloc(needed);
+        if (!thread->record) {
+            fprintf(stderr, "nugget: cannot allocate a %lu byte record\n",
+                    (unsigned long)needed);
+            abort();
+        }
+        thread->record_size = needed;
+    }
+    // Ids from the scan in nugget_interval_hook are already sorted
+    int sorted = 1;
+    for (uint64_t i = 1; i < num_ids && sorted; i++) {
+        sorted = ids[i - 1] < ids[i];
+    }
+    if (!sorted) {
+        qsort(ids, num_ids, sizeof(uint32_t), compareIds);
+    }
+
+    unsigned char *out = thread->record;
+    out = appendVarint(out, thread->index);
+    out = appendVarint(out, inst_count);
+    if (rt.metrics) {
+        uint64_t metrics[NUGGET_NUM_METRICS];
+        int num_metrics = readMetrics(thread, metrics);
+        for (int i = 0; i < num_metrics; i++) {
+            out = appendVarint(out, metrics[i] - thread->last_metrics[i]);
+            thread->last_metrics[i] = metrics[i];
+        }
+    }
+    out = appendVarint(out, num_ids);
+    uint32_t previous = 0;
+    for (uint64_t i = 0; i < num_ids; i++) {
+        if (rt.function_insts && ids[i] < thread->num_counts) {
+            const struct nugget_bb_info *info = &thread->bb_table[ids[i]];
+            if (info->function_id < rt.num_functions) {
+                atomic_fetch_add_explicit(
+                    &rt.function_insts[info->function_id],
+                    counts[ids[i]] * info->inst_count, memory_order_relaxed);
+            }
+        }
+        out = appendVarint(out, ids[i] - previous);
+        out = appendVarint(out, counts[ids[i]]);
+        counts[ids[i]] = 0;
+        previous = ids[i];
+    }
+    return (size_t)(out - thread->record);
+}
+
+// Append one interval to the output and zero its counters
+static void emitInterval(struct nugget_thread *thread, uint64_t *counts,
+                         uint32_t *ids, uint64_t num_ids,
+                         uint64_t inst_count) {
+    if (NUGGET_UNLIKELY(thread->discard)) {
+        for (uint64_t i = 0; i < num_ids; i++) {
+            counts[ids[i]] = 0;
+        }
+        return;
+    }
+    size_t size = encodeInterval(thread, counts, ids, num_ids, inst_count);
+
+    // The interval index and clock are implied by the record's position in
+    // the file, so they only advance under the lock.
+    pthread_mutex_lock(&rt.lock);
+    rt.num_intervals++;
+    rt.clock += inst_count;
+    if (rt.active) {
+        appendOutput(thread->record, size);
+    }
+    pthread_mutex_unlock(&rt.lock);
+}
+
+// ============================================================================
+// Threads
+// ============================================================================
+
+static void closeCallInterval(struct nugget_thread *thread) {
+    emitInterval(thread, thread->counts, thread->dirty, thread->num_dirty,
+                 thread->inst_count);
+    thread->num_dirty = 0;
+    thread->inst_count = 0;
+}
+
+// Close the calling thread's partial interval in both modes
+static void flushCurrentThread(void) {
+    struct nugget_thread *thread = current_thread;
+    if (thread && thread->inst_count > 0) {
+        closeCallInterval(thread);
+    }
+    if (nugget_flush_interval) {
+        nugget_flush_interval();
+    }
+}
+
+static void freeThread(struct nugget_thread *thread) {
+    free(thread->counts);
+    free(thread->dirty);
+    free(thread->scratch);
+    free(thread->record);
+    closePerfGroup(thread->perf_fds);
+    free(thread);
+}
+
+static void threadExit(void *arg) {
+    struct nugget_thread *thread = arg;
+    flushCurrentThread();
+    current_thread = NULL;
+    pthread_mutex_lock(&rt.lock);
+    struct nugget_thread **link = &rt.threads;
+    while (*link && *link != thread) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = thread->next;
+    }
+    pthread_mutex_unlock(&rt.lock);
+    freeThread(thread);
+}
+
+// Returns NULL before nugget_init
+static struct nugget_thread *attachThread(void) {
+    if (NUGGET_UNLIKELY(rt.num_counters == 0)) {
+        return NULL;
+    }
+    pthread_mutex_lock(&rt.lock);
+    uint64_t num_counters = rt.num_counters;
+    const struct nugget_bb_info *bb_table = rt.bb_table;
+    pthread_mutex_unlock(&rt.lock);
+    struct nugget_thread *thread = calloc(1, sizeof(*thread));
+    if (thread) {
+        thread->counts = calloc(num_counters, sizeof(uint64_t));
+        thread->dirty = malloc(num_counters * sizeof(uint32_t));
+    }
+    if (!thread || !thread->counts || !thread->dirty) {
+        fprintf(stderr, "nugget: cannot allocate counters for %lu blocks\n",
+                (unsigned long)num_counters);
+        abort();
+    }
+    thread->num_counts = num_counters;
+    thread->bb_table = bb_table;
+    thread->index = atomic_fetch_add_explicit(&next_thread, 1,
+                                              memory_order_relaxed);
+    for (int i = 0; i < NUGGET_NUM_METRICS; i++) {
+        thread->perf_fds[i] = -1;
+    }
+    startMetrics(thread);
+    current_thread = thread;
+    // The key destructor flushes the thread's last interval when it exits
+    pthread_setspecific(thread_key, thread);
+    pthread_mutex_lock(&rt.lock);
+    thread->next = rt.threads;
+    rt.threads = thread;
+    pthread_mutex_unlock(&rt.lock);
+    return thread;
+}
+
+// A module registered after the thread attached: grow its counters to
+// rt.num_counters. Returns whether bb_id is now in range.
+static int growCounters(struct nugget_thread *thread, uint64_t bb_id) {
+    pthread_mutex_lock(&rt.lock);
+    uint64_t num_counters = rt.num_counters;
+    if (bb_id >= num_counters) {
+        pthread_mutex_unlock(&rt.lock);
+        return 0;
+    }
+    // Under rt.lock, since emitRunningThread may be reading them
+    uint64_t *counts = realloc(thread->counts,
+                               num_counters * sizeof(uint64_t));
+    if (counts) {
+        thread->counts = counts;
+    }
+    uint32_t *dirty = realloc(thread->dirty, num_counters * sizeof(uint32_t));
+    if (dirty) {
+        thread->dirty = dirty;
+    }
+    if (!counts || !dirty) {
+        fprintf(stderr, "nugget: cannot allocate counters for %lu blocks\n",
+                (unsigned long)num_counters);
+        abort();
+    }
+    memset(counts + thread->num_counts, 0,
+           (num_counters - thread->num_counts) * sizeof(uint64_t));
+    thread->num_counts = num_counters;
+    thread->bb_table = rt.bb_table;
+    pthread_mutex_unlock(&rt.lock);
+    return 1;
+}
+
+// Caller holds rt.lock. Append the pending interval of another thread that
+// may still be running. Its counters are only read: the thread keeps
+// counting into them, and nothing it closes after finish() is recorded.
+// Returns whether there was a pending interval.
+static int emitRunningThread(struct nugget_thread *thread,
+                             int read_inline) {
+    uint64_t num_counters = rt.num_counters;
+    uint64_t *counts = calloc(num_counters, sizeof(uint64_t));
+    uint32_t *ids = malloc(num_counters * sizeof(uint32_t));
+    if (!counts || !ids) {
+        free(counts);
+        free(ids);
+        return 0;
+    }
+    uint64_t num_ids = 0;
+    uint64_t inst_count = thread->inst_count;
+    uint64_t num_dirty = thread->num_dirty;
+    for (uint64_t i = 0; i < num_dirty && i < num_counters; i++) {
+        uint32_t id = thread->dirty[i];
+        if (id < num_counters && counts[id] == 0 &&
+            (counts[id] = thread->counts[id]) != 0) {
+            ids[num_ids++] = id;
+        }
+    }
+    // The pass-owned instruction counter is not visible here, but it is
+    // the sum of the blocks' sizes over the counts
+    uint64_t num_inline = read_inline ? thread->num_inline : 0;
+    for (uint64_t i = 0; i < num_inline && i < num_counters; i++) {
+        uint64_t count = thread->inline_counts[i];
+        if (count == 0) {
+            continue;
+        }
+        if (counts[i] == 0) {
+            ids[num_ids++] = (uint32_t)i;
+        }
+        counts[i] += count;
+        if (i < rt.bb_table_size) {
+            inst_count += count * rt.bb_table[i].inst_count;
+        }
+    }
+    int pending = num_ids > 0 || inst_count > 0;
+    if (pending) {
+        // Encode with a copy so the thread's own record and metric
+        // readings stay untouched
+        struct nugget_thread snapshot = *thread;
+        snapshot.record = NULL;
+        snapshot.record_size = 0;
+        size_t size = encodeInterval(&snapshot, counts, ids, num_ids,
+                                     inst_count);
+        rt.num_intervals++;
+        rt.clock += inst_count;
+        appendOutput(snapshot.record, size);
+        free(snapshot.record);
+    }
+    free(counts);
+    free(ids);
+    return pending;
+}
+
+// ============================================================================
+// Process lifetime
+// ============================================================================
+
+// Print the functions that executed the most IR instructions
+static void reportFunctions(void) {
+    uint64_t num_functions = rt.num_functions;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < num_functions; i++) {
+        total += rt.function_insts[i];
+    }
+    if (total == 0) {
+        return;
+    }
+    uint64_t top[NUGGET_TOP_FUNCTIONS];
+    int num_top = 0;
+    for (uint64_t i = 0; i < num_functions; i++) {
+        uint64_t insts = rt.function_insts[i];
+        if (insts == 0) {
+            continue;
+        }
+        int slot = num_top < NUGGET_TOP_FUNCTIONS ? num_top++
+                                                  : NUGGET_TOP_FUNCTIONS;
+        while (slot > 0 && rt.function_insts[top[slot - 1]] < insts) {
+            if (slot < NUGGET_TOP_FUNCTIONS) {
+                top[slot] = top[slot - 1];
+            }
+            slot--;
+        }
+        if (slot < NUGGET_TOP_FUNCTIONS) {
+            top[slot] = i;
+        }
+    }
+    for (int i = 0; i < num_top; i++) {
+        uint64_t insts = rt.function_insts[top[i]];
+        fprintf(stderr, "nugget: %5.1f%% %lu instructions in %s\n",
+                100.0 * (double)insts / (double)total, (unsigned long)insts,
+                rt.function_names[top[i]]);
+    }
+}
+
+static void finish(void) {
+    flushCurrentThread();
+    pthread_mutex_lock(&rt.lock);
+    if (rt.active) {
+        // Threads other than the caller may still be running (ROI end) or
+        // about to be torn down (exit). Threads sharing pass-owned counters
+        // (threading=none) emit them once.
+        uint64_t num_running = 0;
+        for (struct nugget_thread *thread = rt.threads; thread;
+             thread = thread->next) {
+            if (thread == current_thread) {
+                continue;
+            }
+            int read_inline = thread->inline_counts != NULL;
+            for (struct nugget_thread *other = rt.threads;
+                 other != thread && read_inline; other = other->next) {
+                read_inline = other == current_thread ||
+                              other->inline_counts != thread->inline_counts;
+            }
+            num_running += emitRunningThread(thread, read_inline);
+        }
+        flushOutput();
+        stopWriter();
+        if (rt.verbose) {
+            fprintf(stderr, "nugget: %lu intervals, %lu instructions, "
+                    "%lu bytes written to %s, %lu writer stalls\n",
+                    (unsigned long)rt.num_intervals,
+                    (unsigned long)rt.clock,
+                    (unsigned long)rt.bytes_written, rt.output_path,
+                    (unsigned long)rt.stalls);
+            if (num_running > 0) {
+                fprintf(stderr, "nugget: closed the pending intervals of "
+                        "%lu running threads\n", (unsigned long)num_running);
+            }
+            if (rt.function_insts) {
+                reportFunctions();
+            }
+        }
+        rt.active = 0;
+    }
+    pthread_mutex_unlock(&rt.lock);
+}
+
+// Write the parent's output out before fork so that it is written exactly
+// once and the child starts with an empty buffer. Holding writer.lock as
+// well keeps it consistent in the child. The counters are left alone:
+// closing an interval here would put a boundary into the parent's trace
+// wherever it forks (system, popen, ...).
+static void forkPrepare(void) {
+    pthread_mutex_lock(&rt.lock);
+    if (rt.active) {
+        flushOutput();
+    }
+    pthread_mutex_lock(&writer.lock);
+}
+
+static void forkParent(void) {
+    pthread_mutex_unlock(&writer.lock);
+    pthread_mutex_unlock(&rt.lock);
+}
+
+static void forkChild(void) {
+    // Only the forking thread exists in the child; the writer is restarted
+    // by the first submitBuffer. The condition variables still count the
+    // parent's writer as waiting, and would hand it the wakeups meant for
+    // the new one.
+    pthread_mutex_unlock(&writer.lock);
+    pthread_cond_init(&writer.wake, NULL);
+    pthread_cond_init(&writer.done, NULL);
+    if (writer.state == NUGGET_WRITER_RUNNING) {
+        writer.state = NUGGET_WRITER_IDLE;
+    }
+    atomic_store(&writer.idle, 0);
+    atomic_store(&writer.waiting, 0);
+    if (rt.active && rt.fd >= 0) {
+        close(rt.fd);
+        char path[4096];
+        snprintf(path, sizeof(path), "%s.%ld", rt.output_path, (long)getpid());
+        rt.bytes_written = 0;
+        rt.num_intervals = 0;
+        rt.clock = 0;
+        rt.stalls = 0;
+        if (rt.function_insts) {
+            memset(rt.function_insts, 0,
+                   rt.num_functions * sizeof(*rt.function_insts));
+        }
+        openOutput(path);
+    }
+    // The pending counts are the parent's: drop the other threads and the
+    // forking thread's partial interval
+    struct nugget_thread *thread = current_thread;
+    while (rt.threads) {
+        struct nugget_thread *other = rt.threads;
+        rt.threads = other->next;
+        if (other != thread) {
+            freeThread(other);
+        }
+    }
+    if (thread) {
+        rt.threads = thread;
+        thread->next = NULL;
+        for (uint64_t i = 0; i < thread->num_dirty; i++) {
+            thread->counts[thread->dirty[i]] = 0;
+        }
+        thread->num_dirty = 0;
+        thread->inst_count = 0;
+        // The inherited perf events still count the parent's thread
+        closePerfGroup(thread->perf_fds);
+        startMetrics(thread);
+    }
+    pthread_mutex_unlock(&rt.lock);
+    // Only the pass can reset its counters: close their interval unrecorded
+    if (nugget_flush_interval) {
+        if (!thread) {
+            thread = attachThread();
+        }
+        if (thread) {
+            thread->discard = 1;
+        }
+        nugget_flush_interval();
+        if (thread) {
+            thread->discard = 0;
+        }
+    }
+}
+
+static uint64_t envUnsigned(const char *name, uint64_t default_value) {
+    const char *value = getenv(name);
+    if (!value || !*value) {
+        return default_value;
+    }
+    char *end;
+    unsigned long long parsed = strtoull(value, &end, 0);
+    if (*end != '\0') {
+        fprintf(stderr, "nugget: ignoring invalid %s=%s\n", name, value);
+        return default_value;
+    }
+    return parsed;
+}
+
+static int compareModules(const void *a, const void *b) {
+    uint64_t x = ((const struct nugget_file_module *)a)->id_base;
+    uint64_t y = ((const struct nugget_file_module *)b)->id_base;
+    return (x > y) - (x < y);
+}
+
+// Caller holds rt.lock and the program has at least one module. Lay the
+// modules out in one bb_id space (see nugget_rt.h) and merge their tables
+// into rt. Returns the number of counters.
+static uint64_t layoutModules(uint64_t total_bb_count) {
+    // The module built without id_base, if any, exports its tables
+    struct nugget_module unregistered = {
+        .fingerprint = &nugget_module_fingerprint ? nugget_module_fingerprint
+                                                  : 0,
+        .id_base = 0,
+        .num_blocks = &__nugget_bb_table_size ? __nugget_bb_table_size : 0,
+        .bb_table = __nugget_bb_table,
+        .function_names = __nugget_function_names,
+        .num_functions = &__nugget_num_functions ? __nugget_num_functions
+                                                 : 0,
+    };
+    uint64_t num_modules = rt.num_modules + (__nugget_bb_table ? 1 : 0);
+    const struct nugget_module **modules = malloc(
+        num_modules * sizeof(*modules));
+    rt.layout = calloc(num_modules, sizeof(*rt.layout));
+    if (!modules || !rt.layout) {
+        fprintf(stderr, "nugget: cannot allocate the module table\n");
+        abort();
+    }
+    uint64_t count = 0;
+    if (__nugget_bb_table) {
+        modules[count++] = &unregistered;
+    }
+    for (uint64_t i = 0; i < rt.num_modules; i++) {
+        modules[count++] = rt.modules[i];
+    }
+
+    uint64_t end = 0;
+    for (uint64_t i = 0; i < num_modules; i++) {
+        const struct nugget_module *module = modules[i];
+        if (module->id_base != NUGGET_ID_BASE_AUTO &&
+            module->id_base + module->num_blocks > end) {
+            end = module->id_base + module->num_blocks;
+        }
+    }
+    uint64_t num_functions = 0;
+    for (uint64_t i = 0; i < num_modules; i++) {
+        const struct nugget_module *module = modules[i];
+        uint64_t base = module->id_base;
+        if (base == NUGGET_ID_BASE_AUTO) {
+            base = end;
+            end += module->num_blocks;
+        }
+        if (module->assigned_base) {
+            *module->assigned_base = base;
+        }
+        rt.layout[i].fingerprint = module->fingerprint;
+        rt.layout[i].id_base = base;
+        rt.layout[i].num_blocks = module->num_blocks;
+        num_functions += module->num_functions;
+    }
+    // Without registered modules, keep the count the unregistered module
+    // passed
+    uint64_t num_counters = end;
+    if (rt.num_modules == 0 && total_bb_count > num_counters) {
+        num_counters = total_bb_count;
+    }
+    // The dirty lists of the threads hold 32-bit bb_ids
+    if (num_counters > (uint64_t)UINT32_MAX + 1) {
+        fprintf(stderr, "nugget: bb_ids up to %lu exceed the supported "
+                "%lu\n", (unsigned long)(num_counters - 1),
+                (unsigned long)UINT32_MAX);
+        abort();
+    }
+
+    struct nugget_bb_info *bb_table = calloc(num_counters ? num_counters : 1,
+                                             sizeof(*bb_table));
+    const char **function_names = malloc(
+        (num_functions ? num_functions : 1) * sizeof(*function_names));
+    if (!bb_table || !function_names) {
+        fprintf(stderr, "nugget: cannot allocate the tables of %lu blocks\n",
+                (unsigned long)num_counters);
+        abort();
+    }
+    uint64_t first_function = 0;
+    for (uint64_t i = 0; i < num_modules; i++) {
+        const struct nugget_module *module = modules[i];
+        for (uint64_t id = 0; id < module->num_blocks; id++) {
+            struct nugget_bb_info *info = &bb_table[rt.layout[i].id_base + id];
+            *info = module->bb_table[id];
+            info->function_id += (uint32_t)first_function;
+        }
+        for (uint64_t f = 0; f < module->num_functions; f++) {
+            function_names[first_function + f] = module->function_names[f];
+        }
+        first_function += module->num_functions;
+    }
+    free(modules);
+
+    qsort(rt.layout, num_modules, sizeof(*rt.layout), compareModules);
+    for (uint64_t i = 1; i < num_modules; i++) {
+        const struct nugget_file_module *previous = &rt.layout[i - 1];
+        if (previous->id_base + previous->num_blocks > rt.layout[i].id_base) {
+            fprintf(stderr, "nugget: bb_ids of modules %016lx and %016lx "
+                    "overlap, their blocks are counted together\n",
+                    (unsigned long)previous->fingerprint,
+                    (unsigned long)rt.layout[i].fingerprint);
+        }
+    }
+    rt.num_layout = num_modules;
+    rt.bb_table = bb_table;
+    rt.bb_table_size = num_counters;
+    rt.function_names = function_names;
+    rt.num_functions = num_functions;
+    return num_counters;
+}
+
+// Caller holds rt.lock. Lay out a module registered after nugget_init past
+// the last counter, merge its table into a larger copy of rt.bb_table and
+// note it in the trace. Threads grow their counters when they first count
+// one of its blocks.
+static void addLateModule(const struct nugget_module *module) {
+    uint64_t base = rt.num_counters;
+    uint64_t num_counters = base + module->num_blocks;
+    // The dirty lists of the threads hold 32-bit bb_ids
+    if (num_counters > (uint64_t)UINT32_MAX + 1) {
+        // Past any base a later module can be given
+        *module->assigned_base = UINT64_MAX - module->num_blocks;
+        fprintf(stderr, "nugget: module %016lx registered after nugget_init "
+                "exceeds the supported %lu bb_ids, its blocks are not "
+                "counted\n", (unsigned long)module->fingerprint,
+                (unsigned long)UINT32_MAX + 1);
+        return;
+    }
+    struct nugget_bb_info *bb_table = calloc(num_counters ? num_counters : 1,
+                                             sizeof(*bb_table));
+    struct nugget_file_module *layout = realloc(
+        rt.layout, (rt.num_layout + 1) * sizeof(*layout));
+    if (!bb_table || !layout) {
+        fprintf(stderr, "nugget: cannot allocate the tables of %lu blocks\n",
+                (unsigned long)num_counters);
+        abort();
+    }
+    memcpy(bb_table, rt.bb_table, rt.bb_table_size * sizeof(*bb_table));
+    for (uint64_t id = 0; id < module->num_blocks; id++) {
+        bb_table[base + id] = module->bb_table[id];
+        // NUGGET_VERBOSE only names the functions laid out by nugget_init
+        bb_table[base + id].function_id = UINT32_MAX;
+    }
+    layout[rt.num_layout].fingerprint = module->fingerprint;
+    layout[rt.num_layout].id_base = base;
+    layout[rt.num_layout].num_blocks = module->num_blocks;
+    rt.layout = layout;
+    rt.num_layout++;
+    rt.bb_table = bb_table;
+    rt.bb_table_size = num_counters;
+    rt.num_counters = num_counters;
+    *module->assigned_base = base;
+
+    // Ahead of every interval that counts its blocks: those are closed by
+    // threads that grew their counters under rt.lock after this
+    if (rt.active) {
+        unsigned char record[4 * NUGGET_MAX_VARINT];
+        unsigned char *out = appendVarint(record, NUGGET_MODULE_RECORD);
+        out = appendVarint(out, module->fingerprint);
+        out = appendVarint(out, base);
+        out = appendVarint(out, module->num_blocks);
+        appendOutput(record, (size_t)(out - record));
+    }
+    if (rt.verbose) {
+        fprintf(stderr, "nugget: module %016lx registered after nugget_init, "
+                "counted as bb_ids %lu to %lu\n",
+                (unsigned long)module->fingerprint, (unsigned long)base,
+                (unsigned long)(num_counters - 1));
+    }
+}
+
+static void initOnce(void) {
+    pthread_key_create(&thread_key, threadExit);
+    pthread_atfork(forkPrepare, forkParent, forkChild);
+    atexit(finish);
+}
+
+// ============================================================================
+// PhaseAnalysisPass ABI
+// ============================================================================
+
+void nugget_register_module(const struct nugget_module *module) {
+    pthread_mutex_lock(&rt.lock);
+    if (rt.num_counters != 0) {
+        addLateModule(module);
+        pthread_mutex_unlock(&rt.lock);
+        return;
+    }
+    if (rt.num_modules == rt.modules_capacity) {
+        uint64_t capacity = rt.modules_capacity ? 2 * rt.modules_capacity
+                                                : 8;
+        const struct nugget_module **modules = realloc(
+            rt.modules, capacity * sizeof(*modules));
+        if (!modules) {
+            fprintf(stderr, "nugget: cannot allocate the module table\n");
+            abort();
+        }
+        rt.modules = modules;
+        rt.modules_capacity = capacity;
+    }
+    rt.modules[rt.num_modules++] = module;
+    pthread_mutex_unlock(&rt.lock);
+}
+
+void nugget_init(uint64_t total_bb_count, uint64_t interval_length) {
+    pthread_once(&init_once, initOnce);
+
+    pthread_mutex_lock(&rt.lock);
+    if (rt.active || rt.num_counters != 0) {
+        pthread_mutex_unlock(&rt.lock);
+        fprintf(stderr, "nugget: nugget_init called more than once\n");
+        return;
+    }
+    if (!__nugget_bb_table && rt.num_modules == 0) {
+        // nugget_bb_hook cannot count instructions without it
+        pthread_mutex_unlock(&rt.lock);
+        fprintf(stderr, "nugget: __nugget_bb_table not found and no module "
+                "registered, the program was built by an older "
+                "PhaseAnalysisPass; not recording\n");
+        return;
+    }
+    const char *output = getenv("NUGGET_OUTPUT");
+    rt.output_path = strdup(output && *output ? output : NUGGET_DEFAULT_OUTPUT);
+    rt.verbose = envUnsigned("NUGGET_VERBOSE", 0) != 0;
+    rt.buffer_size = envUnsigned("NUGGET_BUFFER_SIZE",
+                                 NUGGET_DEFAULT_BUFFER_SIZE);
+    if (rt.buffer_size < sizeof(struct nugget_file_header)) {
+        rt.buffer_size = sizeof(struct nugget_file_header);
+    }
+    uint64_t buffer_count = envUnsigned("NUGGET_BUFFER_COUNT",
+                                        NUGGET_DEFAULT_BUFFER_COUNT);
+    if (buffer_count < 2) {
+        buffer_count = 2;
+    } else if (buffer_count > NUGGET_MAX_BUFFERS) {
+        buffer_count = NUGGET_MAX_BUFFERS;
+    }
+    struct nugget_buffer *buffers = calloc(buffer_count, sizeof(*buffers));
+    for (uint64_t i = 0; buffers && i < buffer_count; i++) {
+        buffers[i].data = malloc(rt.buffer_size);
+        if (!buffers[i].data) {
+            buffers = NULL;
+        }
+    }
+    if (!buffers || !rt.output_path) {
+        fprintf(stderr, "nugget: cannot allocate the output buffers\n");
+        abort();
+    }
+    rt.current = &buffers[0];
+    for (uint64_t i = 1; i < buffer_count; i++) {
+        ringPush(&writer.free, &buffers[i]);
+    }
+    rt.interval_length = envUnsigned("NUGGET_INTERVAL_LENGTH",
+                                     interval_length);
+    if (rt.interval_length != interval_length && nugget_flush_interval) {
+        fprintf(stderr, "nugget: NUGGET_INTERVAL_LENGTH is ignored with "
+                "mode=inline, using %lu\n", (unsigned long)interval_length);
+        rt.interval_length = interval_length;
+    }
+    if (rt.interval_length == 0) {
+        rt.interval_length = 1;
+    }
+    uint64_t num_counters = layoutModules(total_bb_count);
+    if (rt.verbose && rt.num_functions > 0) {
+        rt.function_insts = calloc(rt.num_functions,
+                                   sizeof(*rt.function_insts));
+    }
+    rt.init_counters = num_counters;
+    rt.num_counters = num_counters;
+    rt.active = 1;
+    initMetrics();
+    openOutput(rt.output_path);
+    pthread_mutex_unlock(&rt.lock);
+    // Start the metrics of the ROI thread here rather than at its first
+    // interval end
+    if (!current_thread) {
+        attachThread();
+    }
+}
+
+void nugget_bb_hook(uint64_t bb_id) {
+    struct nugget_thread *thread = current_thread;
+    if (NUGGET_UNLIKELY(!thread)) {
+        thread = attachThread();
+        if (!thread) {
+            return;
+        }
+    }
+    // Blocks of a module registered after the thread's counters were sized
+    if (NUGGET_UNLIKELY(bb_id >= thread->num_counts) &&
+        !growCounters(thread, bb_id)) {
+        return;
+    }
+    const struct nugget_bb_info *info = &thread->bb_table[bb_id];
+    if (thread->counts[bb_id]++ == 0) {
+        thread->dirty[thread->num_dirty++] = (uint32_t)bb_id;
+    }
+    thread->inst_count += info->inst_count;
+    if (NUGGET_UNLIKELY(thread->inst_count >= rt.interval_length)) {
+        closeCallInterval(thread);
+    }
+}
+
+void nugget_interval_hook(uint64_t *bb_counters, uint64_t num_counters,
+                          uint64_t inst_count) {
+    struct nugget_thread *thread = current_thread;
+    if (NUGGET_UNLIKELY(!thread)) {
+        thread = attachThread();
+        if (!thread) {
+            // Before nugget_init: drop the interval
+            memset(bb_counters, 0, num_counters * sizeof(uint64_t));
+            return;
+        }
+    }
+    if (thread->scratch_size < num_counters) {
+        free(thread->scratch);
+        thread->scratch = malloc(num_counters * sizeof(uint32_t));
+        if (!thread->scratch) {
+            fprintf(stderr, "nugget: cannot allocate %lu counter ids\n",
+                    (unsigned long)num_counters);
+            abort();
+        }
+        thread->scratch_size = num_counters;
+    }
+    thread->inline_counts = bb_counters;
+    thread->num_inline = num_counters;
+    uint64_t num_ids = 0;
+    for (uint64_t i = 0; i < num_counters; i++) {
+        if (bb_counters[i] != 0) {
+            thread->scratch[num_ids++] = (uint32_t)i;
+        }
+    }
+    emitInterval(thread, bb_counters, thread->scratch, num_ids, inst_count);
+}
+
+void nugget_sparse_interval_hook(uint64_t *bb_counters, uint32_t *touched_ids,
+                                 uint64_t num_touched, uint64_t inst_count) {
+    struct nugget_thread *thread = current_thread;
+    if (NUGGET_UNLIKELY(!thread)) {
+        thread = attachThread();
+        if (!thread) {
+            // Before nugget_init: drop the interval
+            for (uint64_t i = 0; i < num_touched; i++) {
+                bb_counters[touched_ids[i]] = 0;
+            }
+            return;
+        }
+    }
+    // mode=inline has a single module, laid out by nugget_init: the
+    // counters cover its bb_ids
+    thread->inline_counts = bb_counters;
+    thread->num_inline = rt.init_counters;
+    emitInterval(thread, bb_counters, touched_ids, num_touched, inst_count);
+}
+
+// Weak so that a program with its own nugget_roi_end_ still links; the
+// output is then completed at exit.
+__attribute__((weak)) void nugget_roi_end_(void) {
+    finish();
+}
@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Nugget Runtime Library - public interface
+//
+// libnugget_rt implements the runtime side of PhaseAnalysisPass:
+//   - nugget_init / nugget_bb_hook for mode=call
+//   - nugget_interval_hook, nugget_sparse_interval_hook (touched=true) and
+//     nugget_flush_interval for mode=inline
+// and records one basic block vector (BBV) per interval to a binary file.
+// libnugget_bound_rt implements the PhaseBoundPass marker hooks. The two
+// cannot be linked into the same program: both define nugget_init.
+//
+// The program itself must define nugget_roi_begin_ (noinline, so the call
+// to nugget_init the passes insert into it stays on the executed path) and
+// call it where the region of interest starts. nugget_roi_end_ is provided
+// by the runtime.
+//
+// A program may consist of several separately instrumented modules, e.g. an
+// executable and its shared libraries, each labeled from bb_id 0. Modules
+// built with PhaseAnalysisPass id_base=auto or id_base=<N> call
+// nugget_register_module from a constructor instead of exporting
+// __nugget_bb_table. nugget_init lays the registered modules out in one
+// dense bb_id space: id_base=<N> modules at N, then the id_base=auto ones
+// one after another in registration order, and tells each module its base
+// through nugget_module.assigned_base. A module built without id_base (at
+// most one per program) keeps its bb_ids from 0. A module registered after
+// nugget_init (e.g. dlopened inside the ROI) is laid out past the last
+// bb_id and counted from then on: the trace gets a module record for it,
+// and each thread grows its counters the first time it runs one of its
+// blocks. NUGGET_VERBOSE does not name the functions of such a module.
+//
+// nugget_roi_end_ (or exit, if the program does not reach it) closes the
+// pending interval of the calling thread and of every other thread that
+// has not exited; NUGGET_VERBOSE reports how many of the latter there were.
+// Those threads may still be running, so their last interval is a snapshot
+// that misses the blocks they execute meanwhile. With mode=inline the
+// runtime only knows a thread's counters once it has closed an interval,
+// and cannot see counts still held in promoted loop registers
+// (promote=true) or in edge counters (placement=edge); those are lost.
+// fork leaves the parent's counters and intervals alone; the child drops
+// everything pending it inherited and starts counting from zero.
+//
+// Configuration is read from the environment when nugget_init runs:
+//   NUGGET_OUTPUT       Output file (default nugget_bbv.bin). A process
+//                       created by fork writes to <NUGGET_OUTPUT>.<pid>.
+//   NUGGET_BUFFER_SIZE  Output buffer size in bytes (default 1 MiB)
+//   NUGGET_BUFFER_COUNT Output buffers shared with the writer thread
+//                       (default 2, at most 64)
+//   NUGGET_VERBOSE      Print a summary to stderr at ROI end when set to 1,
+//                       with the functions that executed the most IR
+//                       instructions (named from __nugget_bb_table)
+//   NUGGET_INTERVAL_LENGTH
+//                       Interval length in IR instructions, overriding the
+//                       interval_length PhaseAnalysisPass passed to
+//                       nugget_init (mode=call only: mode=inline compiles
+//                       the length into the threshold checks)
+//   NUGGET_METRICS      Comma-separated per-interval metrics (default: tsc,
+//                       "none" for none): tsc, cycles, instructions,
+//                       llc-misses. The last three are perf_event counters
+//                       of the thread that closes the interval; they are
+//                       dropped with a warning where they cannot be opened.
+//
+// Output format (NUGGET_FILE_VERSION):
+//   struct nugget_file_header (native byte order)
+//   header.num_modules x struct nugget_file_module, sorted by id_base
+//   repeated, one record per interval:
+//     varint thread         Runtime thread index, in order of first use
+//     varint inst_count     IR instructions executed in the interval
+//     varint metric...      One per bit set in header.metrics, lowest bit
+//                           first: the metric's increase over the interval
+//     varint num_entries
+//     num_entries x (varint bb_id delta, varint count)
+//   or, for a module registered after nugget_init:
+//     varint thread         NUGGET_MODULE_RECORD
+//     varint fingerprint, varint id_base, varint num_blocks
+//                           As in struct nugget_file_module; id_base is the
+//                           number of counters so far, which grows by
+//                           num_blocks
+// Varints are unsigned LEB128. Entries are sorted by bb_id and each stores
+// the difference to the previous entry's bb_id (the first one to 0). Only
+// blocks executed in the interval have an entry. A module record precedes
+// every interval with one of its bb_ids. Interval records are not
+// numbered: the interval index is the record's position in the file,
+// module records not counted, and the clock (instructions of all threads
+// up to the end of the interval) is the sum of inst_count over the
+// intervals so far. tools/BBVTraceReader.hh decodes it.
+//
+// A thread closes its interval once it has executed interval_length
+// instructions, so a trace recorded with a short interval can be merged
+// into any multiple of it offline (nugget-bbv aggregate) instead of
+// profiling the program again for every interval length.
+
+#ifndef _NUGGET_RT_H_
+#define _NUGGET_RT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NUGGET_FILE_MAGIC "NUGGETBB"
+#define NUGGET_FILE_VERSION 1
+
+// Thread of a record that adds a module rather than closing an interval
+#define NUGGET_MODULE_RECORD UINT64_MAX
+
+// Bits of nugget_file_header.metrics
+#define NUGGET_METRIC_TSC          (1u << 0)  // Timestamp counter ticks (x86
+                                              // TSC, aarch64 CNTVCT, else ns)
+#define NUGGET_METRIC_CYCLES       (1u << 1)  // perf cycles
+#define NUGGET_METRIC_INSTRUCTIONS (1u << 2)  // perf instructions
+#define NUGGET_METRIC_LLC_MISSES   (1u << 3)  // perf cache-misses (the last
+                                              // level cache on most CPUs)
+#define NUGGET_NUM_METRICS 4
+
+// Bits of nugget_bb_info.flags
+#define NUGGET_BB_ENTRY  (1u << 0)   // Entry block of its function
+#define NUGGET_BB_RETURN (1u << 1)   // Ends in a return
+#define NUGGET_BB_CALL   (1u << 2)   // Calls a function other than an
+                                     // intrinsic
+
+// Entry of the __nugget_bb_table PhaseAnalysisPass emits, indexed by bb_id.
+// Copies of a labeled block made by inlining, unrolling or other cloning
+// share its bb_id but may have been optimized to different sizes; the entry
+// holds the size of the first copy in the module, and mode=call counts that
+// size for every copy. mode=inline adds the size of each copy itself, so
+// the two modes can report different instruction counts for such a program.
+struct nugget_bb_info {
+    uint32_t inst_count;     // IR instructions of the block
+    uint32_t function_id;    // Index into __nugget_function_names
+    uint32_t flags;          // NUGGET_BB_*
+};
+
+// nugget_module.id_base of an id_base=auto module
+#define NUGGET_ID_BASE_AUTO UINT64_MAX
+
+// Module descriptor PhaseAnalysisPass emits with id_base=auto or
+// id_base=<N> and registers from a constructor
+struct nugget_module {
+    uint64_t fingerprint;    // nugget_module_fingerprint of the module
+    uint64_t id_base;        // <N>, or NUGGET_ID_BASE_AUTO
+    uint64_t num_blocks;     // Entries of bb_table
+    const struct nugget_bb_info *bb_table;     // Indexed by the module's
+                                               // own bb_id
+    const char *const *function_names;         // Indexed by function_id
+    uint64_t num_functions;
+    uint64_t *assigned_base; // Base the runtime assigned, added by the
+                             // module to its bb_ids; initially <N>, or 0
+};
+
+// Module table entry of a trace
+struct nugget_file_module {
+    uint64_t fingerprint;    // nugget_module_fingerprint of the module
+    uint64_t id_base;        // bb_id of the module's bb_id 0 in the trace
+    uint64_t num_blocks;     // bb_ids id_base .. id_base + num_blocks - 1
+};
+
+struct nugget_file_header {
+    char magic[8];           // NUGGET_FILE_MAGIC, not NUL-terminated
+    uint32_t version;        // NUGGET_FILE_VERSION
+    uint32_t header_size;    // Size of the header and the module table;
+                             // records start at this offset
+    uint64_t fingerprint;    // nugget_module_fingerprint of the program, 0 if
+                             // it was not built by PhaseAnalysisPass or has
+                             // several modules
+    uint64_t num_counters;   // Counters when the trace was opened; module
+                             // records add more
+    uint64_t metrics;        // NUGGET_METRIC_* recorded with every interval
+    uint64_t interval_length;  // Instructions per interval
+    uint64_t num_modules;    // Entries of the module table
+};
+
+// PhaseAnalysisPass ABI
+extern const struct nugget_bb_info __nugget_bb_table[];
+extern const uint64_t __nugget_bb_table_size;
+extern const char *const __nugget_function_names[];
+extern const uint64_t __nugget_num_functions;
+void nugget_register_module(const struct nugget_module *module);
+void nugget_init(uint64_t total_bb_count, uint64_t interval_length);
+void nugget_bb_hook(uint64_t bb_id);
+void nugget_interval_hook(uint64_t *bb_counters, uint64_t num_counters,
+                          uint64_t inst_count);
+void nugget_sparse_interval_hook(uint64_t *bb_counters, uint32_t *touched_ids,
+                                 uint64_t num_touched, uint64_t inst_count);
+void nugget_roi_begin_(void);
+void nugget_roi_end_(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _NUGGET_RT_H_
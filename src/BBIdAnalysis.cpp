@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "BBIdAnalysis.hh"
+
+AnalysisKey BBIdAnalysis::Key;
+
+BBIdAnalysis::Result BBIdAnalysis::run(Module &M, ModuleAnalysisManager &) {
+  Result result;
+  for (Function &F : M) {
+    if (F.isDeclaration()) continue;
+
+    // Skip function if it is one of the nugget helper functions
+    if (std::find(nugget_functions.begin(), nugget_functions.end(),
+                  F.getName().str()) != nugget_functions.end()) {
+        continue;
+    }
+
+    for (BasicBlock &BB : F) {
+      Instruction *T = BB.getTerminator();
+      if (!T) {
+        result.unlabeled_.push_back({&BB, Unlabeled::NoTerminator});
+        continue;
+      }
+      MDNode *bb_id_md = T->getMetadata(kBbIdKey);
+      if (!bb_id_md) {
+        result.unlabeled_.push_back({&BB, Unlabeled::MissingMetadata});
+        continue;
+      }
+      std::optional<uint64_t> bb_id = parseBBId(bb_id_md);
+      if (!bb_id) {
+        result.unlabeled_.push_back({&BB, Unlabeled::InvalidMetadata});
+        continue;
+      }
+      result.blocks_.push_back({&BB, *bb_id});
+      result.id_to_block_.try_emplace(*bb_id, &BB);
+      result.block_to_id_[&BB] = *bb_id;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _BBIDANALYSIS_HH_
+#define _BBIDANALYSIS_HH_
+
+#include "common.hh"
+
+// BBIdAnalysis - module analysis mapping basic blocks to their !bb.id.
+//
+// Walks every function of the module once (skipping declarations and
+// nugget_functions), decodes the !bb.id metadata of each terminator and
+// caches the result in the ModuleAnalysisManager, so the passes that look
+// labels up share one walk:
+//
+//   const BBIdAnalysis::Result &ids = MAM.getResult<BBIdAnalysis>(M);
+//   if (BasicBlock *BB = ids.lookup(42)) { ... }
+//
+// The result holds BasicBlock pointers, so a pass that adds, removes or
+// relabels blocks must not preserve it. IRBBLabelPass abandons it and the
+// inline modes of PhaseAnalysisPass preserve nothing; passes that only
+// insert instructions before terminators preserve it.
+//
+// Transforms that clone labeled blocks (inlining, unrolling) leave several
+// blocks with the same bb_id. All of them are in blocks(); lookup() returns
+// the first one in module order.
+class BBIdAnalysis : public AnalysisInfoMixin<BBIdAnalysis> {
+    friend AnalysisInfoMixin<BBIdAnalysis>;
+    static AnalysisKey Key;
+  public:
+    // Why a block of a walked function has no bb_id
+    enum class Unlabeled { NoTerminator, MissingMetadata, InvalidMetadata };
+
+    struct LabeledBB {
+        BasicBlock *block;
+        uint64_t bb_id;
+    };
+
+    class Result {
+      public:
+        // Labeled blocks in module order
+        const std::vector<LabeledBB> &blocks() const { return blocks_; }
+        // Blocks without a usable label, in module order
+        const std::vector<std::pair<BasicBlock *, Unlabeled>> &
+        unlabeled() const { return unlabeled_; }
+
+        // First block labeled bb_id, or nullptr
+        BasicBlock *lookup(uint64_t bb_id) const {
+            return id_to_block_.lookup(bb_id);
+        }
+        // Label of BB, or std::nullopt if it has none
+        std::optional<uint64_t> getId(const BasicBlock *BB) const {
+            auto it = block_to_id_.find(BB);
+            if (it == block_to_id_.end()) {
+                return std::nullopt;
+            }
+            return it->second;
+        }
+      private:
+        friend class BBIdAnalysis;
+        std::vector<LabeledBB> blocks_;
+        std::vector<std::pair<BasicBlock *, Unlabeled>> unlabeled_;
+        DenseMap<uint64_t, BasicBlock *> id_to_block_;
+        DenseMap<const BasicBlock *, uint64_t> block_to_id_;
+    };
+
+    Result run(Module &M, ModuleAnalysisManager &);
+};
+
+#endif // _BBIDANALYSIS_HH_
@@ -30,36 +30,325 @@
 
 #include "IRBBLabelPass.hh"
 
+// Functions per shard. Shards are formatted a few at a time and written as
+// soon as they are done, so this bounds the rows held in memory.
+static constexpr size_t kFunctionsPerShard = 64;
+
+// Shards in flight per worker thread. More shards than threads keeps every
+// thread busy while the calling thread writes finished ones.
+static constexpr size_t kShardsPerThread = 4;
+
+// Buffer of the CSV output stream.
+static constexpr size_t kCsvBufferSize = 1 << 20;
+
+// Appends name to the shard's part of the database string pool and returns
+// its offset there. Empty names share offset 0 of the whole pool.
+static uint64_t addDatabaseName(IRBBLabelPass::FunctionShard &shard,
+                                StringRef name) {
+    if (name.empty()) {
+        return 0;
+    }
+    uint64_t offset = shard.db_strings.size();
+    shard.db_strings.append(name.data(), name.size());
+    shard.db_strings.push_back('\0');
+    return offset;
+}
+
+// The distinct successors of BB in terminator order; a switch with several
+// cases branching to one block yields one edge.
+static void uniqueSuccessors(BasicBlock &BB,
+                             SmallVectorImpl<BasicBlock *> &successors) {
+    successors.clear();
+    for (BasicBlock *successor : llvm::successors(&BB)) {
+        if (!is_contained(successors, successor)) {
+            successors.push_back(successor);
+        }
+    }
+}
+
+// Counts the instruction mix of BB into features.
+static void countInstructionMix(const BasicBlock &BB,
+                                BBDatabaseFeatures &features) {
+    for (const Instruction &I : BB) {
+        switch (I.getOpcode()) {
+        case Instruction::Load:
+            features.loads++;
+            break;
+        case Instruction::Store:
+            features.stores++;
+            break;
+        case Instruction::Br:
+        case Instruction::Switch:
+        case Instruction::IndirectBr:
+        case Instruction::CallBr:
+            features.branches++;
+            break;
+        case Instruction::FNeg:
+        case Instruction::FAdd:
+        case Instruction::FSub:
+        case Instruction::FMul:
+        case Instruction::FDiv:
+        case Instruction::FRem:
+        case Instruction::FCmp:
+        case Instruction::FPTrunc:
+        case Instruction::FPExt:
+        case Instruction::FPToUI:
+        case Instruction::FPToSI:
+        case Instruction::UIToFP:
+        case Instruction::SIToFP:
+            features.fp_ops++;
+            break;
+        default:
+            break;
+        }
+        // callbr is counted as a branch above
+        if ((isa<CallInst>(I) || isa<InvokeInst>(I)) &&
+            !isa<DbgInfoIntrinsic>(I)) {
+            features.calls++;
+        }
+        bool vector = I.getType()->isVectorTy();
+        for (const Use &operand : I.operands()) {
+            vector |= operand->getType()->isVectorTy();
+        }
+        if (vector) {
+            features.vector_ops++;
+        }
+    }
+}
+
+// Stable ID of a block for id_scheme=hash: FNV-1a of the function's
+// (mangled) name, the block's position in the function and its opcodes.
+// Unlike the dense bb.id it does not depend on the rest of the module, so a
+// block keeps it until its function is renamed, or the block or one laid
+// out before it in the same function changes.
+static uint64_t stableBlockId(StringRef function_name, uint64_t index,
+                              const BasicBlock &BB) {
+    uint64_t hash = fnv1a64(function_name);
+    hash = fnv1a64(StringRef("\0", 1), hash);
+    hash = fnv1a64(std::to_string(index), hash);
+    for (const Instruction &I : BB) {
+        hash = fnv1a64(",", hash);
+        hash = fnv1a64(I.getOpcodeName(), hash);
+    }
+    return hash;
+}
+
+// What to export besides the basic CSV rows.
+struct ExportConfig {
+    bool write_db;      // Database records (output_db)
+    bool features;      // Static features (features=true)
+    bool stable_ids;    // StableID column (id_scheme=hash)
+};
+
+// Appends the CSV rows of the shard's functions to shard.csv_rows, and with
+// write_db their database records. With stable_ids, the stable ID and with
+// features, the static features follow every row. Only reads the module,
+// so shards can be formatted concurrently; the loop analysis is computed
+// locally for that reason rather than taken from the (single-threaded)
+// analysis manager.
+static void formatShardRows(const std::vector<Function *> &functions,
+                            IRBBLabelPass::FunctionShard &shard,
+                            const ExportConfig &config) {
+    bool write_db = config.write_db;
+    bool features = config.features;
+    raw_string_ostream rows(shard.csv_rows);
+    uint64_t bb_id = shard.first_bb_id;
+    uint64_t successor_index = shard.first_successor;
+    DenseMap<const BasicBlock *, uint64_t> bb_ids;
+    SmallVector<BasicBlock *, 4> successors;
+    for (size_t f = shard.first_function; f < shard.end_function; f++) {
+        Function &F = *functions[f];
+        // Function name (mangled for C++), looked up once per function
+        StringRef function_name = F.getName();
+        if (write_db) {
+            shard.db_functions.push_back({addDatabaseName(shard,
+                    function_name), function_name.size(), bb_id,
+                    F.size()});
+        }
+        std::optional<DominatorTree> DT;
+        std::optional<LoopInfo> LI;
+        if (features) {
+            bb_ids.clear();
+            uint64_t next_id = bb_id;
+            for (const BasicBlock &BB : F) {
+                bb_ids[&BB] = next_id++;
+            }
+            DT.emplace(F);
+            LI.emplace(*DT);
+        }
+        uint64_t index = 0;
+        for (BasicBlock &BB : F) {
+            // Function name, function ID, BB label ("" for entry block),
+            // instruction count, BB ID
+            rows << function_name << "," << f << "," << BB.getName() << ","
+                 << BB.size() << "," << bb_id;
+            if (config.stable_ids) {
+                uint64_t stable_id = stableBlockId(function_name, index, BB);
+                shard.stable_ids.push_back(stable_id);
+                rows << "," << stable_id;
+            }
+            index++;
+            if (write_db) {
+                shard.db_blocks.push_back({addDatabaseName(shard,
+                        BB.getName()), static_cast<uint32_t>(
+                        BB.getName().size()), static_cast<uint32_t>(f),
+                        static_cast<uint32_t>(BB.size()), 0});
+            }
+            if (features) {
+                BBDatabaseFeatures block_features = {};
+                countInstructionMix(BB, block_features);
+                block_features.loop_depth = LI->getLoopDepth(&BB);
+                if (LI->isLoopHeader(&BB)) {
+                    block_features.flags |= BBDB_LOOP_HEADER;
+                }
+                uniqueSuccessors(BB, successors);
+                block_features.first_successor = successor_index;
+                block_features.num_successors = successors.size();
+                successor_index += successors.size();
+
+                rows << "," << block_features.loads << ","
+                     << block_features.stores << ","
+                     << block_features.branches << ","
+                     << block_features.calls << ","
+                     << block_features.fp_ops << ","
+                     << block_features.vector_ops << ","
+                     << block_features.loop_depth << ","
+                     << ((block_features.flags & BBDB_LOOP_HEADER) ? 1 : 0)
+                     << ",";
+                for (size_t i = 0; i < successors.size(); i++) {
+                    rows << (i ? " " : "") << bb_ids[successors[i]];
+                    if (write_db) {
+                        shard.db_successors.push_back(bb_ids[successors[i]]);
+                    }
+                }
+                if (write_db) {
+                    shard.db_features.push_back(block_features);
+                }
+            }
+            rows << "\n";
+            bb_id++;
+        }
+    }
+    rows.flush();
+}
+
+// Writes a formatted shard to the database: its names are appended to the
+// string pool, which the stream is positioned in, and its records are
+// written in place. strings_size is the size of the pool so far.
+static void writeShardDatabase(raw_fd_ostream &db,
+                               const BBDatabaseHeader &header,
+                               IRBBLabelPass::FunctionShard &shard,
+                               uint64_t &strings_size) {
+    for (BBDatabaseBlock &block : shard.db_blocks) {
+        if (block.name_size != 0) {
+            block.name_offset += strings_size;
+        }
+    }
+    for (BBDatabaseFunction &function : shard.db_functions) {
+        if (function.name_size != 0) {
+            function.name_offset += strings_size;
+        }
+    }
+    db << shard.db_strings;
+    strings_size += shard.db_strings.size();
+
+    db.pwrite(reinterpret_cast<const char *>(shard.db_blocks.data()),
+              shard.db_blocks.size() * sizeof(BBDatabaseBlock),
+              header.blocks_offset +
+                  shard.first_bb_id * sizeof(BBDatabaseBlock));
+    db.pwrite(reinterpret_cast<const char *>(shard.db_functions.data()),
+              shard.db_functions.size() * sizeof(BBDatabaseFunction),
+              header.functions_offset +
+                  shard.first_function * sizeof(BBDatabaseFunction));
+    if (header.features_offset != 0) {
+        db.pwrite(reinterpret_cast<const char *>(shard.db_features.data()),
+                  shard.db_features.size() * sizeof(BBDatabaseFeatures),
+                  header.features_offset +
+                      shard.first_bb_id * sizeof(BBDatabaseFeatures));
+        db.pwrite(reinterpret_cast<const char *>(shard.db_successors.data()),
+                  shard.db_successors.size() * sizeof(uint64_t),
+                  header.successors_offset +
+                      shard.first_successor * sizeof(uint64_t));
+    }
+    shard.db_blocks = std::vector<BBDatabaseBlock>();
+    shard.db_functions = std::vector<BBDatabaseFunction>();
+    if (header.stable_ids_offset != 0) {
+        db.pwrite(reinterpret_cast<const char *>(shard.stable_ids.data()),
+                  shard.stable_ids.size() * sizeof(uint64_t),
+                  header.stable_ids_offset +
+                      shard.first_bb_id * sizeof(uint64_t));
+    }
+    shard.db_features = std::vector<BBDatabaseFeatures>();
+    shard.db_successors = std::vector<uint64_t>();
+    shard.db_strings = std::string();
+}
+
+// Attaches !bb.id metadata to the terminators of the shard's functions.
+// Creating the metadata uniques it in the LLVMContext, so this must only
+// run on one thread.
+static void labelShardBlocks(LLVMContext &C,
+                             const std::vector<Function *> &functions,
+                             const IRBBLabelPass::FunctionShard &shard) {
+    uint64_t bb_id = shard.first_bb_id;
+    for (size_t f = shard.first_function; f < shard.end_function; f++) {
+        for (BasicBlock &BB : *functions[f]) {
+            // Terminator is the last instruction in a BB (the branch
+            // instruction)
+            Instruction *T = BB.getTerminator();
+            if (T) {
+                // Create metadata node: !bb.id !N where !N = !{i64 <bb_id>}
+                T->setMetadata(kBbIdKey, makeBBIdMetadata(C, bb_id++));
+            } else {
+                // Fatal error if basic block has no terminator (malformed IR)
+                // This should never happen with valid LLVM IR
+                report_fatal_error(Twine("BasicBlock ") + BB.getName() +
+                        " in function " + functions[f]->getName() +
+                        " has no terminator instruction.");
+            }
+        }
+    }
+}
+
 // IRBBLabelPass::run - Main pass execution function.
 //
 // Processes the entire LLVM module to assign unique IDs to all basic blocks,
-// attach metadata, and export collected information to CSV.
+// attach metadata, and stream collected information to CSV.
 //
 // Algorithm:
-//   1. Initialize counters for functions and basic blocks
-//   2. Iterate through all functions in the module
-//      - Skip function declarations (F.isDeclaration())
-//      - For each basic block:
-//        a. Assign globally unique ID
-//        b. Attach !bb.id metadata to terminator instruction
-//        c. Collect basic block statistics
-//   3. Write collected data to CSV file
+//   1. Collect the functions to label in module order, skipping
+//      declarations and nugget helpers; a function's index is its ID
+//   2. Split them into shards of consecutive functions and count each
+//      shard's basic blocks on the thread pool
+//   3. Prefix-sum the counts into each shard's first BB ID, so IDs match a
+//      single sequential walk
+//   4. Format the shards' CSV rows (and database records) on the thread
+//      pool, a bounded number at a time. In shard order, this thread writes
+//      each finished shard to the CSV file (and database), hashes it into
+//      the fingerprint, frees it and attaches !bb.id metadata to its
+//      terminators
+//   5. Record the fingerprint in the !nugget.fingerprint named metadata and
+//      the database header
 //
 // Args:
 //   M: LLVM Module to instrument
 //   AM: Module analysis manager (unused)
 //
 // Returns:
-//   PreservedAnalyses::all() - Metadata doesn't invalidate analyses
+//   Every analysis except BBIdAnalysis - Metadata doesn't invalidate the
+//   CFG or dominators, but a cached BBIdAnalysis holds the old labels
 PreservedAnalyses IRBBLabelPass::run(Module &M, ModuleAnalysisManager &) {
     LLVMContext &C = M.getContext();
-    
-    // Initialize counters for assigning unique IDs
-    uint64_t function_counter = 0;            // Function ID counter
-    uint64_t basic_block_global_counter = 0;  // Global BB ID counter
-    bb_info_list_.clear();  // Clear any existing data from previous runs
+    unsigned threads = std::stoul(GetOptionValue(options_, "threads"));
+    bool features = GetOptionValue(options_, "features") == "true";
+    std::string id_scheme = GetOptionValue(options_, "id_scheme");
+    if (id_scheme != "sequential" && id_scheme != "hash") {
+        report_fatal_error(Twine("Unknown ir-bb-label-pass id_scheme: ") +
+                           id_scheme);
+    }
+    bool stable_ids = id_scheme == "hash";
 
-    // Iterate through all functions in the module
+    // Collect the functions to label; the position is the function ID
+    std::vector<Function *> functions;
     for (Function &F : M) {
         // Skip function declarations (external functions without definitions)
         // isDeclaration() returns true for functions like printf, malloc, etc.
@@ -70,75 +359,187 @@ PreservedAnalyses IRBBLabelPass::run(Module &M, ModuleAnalysisManager &) {
                       F.getName().str()) != nugget_functions.end()) {
             continue;
         }
+        functions.push_back(&F);
+    }
 
-        // Process each basic block in the function
-        for (BasicBlock &BB : F) {
-            // Assign globally unique basic block ID and increment counter
-            uint64_t bb_id = basic_block_global_counter++;
+    // Split the functions into shards of consecutive functions
+    std::vector<FunctionShard> shards;
+    for (size_t f = 0; f < functions.size(); f += kFunctionsPerShard) {
+        FunctionShard shard;
+        shard.first_function = f;
+        shard.end_function = std::min(functions.size(),
+                                      f + kFunctionsPerShard);
+        shards.push_back(std::move(shard));
+    }
 
-            // Attach !bb.id metadata to the terminator instruction
-            // Terminator is the last instruction in a BB (the branch 
-            // instruction)
-            Instruction *T = BB.getTerminator();
-            if (T) {
-                // Create metadata node: !bb.id !N where !N = !{"<bb_id>"}
-                // The ID is stored as a string within an MDString node
-                MDNode *N = MDNode::get(C, MDString::get(
-                                                    C, std::to_string(bb_id)));
-                T->setMetadata(kBbIdKey, N);
-            } else {
-                // Fatal error if basic block has no terminator (malformed IR)
-                // This should never happen with valid LLVM IR
-                report_fatal_error(Twine("BasicBlock ") + BB.getName() +
-                        " in function " + F.getName() +
-                        " has no terminator instruction.");
+    // Count the basic blocks (and with features, the CFG edges) of every
+    // shard
+    ThreadPoolStrategy strategy = hardware_concurrency(threads);
+    NuggetThreadPool pool(strategy);
+    for (FunctionShard &shard : shards) {
+        pool.async([&functions, &shard, features] {
+            SmallVector<BasicBlock *, 4> successors;
+            for (size_t f = shard.first_function; f < shard.end_function;
+                 f++) {
+                shard.num_blocks += functions[f]->size();
+                if (!features) {
+                    continue;
+                }
+                for (BasicBlock &BB : *functions[f]) {
+                    uniqueSuccessors(BB, successors);
+                    shard.num_successors += successors.size();
+                }
             }
+        });
+    }
+    pool.wait();
 
-            // Collect basic block information for CSV export
-            BasicBlockInfo bb_info;
-            // Function name (mangled for C++)
-            bb_info.function_name = F.getName().str();  
-            // Current function's ID
-            bb_info.function_id = function_counter;   
-            // BB label ("" for entry block)   
-            bb_info.basic_block_name = BB.getName().str();  
-            // Number of instructions
-            bb_info.basic_block_inst_count = BB.size(); 
-            // Globally unique BB ID 
-            bb_info.basic_block_id = bb_id;              
-
-            bb_info_list_.push_back(bb_info);
-        }
-        // Increment function counter after processing all BBs in this function
-        function_counter++;
+    // Each shard's IDs (and edges) start where the previous shard's end
+    uint64_t basic_block_global_counter = 0;  // Global BB ID counter
+    uint64_t successor_counter = 0;
+    for (FunctionShard &shard : shards) {
+        shard.first_bb_id = basic_block_global_counter;
+        basic_block_global_counter += shard.num_blocks;
+        shard.first_successor = successor_counter;
+        successor_counter += shard.num_successors;
     }
 
-    // Export collected basic block information to CSV file
-    // File path is specified in options_[0].option_value (default: 
-    //                                                          "bb_info.csv")
+    // Stream the CSV: file path is given by the output_csv option
+    // (default: "bb_info.csv")
     std::error_code EC;
     raw_fd_ostream csv_file(GetOptionValue(options_, "output_csv"), EC, sys::fs::OF_Text);
     if (EC) {
         report_fatal_error(Twine("Error opening file ") + GetOptionValue(options_, "output_csv")
                + ": " + EC.message());
     }
+    csv_file.SetBufferSize(kCsvBufferSize);
     
     // Write CSV header row
     csv_file << "FunctionName,FunctionID,BasicBlockName,"
-                                    << "BasicBlockInstCount,BasicBlockID\n";
+                                    << "BasicBlockInstCount,BasicBlockID";
+    if (stable_ids) {
+        csv_file << ",StableID";
+    }
+    if (features) {
+        csv_file << ",Loads,Stores,Branches,Calls,FPOps,VectorOps,LoopDepth,"
+                 << "LoopHeader,Successors";
+    }
+    csv_file << "\n";
+
+    // The database sections are sized up front from the block counts. The
+    // records are written in place shard by shard while the string pool,
+    // the last section, grows at the end of the file.
+    std::string db_path = GetOptionValue(options_, "output_db");
+    bool write_db = db_path != "none";
+    std::optional<raw_fd_ostream> db_file;
+    BBDatabaseHeader db_header = {};
+    uint64_t db_strings_size = 1;  // The empty name at offset 0
+    if (write_db) {
+        db_file.emplace(db_path, EC, sys::fs::OF_None);
+        if (EC) {
+            report_fatal_error(Twine("Error opening file ") + db_path + ": " +
+                               EC.message());
+        }
+        if (!db_file->supportsSeeking()) {
+            report_fatal_error(Twine("BB database ") + db_path +
+                               " must be a regular file");
+        }
+        std::memcpy(db_header.magic, kBBDatabaseMagic, sizeof(db_header.magic));
+        db_header.version = kBBDatabaseVersion;
+        db_header.header_size = sizeof(BBDatabaseHeader);
+        db_header.num_blocks = basic_block_global_counter;
+        db_header.num_functions = functions.size();
+        db_header.blocks_offset = sizeof(BBDatabaseHeader);
+        db_header.functions_offset = db_header.blocks_offset +
+                db_header.num_blocks * sizeof(BBDatabaseBlock);
+        db_header.strings_offset = db_header.functions_offset +
+                db_header.num_functions * sizeof(BBDatabaseFunction);
+        if (features) {
+            db_header.features_offset = db_header.strings_offset;
+            db_header.num_successors = successor_counter;
+            db_header.successors_offset = db_header.features_offset +
+                    db_header.num_blocks * sizeof(BBDatabaseFeatures);
+            db_header.strings_offset = db_header.successors_offset +
+                    db_header.num_successors * sizeof(uint64_t);
+        }
+        if (stable_ids) {
+            db_header.stable_ids_offset = db_header.strings_offset;
+            db_header.remap_offset = db_header.stable_ids_offset +
+                    db_header.num_blocks * sizeof(uint64_t);
+            db_header.strings_offset = db_header.remap_offset +
+                    db_header.num_blocks * sizeof(BBDatabaseRemap);
+        }
+        db_file->SetBufferSize(kCsvBufferSize);
+        db_file->seek(db_header.strings_offset);
+        db_file->write('\0');
+    }
     
-    // Write data rows (one per basic block)
-    for (const auto &bb_info : bb_info_list_) {
-        csv_file << bb_info.function_name << ","
-                << bb_info.function_id << ","
-                // Empty string is allowed
-                << bb_info.basic_block_name << ","  
-                << bb_info.basic_block_inst_count << ","
-                << bb_info.basic_block_id << "\n";
+    // Write data rows (one per basic block) shard by shard, hashing them
+    // into the module fingerprint as they are written. FNV-1a consumes bytes
+    // in order, so hashing shard by shard equals hashing row by row.
+    size_t window = strategy.compute_thread_count() * kShardsPerThread;
+    std::deque<std::shared_future<void>> in_flight;
+    size_t next_shard = 0;
+    uint64_t fingerprint = kFnv1a64Basis;
+    ExportConfig config = {write_db, features, stable_ids};
+    std::vector<BBDatabaseRemap> remap;  // Stable ID to bb.id
+    for (FunctionShard &shard : shards) {
+        // Keep up to window shards formatting ahead of the writer
+        while (next_shard < shards.size() && in_flight.size() < window) {
+            FunctionShard &ahead = shards[next_shard++];
+            in_flight.push_back(pool.async([&functions, &ahead, &config] {
+                formatShardRows(functions, ahead, config);
+            }));
+        }
+        in_flight.front().wait();
+        in_flight.pop_front();
+
+        fingerprint = fnv1a64(shard.csv_rows, fingerprint);
+        csv_file << shard.csv_rows;
+        shard.csv_rows = std::string();
+        if (write_db) {
+            writeShardDatabase(*db_file, db_header, shard, db_strings_size);
+        }
+        for (size_t i = 0; i < shard.stable_ids.size(); i++) {
+            remap.push_back({shard.stable_ids[i], shard.first_bb_id + i});
+        }
+        shard.stable_ids = std::vector<uint64_t>();
+
+        // The workers are done reading this shard's functions
+        labelShardBlocks(C, functions, shard);
     }
+    pool.wait();
     csv_file.close();
+    setModuleFingerprint(M, fingerprint);
+
+    // Stable IDs must be unique to be usable as keys
+    std::sort(remap.begin(), remap.end(),
+              [](const BBDatabaseRemap &a, const BBDatabaseRemap &b) {
+                  return a.stable_id < b.stable_id;
+              });
+    for (size_t i = 1; i < remap.size(); i++) {
+        if (remap[i].stable_id == remap[i - 1].stable_id) {
+            report_fatal_error(Twine("Basic blocks ") + Twine(remap[i - 1].bb_id)
+                    + " and " + Twine(remap[i].bb_id) +
+                    " have the same stable ID; use id_scheme=sequential");
+        }
+    }
+    if (write_db && stable_ids) {
+        db_file->pwrite(reinterpret_cast<const char *>(remap.data()),
+                        remap.size() * sizeof(BBDatabaseRemap),
+                        db_header.remap_offset);
+    }
+    if (write_db) {
+        db_header.fingerprint = fingerprint;
+        db_header.strings_size = db_strings_size;
+        db_file->pwrite(reinterpret_cast<const char *>(&db_header),
+                        sizeof(db_header), 0);
+        db_file->close();
+    }
     
-    // Return PreservedAnalyses::all() because metadata addition doesn't
-    // invalidate any existing analyses (CFG, dominators, etc. remain valid)
-    return PreservedAnalyses::all();
+    // Adding metadata doesn't invalidate the CFG, dominators, etc., but it
+    // does change the labels a cached BBIdAnalysis result holds
+    PreservedAnalyses preserved = PreservedAnalyses::all();
+    preserved.abandon<BBIdAnalysis>();
+    return preserved;
 }
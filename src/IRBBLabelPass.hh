@@ -29,6 +29,7 @@
 #ifndef _IRBBLABELPASS_HH_
 #define _IRBBLABELPASS_HH_
 
+#include "BBIdAnalysis.hh"
 #include "common.hh"
 // IRBBLabelPass - Basic block instrumentation and labeling pass.
 //
@@ -37,7 +38,9 @@
 //   1. Assigns globally unique IDs to each basic block in the module
 //   2. Attaches !bb.id metadata to terminator instructions  
 //   3. Collects basic block statistics (name, instruction count, function)
-//   4. Exports data to CSV for analysis and validation
+//   4. Exports data to CSV for analysis and validation, and optionally to
+//      a binary BB database (see BBDatabaseHeader)
+//   5. Records the FNV-1a hash of the CSV rows as !nugget.fingerprint
 //
 // Usage:
 //   opt -load-pass-plugin=NuggetPasses.so \
@@ -50,15 +53,121 @@
 //   main,0,if.then,3,1
 //   main,0,if.end,2,2
 //
+// With id_scheme=hash a StableID column follows BasicBlockID (see
+// stableBlockId in IRBBLabelPass.cpp). BasicBlockID stays the dense index
+// the instrumentation and runtimes use, so the rows are the remap table
+// between the two.
+//
+// With features=true every row also has the static features of the block
+// (see BBDatabaseFeatures), the successors as space-separated BB IDs:
+//   ...,BasicBlockID,Loads,Stores,Branches,Calls,FPOps,VectorOps,
+//       LoopDepth,LoopHeader,Successors
+//   main,0,,5,0,1,2,1,0,0,0,0,0,1 2
+//
 // The pass is parameterized with the following options:
 //   output_csv: Output CSV filename (default: bb_info.csv)
+//   output_db:  Binary BB database filename, or none (default: none)
+//   features:   Also export static block features (default: false)
+//   id_scheme:  sequential, or hash to also export IDs that survive
+//               rebuilds (default: sequential)
+//   threads:    Worker threads, 0 for one per core (default: 1). IDs, CSV
+//               and fingerprint do not depend on it.
 
 // Contains default values for pass parameters. Users can override these
 // via parameterized pass invocation syntax.
 static const std::vector<Options> IRBBLabelPassOptions = {
-    {"output_csv", "bb_info.csv"}  // Default output file name
+    {"output_csv", "bb_info.csv"}, // Default output file name
+    {"output_db", "none"},         // Binary BB database (none = not written)
+    {"features", "false"},         // Export instruction mix, loops and edges
+    {"id_scheme", "sequential"},   // sequential | hash (adds StableID)
+    {"threads", "1"}               // Labeling threads (0 = one per core)
+};
+
+// Binary BB database written with output_db, so tools can look blocks up
+// by bb.id in O(1) from a read-only mapping instead of parsing the CSV.
+// Must match tools/BBDatabaseReader.hh.
+//
+// Layout, in native byte order:
+//   BBDatabaseHeader
+//   BBDatabaseBlock[num_blocks]        indexed by bb.id
+//   BBDatabaseFunction[num_functions]  indexed by function ID
+//   with features=true (features_offset != 0):
+//     BBDatabaseFeatures[num_blocks]   indexed by bb.id
+//     uint64_t[num_successors]         successor BB IDs of all blocks
+//   with id_scheme=hash (stable_ids_offset != 0):
+//     uint64_t[num_blocks]             stable ID, indexed by bb.id
+//     BBDatabaseRemap[num_blocks]      sorted by stable ID
+//   string pool of NUL-terminated names; offsets are relative to its start
+//   and offset 0 is the empty name
+static constexpr char kBBDatabaseMagic[8] = {'N', 'U', 'G', 'B', 'B', 'D',
+                                             'B', '\0'};
+static constexpr uint32_t kBBDatabaseVersion = 1;
+
+struct BBDatabaseHeader {
+    char magic[8];              // kBBDatabaseMagic
+    uint32_t version;           // kBBDatabaseVersion
+    uint32_t header_size;       // sizeof(BBDatabaseHeader)
+    uint64_t fingerprint;       // Same as !nugget.fingerprint
+    uint64_t num_blocks;
+    uint64_t num_functions;
+    uint64_t blocks_offset;     // File offsets of the sections
+    uint64_t functions_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t features_offset;   // 0 without features
+    uint64_t successors_offset; // 0 without features
+    uint64_t num_successors;    // Entries of the successor array
+    uint64_t stable_ids_offset; // 0 unless id_scheme=hash
+    uint64_t remap_offset;      // 0 unless id_scheme=hash
+};
+
+struct BBDatabaseBlock {
+    uint64_t name_offset;       // BB label in the string pool
+    uint32_t name_size;         // Without the NUL
+    uint32_t function_id;
+    uint32_t inst_count;        // BasicBlockInstCount
+    uint32_t reserved;          // 0
+};
+
+struct BBDatabaseFunction {
+    uint64_t name_offset;       // Function name in the string pool
+    uint64_t name_size;         // Without the NUL
+    uint64_t first_bb_id;       // A function's blocks have consecutive IDs
+    uint64_t num_blocks;
 };
 
+// BBDatabaseFeatures::flags
+enum BBDatabaseFeatureFlags : uint32_t {
+    BBDB_LOOP_HEADER = 1 << 0,  // The block is the header of a loop
+};
+
+// Static features of one block. Counts are over its instructions.
+struct BBDatabaseFeatures {
+    uint32_t loads;             // LoadInst
+    uint32_t stores;            // StoreInst
+    uint32_t branches;          // Branching terminators (br, switch, ...)
+    uint32_t calls;             // Calls and invokes, debug intrinsics aside
+    uint32_t fp_ops;            // FP arithmetic, compares and conversions
+    uint32_t vector_ops;        // Instructions with a vector result/operand
+    uint32_t loop_depth;        // LoopInfo depth, 0 outside loops
+    uint32_t flags;             // BBDatabaseFeatureFlags
+    uint64_t first_successor;   // Index into the successor array
+    uint64_t num_successors;    // Distinct successors, in terminator order
+};
+
+// Stable ID to bb.id, for binary search by stable ID.
+struct BBDatabaseRemap {
+    uint64_t stable_id;
+    uint64_t bb_id;
+};
+
+static_assert(sizeof(BBDatabaseHeader) == 112 &&
+              sizeof(BBDatabaseBlock) == 24 &&
+              sizeof(BBDatabaseFunction) == 32 &&
+              sizeof(BBDatabaseFeatures) == 48 &&
+              sizeof(BBDatabaseRemap) == 16,
+              "BB database layout changed");
+
 class IRBBLabelPass : public PassInfoMixin<IRBBLabelPass> {
   public:
     // Constructor - Initializes pass with configuration options.
@@ -70,41 +179,53 @@ class IRBBLabelPass : public PassInfoMixin<IRBBLabelPass> {
     }
     ~IRBBLabelPass() = default;
 
-    // BasicBlockInfo - Stores metadata about a single basic block.
-    //
-    // Contains all relevant information collected during pass execution for
-    // a single basic block, including its relationship to its parent function.
+    // FunctionShard - A run of consecutive functions labeled by one task.
     //
-    // Fields are exported to CSV in the order declared.
-    struct BasicBlockInfo {
-        // Function metadata
-        std::string function_name;          // Function name (mangled for C++)
-        uint64_t function_id;               // Unique function identifier
-
-        // Basic block metadata
-        std::string basic_block_name;       // BB label (empty for entry block)
-        uint64_t basic_block_inst_count;    // Number of instructions in BB
-        uint64_t basic_block_id;            // Globally unique BB identifier
+    // Function IDs are indices into the list of labeled functions, and the
+    // shard's BB IDs start where the previous shard's end, so numbering is
+    // the same as one sequential walk whatever the shard boundaries. Rows
+    // are freed once written, so only the shards being formatted hold any.
+    struct FunctionShard {
+        size_t first_function;      // Index of the first function
+        size_t end_function;        // One past the last function
+        uint64_t num_blocks = 0;    // Basic blocks in the shard
+        uint64_t first_bb_id = 0;   // ID of the shard's first block
+        uint64_t num_successors = 0;   // CFG edges, with features
+        uint64_t first_successor = 0;  // Index of the shard's first edge
+        std::string csv_rows;       // The shard's CSV rows, in order
+
+        // With output_db: the shard's records, with name offsets relative to
+        // db_strings until the shard is written
+        std::vector<BBDatabaseBlock> db_blocks;
+        std::vector<BBDatabaseFunction> db_functions;
+        std::vector<BBDatabaseFeatures> db_features;
+        std::vector<uint64_t> db_successors;
+        std::string db_strings;
+
+        // With id_scheme=hash: the stable ID of each block, in bb.id order
+        std::vector<uint64_t> stable_ids;
     };
 
   private:
-    std::vector<BasicBlockInfo> bb_info_list_;  // Collected BB information
-    std::vector<Options> options_;              // Pass configuration options
+    std::vector<Options> options_;  // Pass configuration options
 
   public:
     // Main pass entry point - processes entire module.
     //
     // Iterates through all defined functions and their basic blocks,
     // assigning unique IDs and collecting statistics. After processing,
-    // exports data to CSV file specified in options.
+    // streams data to the CSV file specified in options. Counting blocks
+    // and formatting CSV rows is split across threads; metadata is attached
+    // from the calling thread since LLVMContext is not thread-safe.
     //
     // Args:
     //   M: LLVM Module to process
     //   AM: Module analysis manager (unused but required by pass interface)
     //
     // Returns:
-    //   PreservedAnalyses::all() - Pass does not invalidate any analyses
-    //     (metadata addition is transparent to analysis passes)
+    //   Every analysis except BBIdAnalysis, which is abandoned since it
+    //     caches the !bb.id labels this pass rewrites (metadata addition is
+    //     otherwise transparent to analysis passes)
     PreservedAnalyses run(Module &M, ModuleAnalysisManager &);
 };
 
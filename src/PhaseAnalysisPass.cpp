@@ -30,67 +30,1265 @@
 
 #include "PhaseAnalysisPass.hh"
 
-bool PhaseAnalysisPass::instrumentAllIRBasicBlocks(Module &M, 
-                  int64_t &total_basic_block_count, const uint64_t threshold) {
-  
-  Function* bb_hook_function = M.getFunction("nugget_bb_hook");
+// Report the blocks BBIdAnalysis could not find a label for.
+static void warnUnlabeledBlocks(const BBIdAnalysis::Result &bb_ids) {
+  for (const auto &[BB, reason] : bb_ids.unlabeled()) {
+    switch (reason) {
+    case BBIdAnalysis::Unlabeled::NoTerminator:
+      errs() << "Could not find terminator for function "
+             << BB->getParent()->getName() << " bb " << BB->getName() << "\n";
+      break;
+    case BBIdAnalysis::Unlabeled::MissingMetadata:
+      errs() << "Warning: BasicBlock " << BB->getName()
+             << " in function " << BB->getParent()->getName()
+             << " is missing !bb.id metadata.\n";
+      break;
+    case BBIdAnalysis::Unlabeled::InvalidMetadata:
+      errs() << "Warning: Invalid bb.id metadata format\n";
+      break;
+    }
+  }
+}
+
+// Call nugget_bb_hook(bb_id) at the end of every labeled block, adding the
+// module's base in id_base_global if it registers itself.
+bool PhaseAnalysisPass::instrumentAllIRBasicBlocks(Module &M,
+                  const BBIdAnalysis::Result &bb_ids,
+                  int64_t &total_basic_block_count,
+                  GlobalVariable *id_base_global) {
+  Type *i64_type = Type::getInt64Ty(M.getContext());
+  Function* bb_hook_function = getOrDeclareRuntimeFunction(M,
+      "nugget_bb_hook", FunctionType::get(Type::getVoidTy(M.getContext()),
+                                {i64_type}, false));
   if (!bb_hook_function) {
-    errs() << "Function nugget_bb_hook not found\n";
     return false;
   }
 
+  warnUnlabeledBlocks(bb_ids);
   IRBuilder<> builder(M.getContext());
-  int64_t bb_id = -1;
   total_basic_block_count = 0;
-  for (Function &F : M) {
-    if (F.isDeclaration()) continue;
-
-    // Skip function if it is one of the nugget helper functions
-    if (std::find(nugget_functions.begin(), nugget_functions.end(),
-                  F.getName().str()) != nugget_functions.end()) {
-        continue;
+  for (const BBIdAnalysis::LabeledBB &labeled : bb_ids.blocks()) {
+    BasicBlock &BB = *labeled.block;
+    builder.SetInsertPoint(BB.getTerminator());
+    Value *bb_id = ConstantInt::get(i64_type, labeled.bb_id);
+    if (id_base_global) {
+      bb_id = builder.CreateAdd(
+          builder.CreateLoad(i64_type, id_base_global), bb_id);
     }
+    builder.CreateCall(bb_hook_function, {bb_id});
+    total_basic_block_count++;
+  }
+  return true;
+}
+
+// Collect every labeled basic block of the module together with its size.
+// Instrumenting splits blocks, so the inline modes gather the blocks first
+// and only modify the CFG afterwards.
+std::vector<PhaseAnalysisPass::LabeledBlock>
+PhaseAnalysisPass::collectLabeledBlocks(const BBIdAnalysis::Result &bb_ids) {
+  warnUnlabeledBlocks(bb_ids);
+  std::vector<LabeledBlock> labeled_blocks;
+  labeled_blocks.reserve(bb_ids.blocks().size());
+  for (const BBIdAnalysis::LabeledBB &labeled : bb_ids.blocks()) {
+    labeled_blocks.push_back({labeled.block, labeled.bb_id,
+                              labeled.block->size()});
+  }
+  return labeled_blocks;
+}
+
+// Hand the interval's counters to the runtime at the builder's insertion
+// point:
+//   nugget_interval_hook(nugget_bb_counters, N, inst_count)
+// or, with a touched list,
+//   nugget_sparse_interval_hook(nugget_bb_counters, nugget_touched_ids,
+//                               nugget_num_touched, inst_count)
+//   nugget_num_touched = 0
+void PhaseAnalysisPass::emitIntervalHookCall(IRBuilder<> &builder,
+                  const InlineCounters &counters, Value *inst_count) {
+  Type *i64_type = builder.getInt64Ty();
+  // Pass the counters to the runtime as a plain i64 pointer
+  Value *counters_base = builder.CreateConstInBoundsGEP2_64(
+      counters.counters_type, counters.bb_counters, 0, 0);
+  if (!counters.touched_ids) {
+    builder.CreateCall(counters.interval_hook, {counters_base,
+        ConstantInt::get(i64_type, counters.num_counters), inst_count});
+    return;
+  }
+  Value *touched_base = builder.CreateConstInBoundsGEP2_64(
+      counters.touched_type, counters.touched_ids, 0, 0);
+  Value *num_touched = builder.CreateLoad(i64_type, counters.num_touched);
+  builder.CreateCall(counters.sparse_interval_hook, {counters_base,
+      touched_base, num_touched, inst_count});
+  builder.CreateStore(ConstantInt::get(i64_type, 0), counters.num_touched);
+}
+
+// Advance nugget_inst_counter by inst_delta before insert_point and call the
+// interval end on the cold path once the threshold is reached:
+//   nugget_inst_counter += inst_delta
+//   if (nugget_inst_counter >= threshold) {      // cold
+//     nugget_interval_hook(nugget_bb_counters, N, nugget_inst_counter)
+//     nugget_inst_counter = 0
+//   }
+// Edge placement calls nugget_edge_flush instead and compares signed, since
+// an edge can carry a negative weight.
+void PhaseAnalysisPass::emitClockUpdate(IRBuilder<> &builder,
+                  Instruction *insert_point, const InlineCounters &counters,
+                  Value *inst_delta) {
+  LLVMContext &C = insert_point->getContext();
+  Type *i64_type = Type::getInt64Ty(C);
+  builder.SetInsertPoint(insert_point);
+
+  Value *inst_count = builder.CreateLoad(i64_type, counters.inst_counter);
+  Value *new_inst_count = builder.CreateAdd(inst_count, inst_delta);
+  builder.CreateStore(new_inst_count, counters.inst_counter);
+  Value *threshold_value = ConstantInt::get(i64_type, counters.threshold);
+  Value *crossed = counters.edge_flush
+      ? builder.CreateICmpSGE(new_inst_count, threshold_value)
+      : builder.CreateICmpUGE(new_inst_count, threshold_value);
+
+  MDNode *unlikely = MDBuilder(C).createBranchWeights(1, (1U << 20) - 1);
+  Instruction *then_term = SplitBlockAndInsertIfThen(crossed, insert_point,
+                                          /*Unreachable=*/false, unlikely);
+  builder.SetInsertPoint(then_term);
+  if (counters.edge_flush) {
+    builder.CreateCall(counters.edge_flush, {new_inst_count});
+  } else {
+    emitIntervalHookCall(builder, counters, new_inst_count);
+  }
+  builder.CreateStore(ConstantInt::get(i64_type, 0), counters.inst_counter);
+}
+
+// nugget_bb_counters[bb_id] += delta at the builder's insertion point. With
+// a touched list, the first update of the interval also records the block:
+//   if (old == 0 && delta != 0)                  // delta check if needed
+//     nugget_touched_ids[nugget_num_touched++] = bb_id
+// The builder is left in front of the same instruction.
+void PhaseAnalysisPass::emitCounterAdd(IRBuilder<> &builder,
+                  const InlineCounters &counters, uint64_t bb_id,
+                  Value *delta, bool delta_may_be_zero) {
+  Type *i64_type = builder.getInt64Ty();
+  Value *counter_ptr = builder.CreateConstInBoundsGEP2_64(
+      counters.counters_type, counters.bb_counters, 0, bb_id);
+  Value *count = builder.CreateLoad(i64_type, counter_ptr);
+  builder.CreateStore(builder.CreateAdd(count, delta), counter_ptr);
+  if (!counters.touched_ids) {
+    return;
+  }
+
+  Instruction *insert_point = &*builder.GetInsertPoint();
+  Value *zero = ConstantInt::get(i64_type, 0);
+  Value *first = builder.CreateICmpEQ(count, zero);
+  if (delta_may_be_zero) {
+    first = builder.CreateAnd(first, builder.CreateICmpNE(delta, zero));
+  }
+  // Taken once per block and interval
+  MDNode *unlikely = MDBuilder(builder.getContext()).createBranchWeights(1,
+                                                        (1U << 20) - 1);
+  Instruction *then_term = SplitBlockAndInsertIfThen(first, insert_point,
+                                          /*Unreachable=*/false, unlikely);
+  builder.SetInsertPoint(then_term);
+  Value *num_touched = builder.CreateLoad(i64_type, counters.num_touched);
+  Value *slot = builder.CreateInBoundsGEP(counters.touched_type,
+      counters.touched_ids, {zero, num_touched});
+  builder.CreateStore(builder.getInt32(bb_id), slot);
+  builder.CreateStore(builder.CreateAdd(num_touched,
+                        ConstantInt::get(i64_type, 1)), counters.num_touched);
+  builder.SetInsertPoint(insert_point);
+}
+
+// Count one execution of a labeled block right before its terminator:
+//   nugget_bb_counters[bb_id] += 1
+// followed by the clock update for the block's size.
+void PhaseAnalysisPass::emitBlockCounterUpdate(IRBuilder<> &builder,
+                  const LabeledBlock &block, const InlineCounters &counters) {
+  // A musttail call must stay immediately before its ret, so the update
+  // goes in front of the call instead.
+  Instruction *insert_point = block.bb->getTerminator();
+  if (CallInst *musttail = block.bb->getTerminatingMustTailCall()) {
+    insert_point = musttail;
+  }
+  builder.SetInsertPoint(insert_point);
 
-    for (BasicBlock &BB : F) {
-      // Get the bb_id metadata
-      bb_id = -1;
-      Instruction *T = BB.getTerminator();
-      if (T) {
-          MDNode* bb_id_md = T->getMetadata(kBbIdKey);
-          if (!bb_id_md) {
-              errs() << "Warning: BasicBlock " << BB.getName()
-                    << " in function " << F.getName()
-                    << " is missing !bb.id metadata.\n";
-              continue;
-          }
-          
-          // Cast operand to MDString and extract the value
-          MDString *bb_id_str = dyn_cast<MDString>(bb_id_md->getOperand(0));
-          if (!bb_id_str) {
-              errs() << "Warning: Invalid bb.id metadata format\n";
-              continue;
-          }
-          bb_id = std::stoll(bb_id_str->getString().str());
+  Type *i64_type = Type::getInt64Ty(insert_point->getContext());
+  emitCounterAdd(builder, counters, block.bb_id,
+                 ConstantInt::get(i64_type, 1), /*delta_may_be_zero=*/false);
+
+  emitClockUpdate(builder, insert_point, counters,
+                  ConstantInt::get(i64_type, block.bb_size));
+}
+
+// Plan the edge counters of one function.
+//
+// The CFG gets a virtual node V with an edge V -> entry and an edge
+// exit -> V for every block without successors, which makes every complete
+// execution of the function a circulation. A spanning tree rooted at V is
+// grown with Prim's algorithm, weighted by BlockFrequencyInfo so the hottest
+// edges stay uninstrumented. Only the remaining edges need counters: every
+// tree edge value follows from flow conservation at the node it connects to
+// the rest of the tree.
+//
+// Every tree edge points away from V, so a frame that is live at a flush,
+// say in block B, only undercounts: the blocks on the tree path from V to B
+// are one short and the clock is short by their size, until the frame
+// returns. The running count of a block therefore never exceeds its true
+// count, and nugget_bb_carry is empty again once those frames have returned.
+//
+// Outputs, appended to the module-wide tables:
+//   edge_counters - the non-tree edges to instrument
+//   edge_ops      - (dst_edge, src_edge, sign) triples solving the tree
+//                   edges leaf first: value[dst] += sign * value[src]
+//   bb_ops        - (bb_id, edge) pairs: count[bb_id] += value[edge] for
+//                   every edge entering a labeled block
+//
+// Returns false if an edge that cannot hold a counter (into an EH pad,
+// out of an indirectbr/callbr, ...) cannot be put in the tree; the caller
+// then counts the function per block instead.
+bool PhaseAnalysisPass::planFunctionEdges(Function &F,
+                  const DenseMap<BasicBlock*, LabeledBlock> &labels,
+                  BlockFrequencyInfo &BFI, BranchProbabilityInfo &BPI,
+                  uint64_t &num_edge_values,
+                  std::vector<EdgeCounter> &edge_counters,
+                  std::vector<uint32_t> &edge_ops,
+                  std::vector<uint32_t> &bb_ops) {
+  struct CFGEdge {
+    unsigned src;
+    unsigned dst;
+    uint64_t weight;
+    bool instrumentable;
+    bool in_tree;
+  };
+
+  // Node numbering: blocks in function order, the virtual node last
+  DenseMap<BasicBlock*, unsigned> node_index;
+  std::vector<BasicBlock*> nodes;
+  for (BasicBlock &BB : F) {
+    node_index[&BB] = nodes.size();
+    nodes.push_back(&BB);
+  }
+  const unsigned virtual_node = nodes.size();
+  const unsigned num_nodes = nodes.size() + 1;
+
+  std::vector<CFGEdge> edges;
+  BasicBlock &entry = F.getEntryBlock();
+  edges.push_back({virtual_node, node_index[&entry],
+                   BFI.getEntryFreq(), true, false});
+  for (BasicBlock *BB : nodes) {
+    Instruction *T = BB->getTerminator();
+    uint64_t bb_freq = BFI.getBlockFreq(BB).getFrequency();
+    if (succ_empty(BB)) {
+      edges.push_back({node_index[BB], virtual_node, bb_freq,
+                       !isa<CatchSwitchInst>(T), false});
+      continue;
+    }
+    SmallPtrSet<BasicBlock*, 4> seen;
+    for (BasicBlock *succ : successors(BB)) {
+      if (!seen.insert(succ).second) continue;
+      bool instrumentable;
+      if (BB->getUniqueSuccessor() == succ) {
+        instrumentable = !isa<CatchSwitchInst>(T);
+      } else if (succ->getUniquePredecessor() == BB) {
+        instrumentable = succ->getFirstInsertionPt() != succ->end();
       } else {
-        errs() << "Could not find terminator for function " << F.getName() 
-                                            << " bb " << BB.getName() << "\n";
+        instrumentable = !isa<IndirectBrInst>(T) && !isa<CallBrInst>(T) &&
+                         !isa<CatchSwitchInst>(T) && !succ->isEHPad();
+      }
+      uint64_t edge_freq =
+          (BFI.getBlockFreq(BB) * BPI.getEdgeProbability(BB, succ))
+              .getFrequency();
+      edges.push_back({node_index[BB], node_index[succ], edge_freq,
+                       instrumentable, false});
+    }
+  }
+
+  // An edge that cannot be instrumented must be its destination's tree
+  // edge, so no node can have two of them entering it.
+  std::vector<int> forced_edge(num_nodes, -1);
+  for (unsigned e = 0; e < edges.size(); e++) {
+    if (edges[e].instrumentable) continue;
+    if (edges[e].dst == virtual_node || forced_edge[edges[e].dst] >= 0) {
+      return false;
+    }
+    forced_edge[edges[e].dst] = e;
+  }
+
+  // Prim from the virtual node, hottest edge first, over edges leaving the
+  // tree, so every tree edge points away from V (and from the first node of
+  // any block V does not reach).
+  std::vector<std::vector<unsigned>> outgoing(num_nodes);
+  for (unsigned e = 0; e < edges.size(); e++) {
+    outgoing[edges[e].src].push_back(e);
+  }
+  auto colder = [&](unsigned a, unsigned b) {
+    if (edges[a].weight != edges[b].weight)
+      return edges[a].weight < edges[b].weight;
+    return a > b;
+  };
+  std::vector<bool> reached(num_nodes, false);
+  std::vector<unsigned> roots = {virtual_node};
+  for (unsigned n = 0; n < virtual_node; n++) roots.push_back(n);
+  for (unsigned root : roots) {
+    if (reached[root]) continue;
+    reached[root] = true;
+    std::priority_queue<unsigned, std::vector<unsigned>, decltype(colder)>
+        frontier(colder, outgoing[root]);
+    while (!frontier.empty()) {
+      unsigned e = frontier.top();
+      frontier.pop();
+      unsigned dst = edges[e].dst;
+      if (reached[dst] || (forced_edge[dst] >= 0 &&
+                           static_cast<unsigned>(forced_edge[dst]) != e)) {
         continue;
       }
-      assert(bb_id != -1 && "bb_id should have been set from metadata");
-      builder.SetInsertPoint(T);
+      reached[dst] = true;
+      edges[e].in_tree = true;
+      for (unsigned f : outgoing[dst]) frontier.push(f);
+    }
+  }
+  for (const CFGEdge &edge : edges) {
+    if (!edge.in_tree && !edge.instrumentable) {
+      return false;
+    }
+  }
+
+  // Instruction count attributed to entering a node; the virtual node and
+  // unlabeled blocks are not counted by the block placement either.
+  auto node_size = [&](unsigned node) -> int64_t {
+    if (node == virtual_node) return 0;
+    auto it = labels.find(nodes[node]);
+    return it == labels.end() ? 0 : it->second.bb_size;
+  };
+
+  // Walk the tree breadth first from the virtual node (and from the first
+  // node of any component it does not reach) to get each node's tree edge
+  // to its parent and its potential: potential(dst) = potential(src) +
+  // size(dst) along every tree edge.
+  std::vector<std::vector<unsigned>> incident(num_nodes);
+  for (unsigned e = 0; e < edges.size(); e++) {
+    if (edges[e].src == edges[e].dst) continue;
+    incident[edges[e].src].push_back(e);
+    incident[edges[e].dst].push_back(e);
+  }
+  std::vector<int64_t> potential(num_nodes, 0);
+  std::vector<int> tree_parent_edge(num_nodes, -1);
+  std::vector<bool> visited(num_nodes, false);
+  std::vector<unsigned> bfs_order;
+  std::vector<unsigned> component_starts = {virtual_node};
+  for (unsigned n = 0; n < virtual_node; n++) component_starts.push_back(n);
+  for (unsigned start : component_starts) {
+    if (visited[start]) continue;
+    visited[start] = true;
+    size_t head = bfs_order.size();
+    bfs_order.push_back(start);
+    while (head < bfs_order.size()) {
+      unsigned x = bfs_order[head++];
+      for (unsigned e : incident[x]) {
+        if (!edges[e].in_tree) continue;
+        unsigned y = edges[e].src == x ? edges[e].dst : edges[e].src;
+        if (visited[y]) continue;
+        visited[y] = true;
+        tree_parent_edge[y] = e;
+        potential[y] = edges[e].dst == y
+            ? potential[x] + node_size(y)    // x -> y
+            : potential[x] - node_size(x);   // y -> x
+        bfs_order.push_back(y);
+      }
+    }
+  }
 
-      builder.CreateCall(bb_hook_function, {
-        ConstantInt::get(Type::getInt64Ty(M.getContext()), BB.size()),
-        ConstantInt::get(Type::getInt64Ty(M.getContext()), bb_id),
-        ConstantInt::get(Type::getInt64Ty(M.getContext()), threshold),
-      });
-      total_basic_block_count++;
+  // Value slots for every edge of the function
+  const uint64_t value_base = num_edge_values;
+  num_edge_values += edges.size();
+
+  // Counted edges and their clock weights: taking a non-tree edge u -> v
+  // closes its fundamental cycle, whose instruction count is
+  // size(v) + potential(u) - potential(v).
+  for (unsigned e = 0; e < edges.size(); e++) {
+    if (edges[e].in_tree) continue;
+    const CFGEdge &edge = edges[e];
+    int64_t weight = node_size(edge.dst) + potential[edge.src]
+                                         - potential[edge.dst];
+    edge_counters.push_back({
+        edge.src == virtual_node ? nullptr : nodes[edge.src],
+        edge.dst == virtual_node ? nullptr : nodes[edge.dst],
+        value_base + e, weight});
+  }
+
+  // Solve the tree edges leaf first: for a node x whose parent tree edge is
+  // t, conservation (sum in == sum out) gives t from the other edges of x.
+  for (auto it = bfs_order.rbegin(); it != bfs_order.rend(); ++it) {
+    unsigned x = *it;
+    if (tree_parent_edge[x] < 0) continue;
+    unsigned t = tree_parent_edge[x];
+    bool t_enters_x = edges[t].dst == x;
+    for (unsigned f : incident[x]) {
+      if (f == t) continue;
+      bool f_enters_x = edges[f].dst == x;
+      int32_t sign = f_enters_x == t_enters_x ? -1 : 1;
+      edge_ops.push_back(value_base + t);
+      edge_ops.push_back(value_base + f);
+      edge_ops.push_back(static_cast<uint32_t>(sign));
     }
   }
+
+  // A block executes once per entering edge (self loops included)
+  for (unsigned e = 0; e < edges.size(); e++) {
+    if (edges[e].dst == virtual_node) continue;
+    auto it = labels.find(nodes[edges[e].dst]);
+    if (it == labels.end()) continue;
+    bb_ops.push_back(it->second.bb_id);
+    bb_ops.push_back(value_base + e);
+  }
   return true;
 }
 
-PreservedAnalyses PhaseAnalysisPass::run(Module &M, ModuleAnalysisManager &) {
+// Find the innermost loops of F whose block counts can be added once at the
+// loop exit instead of on every iteration. A loop qualifies when
+//   - it has a preheader, and its latch is its only exiting block, with a
+//     unique exit block entered only from the latch,
+//   - every block dominates the latch, so each block runs exactly once per
+//     iteration,
+//   - it makes no calls other than intrinsics, so no interval of a callee
+//     can close while the loop's counts are still pending, and
+//   - ScalarEvolution can compute its backedge-taken count and expand it in
+//     the preheader.
+// The trip count (backedge-taken count + 1) is expanded in the preheader
+// here, before any block is split.
+void PhaseAnalysisPass::planLoopHoisting(Function &F,
+                  const DenseMap<BasicBlock*, LabeledBlock> &labels,
+                  LoopInfo &LI, DominatorTree &DT, ScalarEvolution &SE,
+                  std::vector<HoistedLoop> &hoisted_loops) {
+  Type *i64_type = Type::getInt64Ty(F.getContext());
+  SCEVExpander expander(SE, F.getParent()->getDataLayout(), "nugget.trip");
+
+  for (Loop *L : LI.getLoopsInPreorder()) {
+    if (!L->isInnermost()) continue;
+    BasicBlock *preheader = L->getLoopPreheader();
+    BasicBlock *latch = L->getLoopLatch();
+    BasicBlock *exit = L->getUniqueExitBlock();
+    if (!preheader || !latch || !exit || L->getExitingBlock() != latch ||
+        exit->getUniquePredecessor() != latch) {
+      continue;
+    }
+
+    bool straight_line = true;
+    HoistedLoop hoisted;
+    hoisted.exit = exit;
+    hoisted.loop_size = 0;
+    for (BasicBlock *BB : L->blocks()) {
+      if (!DT.dominates(BB, latch)) {
+        straight_line = false;
+        break;
+      }
+      for (Instruction &I : *BB) {
+        if (isa<CallBase>(I) && !isa<IntrinsicInst>(I)) {
+          straight_line = false;
+          break;
+        }
+      }
+      if (!straight_line) break;
+      auto it = labels.find(BB);
+      if (it != labels.end()) {
+        hoisted.blocks.push_back(it->second);
+        hoisted.loop_size += it->second.bb_size;
+      }
+    }
+    if (!straight_line || hoisted.blocks.empty()) continue;
+
+    const SCEV *backedge_count = SE.getBackedgeTakenCount(L);
+    if (isa<SCEVCouldNotCompute>(backedge_count)) continue;
+    const SCEV *trip_count = SE.getAddExpr(
+        SE.getTruncateOrZeroExtend(backedge_count, i64_type),
+        SE.getOne(i64_type));
+    Instruction *expand_point = preheader->getTerminator();
+    if (!expander.isSafeToExpandAt(trip_count, expand_point)) continue;
+
+    hoisted.trip_count =
+        expander.expandCodeFor(trip_count, i64_type, expand_point);
+    DEBUG_PRINT("Hoisting counters of loop " << L->getHeader()->getName()
+                << " in " << F.getName() << " (" << hoisted.blocks.size()
+                << " blocks)");
+    hoisted_loops.push_back(std::move(hoisted));
+  }
+}
+
+// Find the innermost loops of LI whose counters can be kept in registers:
+// loops with a preheader, a single latch and dedicated exits that make no
+// calls other than intrinsics (a callee could close an interval while the
+// loop's counts are still pending). Loops already hoisted have no labeled
+// blocks left in labels and are skipped.
+void PhaseAnalysisPass::planLoopPromotion(
+                  const DenseMap<BasicBlock*, LabeledBlock> &labels,
+                  LoopInfo &LI, std::vector<PromotedLoop> &promoted_loops) {
+  for (Loop *L : LI.getLoopsInPreorder()) {
+    if (!L->isInnermost()) continue;
+    BasicBlock *preheader = L->getLoopPreheader();
+    BasicBlock *latch = L->getLoopLatch();
+    if (!preheader || !latch || !L->hasDedicatedExits()) continue;
+
+    bool promotable = true;
+    PromotedLoop promoted;
+    for (BasicBlock *BB : L->blocks()) {
+      for (Instruction &I : *BB) {
+        if (isa<CallBase>(I) && !isa<IntrinsicInst>(I)) {
+          promotable = false;
+          break;
+        }
+      }
+      if (!promotable) break;
+      auto it = labels.find(BB);
+      if (it != labels.end()) {
+        promoted.blocks.push_back(it->second);
+      }
+    }
+    if (!promotable || promoted.blocks.empty()) continue;
+
+    SmallVector<BasicBlock*, 4> exits;
+    L->getUniqueExitBlocks(exits);
+    for (BasicBlock *exit : exits) {
+      BasicBlock::iterator it = exit->getFirstInsertionPt();
+      if (it == exit->end()) {
+        promotable = false;
+        break;
+      }
+      promoted.exit_points.push_back(&*it);
+    }
+    if (!promotable) continue;
+
+    promoted.preheader_point = preheader->getTerminator();
+    promoted.latch_point = latch->getTerminator();
+    DEBUG_PRINT("Promoting counters of loop " << L->getHeader()->getName()
+                << " in " << F.getName() << " (" << promoted.blocks.size()
+                << " blocks, " << exits.size() << " exits)");
+    promoted_loops.push_back(std::move(promoted));
+  }
+}
+
+// Instrument a promoted loop with local counters:
+//   preheader:     local_count[*] = 0, local_insts = 0, iterations = 0
+//   each block:    local_count[b] += 1, local_insts += bb_size
+//   latch:         if (++iterations >= promote_stride) {   // cold
+//                    flush, iterations = 0
+//                  }
+//   each exit:     flush
+// where flush adds the locals to nugget_bb_counters and nugget_inst_counter,
+// clears them and runs the threshold check. The locals are allocas that the
+// caller promotes to registers once all instrumentation is in place.
+void PhaseAnalysisPass::emitPromotedLoop(IRBuilder<> &builder,
+                  const PromotedLoop &loop, const InlineCounters &counters,
+                  uint64_t promote_stride, std::vector<AllocaInst*> &allocas) {
+  Function *F = loop.preheader_point->getFunction();
+  Type *i64_type = Type::getInt64Ty(F->getContext());
+  Value *zero = ConstantInt::get(i64_type, 0);
+
+  BasicBlock &entry = F->getEntryBlock();
+  builder.SetInsertPoint(&entry, entry.getFirstInsertionPt());
+  std::vector<AllocaInst*> local_counts;
+  for (size_t i = 0; i < loop.blocks.size(); i++) {
+    local_counts.push_back(builder.CreateAlloca(i64_type, nullptr,
+                                                "nugget.count"));
+  }
+  AllocaInst *local_insts = builder.CreateAlloca(i64_type, nullptr,
+                                                 "nugget.insts");
+  AllocaInst *iterations = builder.CreateAlloca(i64_type, nullptr,
+                                                "nugget.iters");
+  allocas.insert(allocas.end(), local_counts.begin(), local_counts.end());
+  allocas.push_back(local_insts);
+  allocas.push_back(iterations);
+
+  builder.SetInsertPoint(loop.preheader_point);
+  for (AllocaInst *local : local_counts) {
+    builder.CreateStore(zero, local);
+  }
+  builder.CreateStore(zero, local_insts);
+  builder.CreateStore(zero, iterations);
+
+  for (size_t i = 0; i < loop.blocks.size(); i++) {
+    builder.SetInsertPoint(loop.blocks[i].bb->getTerminator());
+    builder.CreateStore(builder.CreateAdd(
+        builder.CreateLoad(i64_type, local_counts[i]),
+        ConstantInt::get(i64_type, 1)), local_counts[i]);
+    builder.CreateStore(builder.CreateAdd(
+        builder.CreateLoad(i64_type, local_insts),
+        ConstantInt::get(i64_type, loop.blocks[i].bb_size)), local_insts);
+  }
+
+  auto flush = [&](Instruction *insert_point) {
+    builder.SetInsertPoint(insert_point);
+    for (size_t i = 0; i < loop.blocks.size(); i++) {
+      // A block of the loop may not have run since the last flush
+      emitCounterAdd(builder, counters, loop.blocks[i].bb_id,
+                     builder.CreateLoad(i64_type, local_counts[i]),
+                     /*delta_may_be_zero=*/true);
+      builder.CreateStore(zero, local_counts[i]);
+    }
+    Value *inst_delta = builder.CreateLoad(i64_type, local_insts);
+    builder.CreateStore(zero, local_insts);
+    emitClockUpdate(builder, insert_point, counters, inst_delta);
+  };
+
+  if (promote_stride > 0) {
+    builder.SetInsertPoint(loop.latch_point);
+    Value *next = builder.CreateAdd(builder.CreateLoad(i64_type, iterations),
+                                    ConstantInt::get(i64_type, 1));
+    builder.CreateStore(next, iterations);
+    Value *stride_reached = builder.CreateICmpUGE(next,
+        ConstantInt::get(i64_type, promote_stride));
+    MDNode *unlikely = MDBuilder(F->getContext()).createBranchWeights(1,
+                                                        (1U << 20) - 1);
+    Instruction *then_term = SplitBlockAndInsertIfThen(stride_reached,
+        loop.latch_point, /*Unreachable=*/false, unlikely);
+    builder.SetInsertPoint(then_term);
+    builder.CreateStore(zero, iterations);
+    flush(then_term);
+  }
+  for (Instruction *exit_point : loop.exit_points) {
+    flush(exit_point);
+  }
+}
+
+// Create nugget_flush_interval(), which closes the calling thread's partial
+// interval:
+//   if (nugget_inst_counter != 0) {
+//     nugget_interval_hook(nugget_bb_counters, N, nugget_inst_counter)
+//     nugget_inst_counter = 0
+//   }
+// (nugget_edge_flush instead of the hook with edge placement). It is weak so
+// a runtime can declare it weak and call it only when it exists.
+Function *PhaseAnalysisPass::createIntervalFlush(Module &M,
+                  const InlineCounters &counters) {
+  LLVMContext &C = M.getContext();
+  Type *i64_type = Type::getInt64Ty(C);
+  Function *flush = Function::Create(
+      FunctionType::get(Type::getVoidTy(C), false),
+      GlobalValue::WeakAnyLinkage, "nugget_flush_interval", M);
+  flush->addFnAttr(Attribute::NoInline);
+  BasicBlock *entry = BasicBlock::Create(C, "entry", flush);
+  BasicBlock *pending = BasicBlock::Create(C, "pending", flush);
+  BasicBlock *done = BasicBlock::Create(C, "done", flush);
+
+  IRBuilder<> builder(entry);
+  Value *inst_count = builder.CreateLoad(i64_type, counters.inst_counter);
+  builder.CreateCondBr(builder.CreateICmpNE(inst_count,
+                          ConstantInt::get(i64_type, 0)), pending, done);
+  builder.SetInsertPoint(pending);
+  if (counters.edge_flush) {
+    builder.CreateCall(counters.edge_flush, {inst_count});
+  } else {
+    emitIntervalHookCall(builder, counters, inst_count);
+  }
+  builder.CreateStore(ConstantInt::get(i64_type, 0), counters.inst_counter);
+  builder.CreateBr(done);
+  builder.SetInsertPoint(done);
+  builder.CreateRetVoid();
+  return flush;
+}
+
+// Emit `for (i = 0; i < count; ++i) body(i)` at the builder's insertion
+// point; the builder is left in the loop exit block.
+static void emitCountedLoop(IRBuilder<> &builder, uint64_t count,
+                  function_ref<void(IRBuilder<>&, Value*)> body) {
+  if (count == 0) return;
+  LLVMContext &C = builder.getContext();
+  Type *i64_type = Type::getInt64Ty(C);
+  Function *F = builder.GetInsertBlock()->getParent();
+  BasicBlock *preheader = builder.GetInsertBlock();
+  BasicBlock *loop = BasicBlock::Create(C, "loop", F);
+  BasicBlock *exit = BasicBlock::Create(C, "loop.exit", F);
+  builder.CreateBr(loop);
+
+  builder.SetInsertPoint(loop);
+  PHINode *index = builder.CreatePHI(i64_type, 2, "i");
+  index->addIncoming(ConstantInt::get(i64_type, 0), preheader);
+  body(builder, index);
+  Value *next = builder.CreateAdd(index, ConstantInt::get(i64_type, 1));
+  index->addIncoming(next, builder.GetInsertBlock());
+  builder.CreateCondBr(builder.CreateICmpULT(next,
+                          ConstantInt::get(i64_type, count)), loop, exit);
+  builder.SetInsertPoint(exit);
+}
+
+// Create the cold nugget_edge_flush(i64 inst_count) function:
+//   value[dst] += sign * value[src]       for every edge op (tree edges)
+//   count[i] += carry[i]                  for every bb_id
+//   count[bb] += value[edge]              for every bb op
+//   if (count[i] < 0) carry it into the next interval instead
+//   value[] = 0
+//   nugget_interval_hook(count, N, inst_count)
+// A frame that is live across the boundary can make a block's reconstructed
+// count transiently negative; the carry keeps the emitted counts
+// non-negative until a later interval settles it. The counts never run
+// ahead of the real ones, so the carry is empty once every frame has
+// returned (see PhaseAnalysisPass.hh).
+Function *PhaseAnalysisPass::createEdgeFlush(Module &M,
+                  const InlineCounters &counters, uint64_t num_edge_values,
+                  const std::vector<uint32_t> &edge_ops,
+                  const std::vector<uint32_t> &bb_ops) {
+  LLVMContext &C = M.getContext();
+  Type *i32_type = Type::getInt32Ty(C);
+  Type *i64_type = Type::getInt64Ty(C);
+
+  auto make_table = [&](const std::vector<uint32_t> &ops, StringRef name) {
+    ArrayType *type = ArrayType::get(i32_type, ops.size());
+    return std::make_pair(type, new GlobalVariable(M, type,
+        /*isConstant=*/true, GlobalValue::PrivateLinkage,
+        ConstantDataArray::get(C, ArrayRef<uint32_t>(ops)), name));
+  };
+  auto [edge_ops_type, edge_ops_table] =
+      make_table(edge_ops, "nugget_edge_ops");
+  auto [bb_ops_type, bb_ops_table] = make_table(bb_ops, "nugget_bb_ops");
+  GlobalVariable *carry = new GlobalVariable(M, counters.counters_type,
+      /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantAggregateZero::get(counters.counters_type), "nugget_bb_carry",
+      /*InsertBefore=*/nullptr, counters.bb_counters->getThreadLocalMode());
+  ArrayType *values_type = cast<ArrayType>(counters.edge_values->getValueType());
+
+  Function *flush = Function::Create(
+      FunctionType::get(Type::getVoidTy(C), {i64_type}, false),
+      GlobalValue::InternalLinkage, "nugget_edge_flush", M);
+  flush->addFnAttr(Attribute::NoInline);
+  flush->addFnAttr(Attribute::Cold);
+  IRBuilder<> builder(BasicBlock::Create(C, "entry", flush));
+
+  auto element = [&](ArrayType *type, Value *base, Value *index) {
+    return builder.CreateInBoundsGEP(type, base,
+                              {ConstantInt::get(i64_type, 0), index});
+  };
+  auto load_op = [&](ArrayType *type, Value *table, Value *i, unsigned width,
+                     unsigned field, bool sign_extend) {
+    Value *slot = builder.CreateAdd(builder.CreateMul(i,
+        ConstantInt::get(i64_type, width)), ConstantInt::get(i64_type, field));
+    Value *op = builder.CreateLoad(i32_type, element(type, table, slot));
+    return sign_extend ? builder.CreateSExt(op, i64_type)
+                       : builder.CreateZExt(op, i64_type);
+  };
+
+  emitCountedLoop(builder, edge_ops.size() / 3, [&](IRBuilder<> &,
+                                                    Value *i) {
+    Value *dst = element(values_type, counters.edge_values,
+        load_op(edge_ops_type, edge_ops_table, i, 3, 0, false));
+    Value *src = element(values_type, counters.edge_values,
+        load_op(edge_ops_type, edge_ops_table, i, 3, 1, false));
+    Value *sign = load_op(edge_ops_type, edge_ops_table, i, 3, 2, true);
+    Value *delta = builder.CreateMul(sign, builder.CreateLoad(i64_type, src));
+    builder.CreateStore(builder.CreateAdd(
+        builder.CreateLoad(i64_type, dst), delta), dst);
+  });
+  emitCountedLoop(builder, counters.num_counters, [&](IRBuilder<> &,
+                                                      Value *i) {
+    Value *count = element(counters.counters_type, counters.bb_counters, i);
+    Value *pending = builder.CreateLoad(i64_type,
+        element(counters.counters_type, carry, i));
+    builder.CreateStore(builder.CreateAdd(
+        builder.CreateLoad(i64_type, count), pending), count);
+  });
+  emitCountedLoop(builder, bb_ops.size() / 2, [&](IRBuilder<> &,
+                                                  Value *i) {
+    Value *count = element(counters.counters_type, counters.bb_counters,
+        load_op(bb_ops_type, bb_ops_table, i, 2, 0, false));
+    Value *value = builder.CreateLoad(i64_type,
+        element(values_type, counters.edge_values,
+            load_op(bb_ops_type, bb_ops_table, i, 2, 1, false)));
+    builder.CreateStore(builder.CreateAdd(
+        builder.CreateLoad(i64_type, count), value), count);
+  });
+  emitCountedLoop(builder, counters.num_counters, [&](IRBuilder<> &,
+                                                      Value *i) {
+    Value *count_ptr = element(counters.counters_type,
+                               counters.bb_counters, i);
+    Value *carry_ptr = element(counters.counters_type, carry, i);
+    Value *count = builder.CreateLoad(i64_type, count_ptr);
+    Value *negative = builder.CreateICmpSLT(count,
+                                            ConstantInt::get(i64_type, 0));
+    Value *zero = ConstantInt::get(i64_type, 0);
+    builder.CreateStore(builder.CreateSelect(negative, count, zero),
+                        carry_ptr);
+    builder.CreateStore(builder.CreateSelect(negative, zero, count),
+                        count_ptr);
+  });
+  builder.CreateMemSet(counters.edge_values, builder.getInt8(0),
+                       num_edge_values * 8, MaybeAlign(8));
+
+  Value *counters_base = builder.CreateConstInBoundsGEP2_64(
+      counters.counters_type, counters.bb_counters, 0, 0);
+  builder.CreateCall(counters.interval_hook, {counters_base,
+      ConstantInt::get(i64_type, counters.num_counters), flush->getArg(0)});
+  builder.CreateRetVoid();
+  return flush;
+}
+
+// Functions of M that can still have a frame live when nugget_roi_end_
+// flushes the last interval: its direct callers and, transitively, theirs.
+static SmallPtrSet<Function*, 8> collectRoiEndCallers(Module &M) {
+  SmallPtrSet<Function*, 8> callers;
+  Function *roi_end = M.getFunction("nugget_roi_end_");
+  if (!roi_end) {
+    return callers;
+  }
+  std::vector<Function*> worklist = {roi_end};
+  while (!worklist.empty()) {
+    Function *callee = worklist.back();
+    worklist.pop_back();
+    for (User *user : callee->users()) {
+      auto *call = dyn_cast<CallBase>(user);
+      if (!call || call->getCalledFunction() != callee) continue;
+      Function *caller = call->getFunction();
+      if (callers.insert(caller).second) {
+        worklist.push_back(caller);
+      }
+    }
+  }
+  return callers;
+}
+
+// Instrument the module with inline counters.
+//
+// Block placement gives every labeled block, right before its terminator:
+//   nugget_bb_counters[bb_id] += 1
+//   nugget_inst_counter += bb_size
+//   if (nugget_inst_counter >= threshold) {      // cold
+//     nugget_interval_hook(nugget_bb_counters, N, nugget_inst_counter)
+//     nugget_inst_counter = 0
+//   }
+// Edge placement instead gives every non-tree edge (see planFunctionEdges):
+//   nugget_edge_values[edge] += 1
+//   nugget_inst_counter += cycle_weight
+//   if (nugget_inst_counter >= threshold) {      // cold
+//     nugget_edge_flush(nugget_inst_counter)
+//     nugget_inst_counter = 0
+//   }
+// With loop_hoist, the blocks of qualifying loops (see planLoopHoisting) are
+// counted once in the loop exit block instead:
+//   nugget_bb_counters[bb_id] += trip_count      for every block of the loop
+//   nugget_inst_counter += trip_count * loop_size
+//   ... threshold check as above
+// With promote, the remaining call-free innermost loops count into locals
+// that are flushed at loop exits and every promote_stride iterations (see
+// emitPromotedLoop).
+bool PhaseAnalysisPass::instrumentAllIRBasicBlocksInline(Module &M,
+                  ModuleAnalysisManager &MAM,
+                  int64_t &total_basic_block_count, const uint64_t threshold,
+                  const InlineConfig &config) {
+
+  Type *i64_type = Type::getInt64Ty(M.getContext());
+  Function* interval_hook_function = getOrDeclareRuntimeFunction(M,
+      "nugget_interval_hook", FunctionType::get(
+          Type::getVoidTy(M.getContext()),
+          {PointerType::getUnqual(i64_type), i64_type, i64_type}, false));
+  if (!interval_hook_function) {
+    return false;
+  }
+  Function* sparse_hook_function = nullptr;
+  if (config.touched) {
+    sparse_hook_function = getOrDeclareRuntimeFunction(M,
+        "nugget_sparse_interval_hook", FunctionType::get(
+            Type::getVoidTy(M.getContext()),
+            {PointerType::getUnqual(i64_type),
+             PointerType::getUnqual(Type::getInt32Ty(M.getContext())),
+             i64_type, i64_type}, false));
+    if (!sparse_hook_function) {
+      return false;
+    }
+  }
+
+  std::vector<LabeledBlock> labeled_blocks =
+      collectLabeledBlocks(MAM.getResult<BBIdAnalysis>(M));
+  total_basic_block_count = labeled_blocks.size();
+  if (labeled_blocks.empty()) {
+    return true;
+  }
+  uint64_t max_bb_id = 0;
+  for (const LabeledBlock &block : labeled_blocks) {
+    max_bb_id = std::max(max_bb_id, block.bb_id);
+  }
+
+  // Plan the edge counters while the CFG is still untouched; functions that
+  // cannot use edge placement keep their blocks in block_counted.
+  std::vector<LabeledBlock> block_counted;
+  std::vector<EdgeCounter> edge_counters;
+  std::vector<uint32_t> edge_ops;
+  std::vector<uint32_t> bb_ops;
+  uint64_t num_edge_values = 0;
+  FunctionAnalysisManager &FAM =
+      MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+  if (config.edge_placement) {
+    MapVector<Function*, DenseMap<BasicBlock*, LabeledBlock>> per_function;
+    for (const LabeledBlock &block : labeled_blocks) {
+      per_function[block.bb->getParent()][block.bb] = block;
+    }
+    // A frame live at the last flush would never settle its undercount
+    SmallPtrSet<Function*, 8> roi_end_callers = collectRoiEndCallers(M);
+    for (auto &[F, labels] : per_function) {
+      if (roi_end_callers.count(F) ||
+          !planFunctionEdges(*F, labels,
+                             FAM.getResult<BlockFrequencyAnalysis>(*F),
+                             FAM.getResult<BranchProbabilityAnalysis>(*F),
+                             num_edge_values, edge_counters,
+                             edge_ops, bb_ops)) {
+        DEBUG_PRINT("Edge placement not possible for " << F->getName()
+                    << ", counting its blocks instead");
+        for (BasicBlock &BB : *F) {
+          auto it = labels.find(&BB);
+          if (it != labels.end()) block_counted.push_back(it->second);
+        }
+      }
+    }
+    DEBUG_PRINT("Edge placement: " << edge_counters.size()
+                << " counted edges for " << labeled_blocks.size()
+                << " labeled blocks");
+  } else {
+    block_counted = labeled_blocks;
+  }
+
+  // Move the blocks of counted loops out of block_counted; their trip
+  // counts are expanded now, while the loop analyses are still valid.
+  std::vector<HoistedLoop> hoisted_loops;
+  if (config.loop_hoist) {
+    MapVector<Function*, DenseMap<BasicBlock*, LabeledBlock>> per_function;
+    for (const LabeledBlock &block : block_counted) {
+      per_function[block.bb->getParent()][block.bb] = block;
+    }
+    for (auto &[F, labels] : per_function) {
+      planLoopHoisting(*F, labels, FAM.getResult<LoopAnalysis>(*F),
+                       FAM.getResult<DominatorTreeAnalysis>(*F),
+                       FAM.getResult<ScalarEvolutionAnalysis>(*F),
+                       hoisted_loops);
+    }
+    SmallPtrSet<BasicBlock*, 32> hoisted_blocks;
+    for (const HoistedLoop &loop : hoisted_loops) {
+      for (const LabeledBlock &block : loop.blocks) {
+        hoisted_blocks.insert(block.bb);
+      }
+    }
+    llvm::erase_if(block_counted, [&](const LabeledBlock &block) {
+      return hoisted_blocks.count(block.bb);
+    });
+    DEBUG_PRINT("Loop hoisting: " << hoisted_loops.size() << " loops, "
+                << hoisted_blocks.size() << " blocks counted at loop exits");
+  }
+
+  // Same for the loops whose counters are promoted to registers
+  std::vector<PromotedLoop> promoted_loops;
+  if (config.promote) {
+    MapVector<Function*, DenseMap<BasicBlock*, LabeledBlock>> per_function;
+    for (const LabeledBlock &block : block_counted) {
+      per_function[block.bb->getParent()][block.bb] = block;
+    }
+    for (auto &[F, labels] : per_function) {
+      planLoopPromotion(labels, FAM.getResult<LoopAnalysis>(*F),
+                        promoted_loops);
+    }
+    SmallPtrSet<BasicBlock*, 32> promoted_blocks;
+    for (const PromotedLoop &loop : promoted_loops) {
+      for (const LabeledBlock &block : loop.blocks) {
+        promoted_blocks.insert(block.bb);
+      }
+    }
+    llvm::erase_if(block_counted, [&](const LabeledBlock &block) {
+      return promoted_blocks.count(block.bb);
+    });
+    DEBUG_PRINT("Counter promotion: " << promoted_loops.size() << " loops, "
+                << promoted_blocks.size() << " blocks");
+  }
+
+  LLVMContext &C = M.getContext();
+  InlineCounters counters;
+  counters.num_counters = max_bb_id + 1;
+  counters.threshold = threshold;
+  counters.interval_hook = interval_hook_function;
+  counters.counters_type = ArrayType::get(i64_type, counters.num_counters);
+  // Initial-exec TLS keeps the counter address a single thread-pointer
+  // offset on the hot path.
+  GlobalValue::ThreadLocalMode tls_mode = config.thread_local_counters
+      ? GlobalValue::InitialExecTLSModel : GlobalValue::NotThreadLocal;
+  counters.bb_counters = new GlobalVariable(M, counters.counters_type,
+      /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantAggregateZero::get(counters.counters_type),
+      "nugget_bb_counters", /*InsertBefore=*/nullptr, tls_mode);
+  counters.inst_counter = new GlobalVariable(M, i64_type,
+      /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantInt::get(i64_type, 0), "nugget_inst_counter",
+      /*InsertBefore=*/nullptr, tls_mode);
+  if (config.edge_placement) {
+    ArrayType *values_type = ArrayType::get(i64_type, num_edge_values);
+    counters.edge_values = new GlobalVariable(M, values_type,
+        /*isConstant=*/false, GlobalValue::InternalLinkage,
+        ConstantAggregateZero::get(values_type), "nugget_edge_values",
+        /*InsertBefore=*/nullptr, tls_mode);
+    counters.edge_flush = createEdgeFlush(M, counters, num_edge_values,
+                                          edge_ops, bb_ops);
+  }
+  if (config.touched) {
+    counters.touched_type = ArrayType::get(Type::getInt32Ty(C),
+                                           counters.num_counters);
+    counters.touched_ids = new GlobalVariable(M, counters.touched_type,
+        /*isConstant=*/false, GlobalValue::InternalLinkage,
+        ConstantAggregateZero::get(counters.touched_type),
+        "nugget_touched_ids", /*InsertBefore=*/nullptr, tls_mode);
+    counters.num_touched = new GlobalVariable(M, i64_type,
+        /*isConstant=*/false, GlobalValue::InternalLinkage,
+        ConstantInt::get(i64_type, 0), "nugget_num_touched",
+        /*InsertBefore=*/nullptr, tls_mode);
+    counters.sparse_interval_hook = sparse_hook_function;
+  }
+  createIntervalFlush(M, counters);
+
+  IRBuilder<> builder(C);
+  for (const LabeledBlock &block : block_counted) {
+    emitBlockCounterUpdate(builder, block, counters);
+  }
+  // After the per-block updates: the exit block may itself be counted, and
+  // its update must still find the original terminator.
+  for (const HoistedLoop &loop : hoisted_loops) {
+    Instruction *insert_point = &*loop.exit->getFirstInsertionPt();
+    builder.SetInsertPoint(insert_point);
+    // The exit is only reached through the latch: trip_count >= 1
+    for (const LabeledBlock &block : loop.blocks) {
+      emitCounterAdd(builder, counters, block.bb_id, loop.trip_count,
+                     /*delta_may_be_zero=*/false);
+    }
+    Value *inst_delta = builder.CreateMul(loop.trip_count,
+        ConstantInt::get(i64_type, loop.loop_size));
+    emitClockUpdate(builder, insert_point, counters, inst_delta);
+  }
+  // Promote the loop-local counters once every loop is instrumented
+  MapVector<Function*, std::vector<AllocaInst*>> promoted_allocas;
+  for (const PromotedLoop &loop : promoted_loops) {
+    emitPromotedLoop(builder, loop, counters, config.promote_stride,
+                     promoted_allocas[loop.preheader_point->getFunction()]);
+  }
+  for (auto &[F, allocas] : promoted_allocas) {
+    DominatorTree DT(*F);
+    PromoteMemToReg(allocas, DT);
+  }
+  if (edge_counters.empty()) {
+    return true;
+  }
+
+  // Find where each edge counter goes before inserting anything: the clock
+  // checks split blocks and would change the predecessor/successor shapes
+  // the placement relies on.
+  std::vector<Instruction*> insert_points;
+  for (const EdgeCounter &edge : edge_counters) {
+    Instruction *insert_point;
+    if (!edge.src) {
+      // Virtual edge into the entry block; keep the allocas up front
+      BasicBlock::iterator it = edge.dst->getFirstInsertionPt();
+      while (isa<AllocaInst>(*it)) ++it;
+      insert_point = &*it;
+    } else if (!edge.dst) {
+      // Virtual edge out of an exit block
+      insert_point = edge.src->getTerminator();
+      if (CallInst *musttail = edge.src->getTerminatingMustTailCall()) {
+        insert_point = musttail;
+      }
+    } else if (edge.src->getUniqueSuccessor() == edge.dst) {
+      insert_point = edge.src->getTerminator();
+    } else if (edge.dst->getUniquePredecessor() == edge.src) {
+      insert_point = &*edge.dst->getFirstInsertionPt();
+    } else {
+      BasicBlock *split = SplitCriticalEdge(edge.src, edge.dst,
+          CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+      if (!split) {
+        report_fatal_error(Twine("Could not split edge ") +
+            edge.src->getName() + " -> " + edge.dst->getName() +
+            " in function " + edge.src->getParent()->getName());
+      }
+      insert_point = split->getTerminator();
+    }
+    insert_points.push_back(insert_point);
+  }
+
+  ArrayType *values_type =
+      cast<ArrayType>(counters.edge_values->getValueType());
+  for (size_t i = 0; i < edge_counters.size(); i++) {
+    builder.SetInsertPoint(insert_points[i]);
+    Value *value_ptr = builder.CreateConstInBoundsGEP2_64(values_type,
+        counters.edge_values, 0, edge_counters[i].value_index);
+    Value *value = builder.CreateLoad(i64_type, value_ptr);
+    builder.CreateStore(builder.CreateAdd(value,
+                          ConstantInt::get(i64_type, 1)), value_ptr);
+    // Cycles through unlabeled blocks only do not move the clock
+    if (edge_counters[i].inst_weight != 0) {
+      emitClockUpdate(builder, insert_points[i], counters,
+                      ConstantInt::get(i64_type, edge_counters[i].inst_weight,
+                                       /*isSigned=*/true));
+    }
+  }
+  return true;
+}
+
+// Export the fingerprint of the labeled module to the runtime as
+//   @nugget_module_fingerprint = weak constant i64 <fingerprint>
+// which the runtime references weakly and writes into its trace header.
+// Weak, so that separately instrumented translation units still link.
+void PhaseAnalysisPass::emitModuleFingerprint(Module &M) {
+  if (M.getNamedGlobal("nugget_module_fingerprint")) {
+    return;
+  }
+  Type *i64_type = Type::getInt64Ty(M.getContext());
+  GlobalVariable *fingerprint = new GlobalVariable(M, i64_type,
+      /*isConstant=*/true, GlobalValue::WeakAnyLinkage,
+      ConstantInt::get(i64_type, getModuleFingerprint(M)),
+      "nugget_module_fingerprint");
+  // Kept or dropped by the linker together with the unit's tables
+  if (GlobalVariable *table = M.getNamedGlobal("__nugget_bb_table")) {
+    fingerprint->setComdat(table->getComdat());
+  }
+}
+
+// Export the static data of every labeled block to the runtime, see
+// PhaseAnalysisPass.hh. Must run before the blocks are instrumented, as the
+// inst_count entries are the sizes nugget_bb_hook used to pass. Clones of a
+// block share the entry of the first one; ids without a block in the module
+// (e.g. deleted by optimizations) have an all-zero entry. The globals are
+// weak, so translation units instrumented on their own still link into one
+// program, and share a COMDAT where the object format has them, so the
+// linker keeps the tables of a single unit.
+void PhaseAnalysisPass::emitBBTable(Module &M,
+                                    const BBIdAnalysis::Result &bb_ids) {
+  if (M.getNamedGlobal("__nugget_bb_table")) {
+    return;
+  }
+  LLVMContext &C = M.getContext();
+  Type *i32_type = Type::getInt32Ty(C);
+  Type *i64_type = Type::getInt64Ty(C);
+  Type *name_type = PointerType::getUnqual(Type::getInt8Ty(C));
+  StructType *entry_type = StructType::get(C,
+      {i32_type, i32_type, i32_type});
+
+  uint64_t num_entries = 0;
+  for (const BBIdAnalysis::LabeledBB &labeled : bb_ids.blocks()) {
+    num_entries = std::max(num_entries, labeled.bb_id + 1);
+  }
+  std::vector<Constant*> entries(num_entries,
+                                 Constant::getNullValue(entry_type));
+  std::vector<bool> filled(num_entries);
+  std::vector<Constant*> names;
+  DenseMap<const Function*, uint32_t> function_ids;
+  for (const BBIdAnalysis::LabeledBB &labeled : bb_ids.blocks()) {
+    BasicBlock &BB = *labeled.block;
+    Function *F = BB.getParent();
+    auto [it, inserted] = function_ids.try_emplace(F, names.size());
+    if (inserted) {
+      GlobalVariable *name = new GlobalVariable(M,
+          ArrayType::get(Type::getInt8Ty(C), F->getName().size() + 1),
+          /*isConstant=*/true, GlobalValue::PrivateLinkage,
+          ConstantDataArray::getString(C, F->getName()),
+          "nugget_function_name");
+      name->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+      names.push_back(ConstantExpr::getPointerCast(name, name_type));
+    }
+    if (filled[labeled.bb_id]) {
+      continue;
+    }
+    filled[labeled.bb_id] = true;
+    uint32_t flags = 0;
+    if (&BB == &F->getEntryBlock()) {
+      flags |= NUGGET_BB_ENTRY;
+    }
+    if (isa<ReturnInst>(BB.getTerminator())) {
+      flags |= NUGGET_BB_RETURN;
+    }
+    for (const Instruction &I : BB) {
+      if (isa<CallBase>(I) && !isa<IntrinsicInst>(I)) {
+        flags |= NUGGET_BB_CALL;
+        break;
+      }
+    }
+    entries[labeled.bb_id] = ConstantStruct::get(entry_type, {
+      ConstantInt::get(i32_type, BB.size()),
+      ConstantInt::get(i32_type, it->second),
+      ConstantInt::get(i32_type, flags),
+    });
+  }
+
+  Triple triple(M.getTargetTriple());
+  ArrayType *table_type = ArrayType::get(entry_type, num_entries);
+  GlobalVariable *table = new GlobalVariable(M, table_type,
+      /*isConstant=*/true, GlobalValue::WeakAnyLinkage,
+      ConstantArray::get(table_type, entries), "__nugget_bb_table");
+  if (triple.isOSBinFormatELF()) {
+    table->setSection("nugget_bb_table");
+  }
+  ArrayType *names_type = ArrayType::get(name_type, names.size());
+  GlobalVariable *globals[] = {
+    table,
+    new GlobalVariable(M, i64_type, /*isConstant=*/true,
+        GlobalValue::WeakAnyLinkage, ConstantInt::get(i64_type, num_entries),
+        "__nugget_bb_table_size"),
+    new GlobalVariable(M, names_type, /*isConstant=*/true,
+        GlobalValue::WeakAnyLinkage, ConstantArray::get(names_type, names),
+        "__nugget_function_names"),
+    new GlobalVariable(M, i64_type, /*isConstant=*/true,
+        GlobalValue::WeakAnyLinkage, ConstantInt::get(i64_type, names.size()),
+        "__nugget_num_functions"),
+  };
+  if (triple.supportsCOMDAT()) {
+    Comdat *comdat = M.getOrInsertComdat("__nugget_bb_table");
+    for (GlobalVariable *global : globals) {
+      global->setComdat(comdat);
+    }
+  }
+}
+
+// Register the module with the runtime instead of exporting its tables, see
+// PhaseAnalysisPass.hh. Must run after emitBBTable and emitModuleFingerprint.
+void PhaseAnalysisPass::emitModuleRegistration(Module &M,
+                  GlobalVariable *id_base_global, uint64_t id_base) {
+  if (M.getNamedGlobal("nugget_module")) {
+    return;
+  }
+  LLVMContext &C = M.getContext();
+  Type *i64_type = Type::getInt64Ty(C);
+  Type *ptr_type = PointerType::getUnqual(Type::getInt8Ty(C));
+  GlobalVariable *fingerprint =
+      M.getNamedGlobal("nugget_module_fingerprint");
+  GlobalVariable *table = M.getNamedGlobal("__nugget_bb_table");
+  GlobalVariable *table_size = M.getNamedGlobal("__nugget_bb_table_size");
+  GlobalVariable *names = M.getNamedGlobal("__nugget_function_names");
+  GlobalVariable *num_names = M.getNamedGlobal("__nugget_num_functions");
+  for (GlobalVariable *global :
+       {fingerprint, table, table_size, names, num_names}) {
+    global->setLinkage(GlobalValue::InternalLinkage);
+    global->setComdat(nullptr);
+  }
+  M.getComdatSymbolTable().erase("__nugget_bb_table");
+
+  // struct nugget_module of runtime/nugget_rt.h
+  StructType *module_type = StructType::get(C, {i64_type, i64_type,
+      i64_type, ptr_type, ptr_type, i64_type, ptr_type});
+  GlobalVariable *module = new GlobalVariable(M, module_type,
+      /*isConstant=*/true, GlobalValue::InternalLinkage,
+      ConstantStruct::get(module_type, {
+        fingerprint->getInitializer(),
+        ConstantInt::get(i64_type, id_base),
+        table_size->getInitializer(),
+        ConstantExpr::getPointerCast(table, ptr_type),
+        ConstantExpr::getPointerCast(names, ptr_type),
+        num_names->getInitializer(),
+        ConstantExpr::getPointerCast(id_base_global, ptr_type),
+      }), "nugget_module");
+
+  Function *register_function = getOrDeclareRuntimeFunction(M,
+      "nugget_register_module", FunctionType::get(Type::getVoidTy(C),
+                                                  {ptr_type}, false));
+  if (!register_function) {
+    report_fatal_error("Error declaring nugget_register_module");
+  }
+  Function *ctor = Function::Create(
+      FunctionType::get(Type::getVoidTy(C), false),
+      GlobalValue::InternalLinkage, "nugget_register_module_ctor", M);
+  IRBuilder<> builder(BasicBlock::Create(C, "entry", ctor));
+  builder.CreateCall(register_function,
+                     {ConstantExpr::getPointerCast(module, ptr_type)});
+  builder.CreateRetVoid();
+  // Ahead of the program's own constructors, which may run instrumented
+  // code, like the sanitizer runtimes
+  appendToGlobalCtors(M, ctor, 1);
+}
+
+PreservedAnalyses PhaseAnalysisPass::run(Module &M,
+                                         ModuleAnalysisManager &MAM) {
   LLVMContext &C = M.getContext();
 
   // First, instrument every basic block in every function
@@ -99,23 +1297,146 @@ PreservedAnalyses PhaseAnalysisPass::run(Module &M, ModuleAnalysisManager &) {
 
   uint64_t threshold = std::stoull(GetOptionValue(options_, 
                                                           "interval_length"));
+  std::string mode = GetOptionValue(options_, "mode");
+  std::string placement = GetOptionValue(options_, "placement");
+  InlineConfig config;
+  config.edge_placement = placement == "edge";
+  config.loop_hoist = GetOptionValue(options_, "loop_hoist") == "true";
+  config.promote = GetOptionValue(options_, "promote") == "true";
+  config.promote_stride = std::stoull(GetOptionValue(options_,
+                                                     "promote_stride"));
+  std::string threading = GetOptionValue(options_, "threading");
+  config.thread_local_counters = threading == "tls";
+  config.touched = GetOptionValue(options_, "touched") == "true";
+  std::string id_base_option = GetOptionValue(options_, "id_base");
+  bool register_module = id_base_option != "none";
+  uint64_t id_base = UINT64_MAX;  // NUGGET_ID_BASE_AUTO of the runtime
+  if (register_module && id_base_option != "auto") {
+    id_base = std::stoull(id_base_option);
+  }
   DEBUG_PRINT("PhaseAnalysisPass options:"
       << "\n  interval_length: " << threshold
+      << "\n  mode: " << mode
+      << "\n  placement: " << placement
+      << "\n  loop_hoist: " << (config.loop_hoist ? "true" : "false")
+      << "\n  promote: " << (config.promote ? "true" : "false")
+      << "\n  promote_stride: " << config.promote_stride
+      << "\n  threading: " << threading
+      << "\n  touched: " << config.touched
+      << "\n  id_base: " << id_base_option
   );
+  if (placement != "block" && placement != "edge") {
+    report_fatal_error(Twine("Unknown phase-analysis-pass placement: ") +
+                       placement);
+  }
+  if (placement == "edge" && mode != "inline") {
+    report_fatal_error("placement=edge requires mode=inline");
+  }
+  if (config.loop_hoist && (mode != "inline" || placement != "block")) {
+    report_fatal_error("loop_hoist=true requires mode=inline and "
+                       "placement=block");
+  }
+  if (config.promote && (mode != "inline" || placement != "block")) {
+    report_fatal_error("promote=true requires mode=inline and "
+                       "placement=block");
+  }
+  if (threading != "none" && threading != "tls") {
+    report_fatal_error(Twine("Unknown phase-analysis-pass threading: ") +
+                       threading);
+  }
+  // In call mode the counters belong to the runtime, which can keep them
+  // per thread itself.
+  if (config.thread_local_counters && mode != "inline") {
+    report_fatal_error("threading=tls requires mode=inline");
+  }
+  if (config.touched && (mode != "inline" || placement != "block")) {
+    report_fatal_error("touched=true requires mode=inline and "
+                       "placement=block");
+  }
+  // The inline counters are indexed by the module's own bb_ids and handed
+  // to the runtime without saying which module they belong to.
+  if (register_module && mode != "call") {
+    report_fatal_error("id_base requires mode=call");
+  }
+  // A registered module adds its base from here rather than a constant, so
+  // the runtime can move an id_base=<N> module loaded after nugget_init
+  // past the bb_ids already in use.
+  GlobalVariable *id_base_global = nullptr;
+  if (register_module) {
+    Type *i64_type = Type::getInt64Ty(C);
+    id_base_global = new GlobalVariable(M, i64_type, /*isConstant=*/false,
+        GlobalValue::InternalLinkage,
+        ConstantInt::get(i64_type, id_base == UINT64_MAX ? 0 : id_base),
+        "nugget_id_base");
+  }
 
-  if (!instrumentAllIRBasicBlocks(M, total_basic_block_count, 
-                                                        threshold)) {
-    report_fatal_error("Error instrumenting basic blocks");
+  // nugget_touched_ids holds i32 bb_ids
+  if (config.touched) {
+    uint64_t max_bb_id = 0;
+    for (const BBIdAnalysis::LabeledBB &labeled :
+         MAM.getResult<BBIdAnalysis>(M).blocks()) {
+      max_bb_id = std::max(max_bb_id, labeled.bb_id);
+    }
+    if (max_bb_id > UINT32_MAX) {
+      report_fatal_error(Twine("touched=true supports bb_ids up to ") +
+                         Twine(UINT32_MAX) + ", the module has bb_id " +
+                         Twine(max_bb_id));
+    }
+  }
+
+  emitBBTable(M, MAM.getResult<BBIdAnalysis>(M));
+  if (mode == "inline") {
+    if (!instrumentAllIRBasicBlocksInline(M, MAM, total_basic_block_count,
+                                          threshold, config)) {
+      report_fatal_error("Error instrumenting basic blocks");
+    }
+  } else if (mode == "call") {
+    if (!instrumentAllIRBasicBlocks(M, MAM.getResult<BBIdAnalysis>(M),
+                                    total_basic_block_count,
+                                    id_base_global)) {
+      report_fatal_error("Error instrumenting basic blocks");
+    }
+  } else {
+    report_fatal_error(Twine("Unknown phase-analysis-pass mode: ") + mode);
   }
   assert(total_basic_block_count >= 1 && 
                 "There should be at least one basic block instrumented");
   DEBUG_PRINT("Total basic blocks instrumented: " 
                                                 << total_basic_block_count);
+  // The runtime learns the interval length here rather than from every
+  // nugget_bb_hook call, so it can record it in the trace header and a
+  // mode=call build can be rerun with another length.
   Value* total_bb_count_arg = ConstantInt::get(
         Type::getInt64Ty(C), total_basic_block_count);
-  if (!instrumentRoiBegin(M, {total_bb_count_arg})) {
+  Value* interval_length_arg = ConstantInt::get(Type::getInt64Ty(C),
+                                                threshold);
+  // Only one of the modules of a program defines the ROI, e.g. one of its
+  // separately instrumented translation units
+  Function *roi_begin = M.getFunction("nugget_roi_begin_");
+  bool defines_roi = roi_begin && !roi_begin->isDeclaration();
+  if (defines_roi &&
+      !instrumentRoiBegin(M, {total_bb_count_arg, interval_length_arg})) {
     report_fatal_error("Error instrumenting nugget_roi_begin_");
   }
-  return PreservedAnalyses::all();
+  if (!defines_roi && !register_module) {
+    errs() << "Warning: nugget_roi_begin_ is not defined in "
+           << M.getModuleIdentifier() << "; another module of the program "
+           << "must define it to call nugget_init\n";
+  }
+  emitModuleFingerprint(M);
+  if (register_module) {
+    emitModuleRegistration(M, id_base_global, id_base);
+  }
+  // The inline modes split blocks, which invalidates the CFG analyses
+  // (including the BlockFrequencyInfo queried for edge placement) and the
+  // block map of BBIdAnalysis. Call mode only inserts calls before the
+  // terminators.
+  if (mode == "inline") {
+    return PreservedAnalyses::none();
+  }
+  PreservedAnalyses preserved;
+  preserved.preserveSet<CFGAnalyses>();
+  preserved.preserve<BBIdAnalysis>();
+  return preserved;
 
 }
\ No newline at end of file
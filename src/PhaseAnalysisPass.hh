@@ -31,16 +31,157 @@
 #ifndef _PHASEANALYSISPASS_HH_
 #define _PHASEANALYSISPASS_HH_
 
+#include "BBIdAnalysis.hh"
 #include "common.hh"
 
 const std::vector<Options> PhaseAnalysisPassOptions = {
-    {"interval_length", ""}, // Length in terms of IR instruction executed
+    // Length in terms of IR instruction executed, passed to the runtime once
+    // as nugget_init(total_bb_count, interval_length)
+    {"interval_length", ""},
+    // How every basic block is counted:
+    //   call   - call nugget_bb_hook(bb_id) per block; the runtime looks
+    //            the block size up in __nugget_bb_table and closes the
+    //            interval at interval_length
+    //   inline - update pass-created counters inline and only call
+    //            nugget_interval_hook when the interval threshold is crossed
+    {"mode", "call"},
+    // Where the inline counters are placed (mode=inline only):
+    //   block - one counter update per labeled basic block
+    //   edge  - counters only on the CFG edges outside a spanning tree
+    //           grown along the hottest edges by BlockFrequencyInfo;
+    //           per-block counts are reconstructed by flow conservation
+    //           when an interval closes
+    {"placement", "block"},
+    // Hoist the counter updates of counted innermost loops to the loop exit
+    // (mode=inline, placement=block only): "true" or "false"
+    {"loop_hoist", "false"},
+    // Keep the counters of the remaining innermost loops in registers
+    // (mode=inline, placement=block only): "true" or "false"
+    {"promote", "false"},
+    // With promote=true, also flush every promote_stride iterations
+    // (0 = flush at loop exits only)
+    {"promote_stride", "1024"},
+    // Counter storage of the inline modes:
+    //   none - one set of counters shared by all threads
+    //   tls  - thread_local counters, one basic block vector per thread
+    {"threading", "none"},
+    // Also record which blocks were counted in the current interval, so the
+    // runtime can emit and reset only those (mode=inline, placement=block
+    // only): "true" or "false"
+    {"touched", "false"},
+    // Namespace of the module's bb_ids, for programs made of several
+    // separately instrumented modules (mode=call only):
+    //   none - the module's bb_ids are the program's (one module only)
+    //   auto - the runtime assigns the module a base at load time
+    //   <N>  - the module's bb_ids start at N
+    {"id_base", "none"},
 };
 
 // PhaseAnalysisPass - instrument every basic block to collect runtime data
 // It expects every IR basic block is labeled with metadata from IRBBLabel pass
 // This is important because it ensures the IR basic block identify remains
 // stable.
+//
+// In inline mode the pass creates two module globals:
+//   nugget_bb_counters  - [N x i64] per bb_id execution counts
+//   nugget_inst_counter - i64 IR instructions executed in the current interval
+// and every block increments its counter and the instruction count inline.
+// Only when the instruction count reaches the threshold does the block take
+// a cold path calling
+//   nugget_interval_hook(bb_counters, N, inst_count)
+// after which the pass-emitted code resets nugget_inst_counter to zero. The
+// runtime is responsible for consuming and zeroing bb_counters.
+//
+// With placement=edge the pass grows, for every function, a spanning tree
+// over the CFG (plus a virtual node joining exits to the entry) from the
+// virtual node, hottest edges first, and only counts the edges outside the
+// tree, in nugget_edge_values. Each instrumented edge also advances
+// nugget_inst_counter by the instruction count of its fundamental cycle, so
+// the clock is exact whenever no frame of an instrumented function is half
+// way through a path. On the cold path the pass-emitted nugget_edge_flush
+// solves the tree edges by flow conservation, fills nugget_bb_counters and
+// then calls nugget_interval_hook exactly as in block placement, so the
+// runtime sees basic block vectors of the same shape. The reconstruction
+// assumes every frame has returned. A frame that is live at a flush leaves
+// the blocks on its tree path one short and the clock short by their size;
+// since every tree edge points away from the virtual node, the counts never
+// run ahead, and the shortfall is made up at a later flush once the frame
+// returns. Counts that turn negative meanwhile wait in nugget_bb_carry,
+// which is empty again by then, so run totals equal those of block
+// placement. Functions that call nugget_roi_end_, directly or through other
+// functions of the module, use block placement, as their frames are still
+// live at the last flush; frames abandoned by exit() or longjmp stay short.
+// Functions whose uninstrumentable edges (EH pads, indirectbr) cannot all be
+// put in the tree fall back to block placement too.
+//
+// With loop_hoist=true, innermost loops whose trip count ScalarEvolution can
+// compute and whose blocks all run once per iteration get no instrumentation
+// in the loop body. The trip count is expanded in the preheader and the exit
+// block adds it to every block counter of the loop and trip_count * loop_size
+// to nugget_inst_counter, so the interval check happens at the loop exit.
+// Loops that call functions are left alone to keep the callee's intervals
+// accurate.
+//
+// With promote=true, the other call-free innermost loops keep their block
+// counts and instruction count in local variables that are promoted to SSA
+// registers. They are added to nugget_bb_counters and nugget_inst_counter,
+// followed by the threshold check, at every loop exit and every
+// promote_stride iterations of the latch, so an interval closes at most
+// promote_stride iterations late.
+//
+// The inline modes also define nugget_flush_interval(), which closes the
+// calling thread's pending partial interval through the same cold path
+// (nothing happens if it is empty). Runtimes call it at ROI end, at exit and
+// before a thread terminates.
+//
+// With threading=tls every global above is thread_local (initial-exec
+// model): each thread counts into its own nugget_bb_counters and has its own
+// interval clock, and nugget_interval_hook is called on the thread whose
+// clock reached the threshold with that thread's counters. Merging the
+// threads' instruction counts into a global clock is left to the runtime.
+//
+// With touched=true the first update of a counter in an interval also
+// appends its bb_id to nugget_touched_ids ([N x i32], nugget_num_touched
+// entries), and the cold path calls
+//   nugget_sparse_interval_hook(counters, touched_ids, num_touched, insts)
+// instead of nugget_interval_hook. The runtime then emits and zeroes only
+// the counters that were touched; the pass resets nugget_num_touched. The
+// pass rejects a module with bb_ids above UINT32_MAX.
+//
+// Every mode also defines the weak constant nugget_module_fingerprint, the
+// fingerprint IRBBLabel stored for the bb_info CSV, so traces written by the
+// runtime can be matched against the CSV they were labeled with, and a
+// static table of the labeled blocks, indexed by bb_id:
+//   __nugget_bb_table        - [N x {i32 inst_count, i32 function_id,
+//                              i32 flags}] in section nugget_bb_table (ELF)
+//   __nugget_bb_table_size   - i64 N
+//   __nugget_function_names  - [F x ptr] names indexed by function_id
+//   __nugget_num_functions   - i64 F
+// mode=call passes only the bb_id to nugget_bb_hook and the runtime reads
+// the instruction count from the table, which keeps each call down to one
+// immediate; the names let the runtime report functions without the CSV.
+// The table globals are weak and share the COMDAT __nugget_bb_table where
+// the object format supports it, so translation units instrumented on their
+// own link into one program, which keeps the tables of one of them.
+//
+// With id_base=auto or id_base=<N> the globals above are internal, so any
+// number of modules can be linked or loaded into one program, and a
+// constructor registers the module with the runtime:
+//   nugget_register_module(&nugget_module)
+// where nugget_module is a struct nugget_module (runtime/nugget_rt.h) that
+// points to the module's tables. Every nugget_bb_hook call passes
+// nugget_id_base + bb_id, where nugget_id_base is an internal global holding
+// N, or 0 with id_base=auto, and the runtime stores the base it assigned the
+// module into it. A module that does not define nugget_roi_begin_
+// gets no nugget_init call, with a warning unless it registers itself.
+
+// Bits of the flags of a __nugget_bb_table entry. Must match NUGGET_BB_* in
+// runtime/nugget_rt.h.
+enum NuggetBBFlags : uint32_t {
+    NUGGET_BB_ENTRY = 1u << 0,   // Entry block of its function
+    NUGGET_BB_RETURN = 1u << 1,  // Ends in a return
+    NUGGET_BB_CALL = 1u << 2,    // Calls a function other than an intrinsic
+};
 
 class PhaseAnalysisPass : public PassInfoMixin<PhaseAnalysisPass> {
   public:
@@ -50,12 +191,116 @@ class PhaseAnalysisPass : public PassInfoMixin<PhaseAnalysisPass> {
     }
     ~PhaseAnalysisPass() = default;
   private:
+    // A labeled basic block and its size, recorded before any
+    // instrumentation is inserted.
+    struct LabeledBlock {
+        BasicBlock *bb;
+        uint64_t bb_id;
+        uint64_t bb_size;
+    };
+
+    // Pass-created globals shared by the inline instrumentation modes.
+    struct InlineCounters {
+        ArrayType *counters_type;      // [N x i64]
+        GlobalVariable *bb_counters;   // Per bb_id execution counts
+        GlobalVariable *inst_counter;  // Instructions in the current interval
+        uint64_t num_counters;         // N = max bb_id + 1
+        uint64_t threshold;            // Interval length
+        Function *interval_hook;       // nugget_interval_hook
+        // Edge placement only: counted and reconstructed edge values and the
+        // cold path that rebuilds bb_counters from them
+        GlobalVariable *edge_values = nullptr;
+        Function *edge_flush = nullptr;
+        // touched=true only: ids of the counters updated in the interval
+        ArrayType *touched_type = nullptr;          // [N x i32]
+        GlobalVariable *touched_ids = nullptr;
+        GlobalVariable *num_touched = nullptr;      // i64
+        Function *sparse_interval_hook = nullptr;   // nugget_sparse_interval_hook
+    };
+
+    // A CFG edge that gets a counter in edge placement. A null src is the
+    // virtual edge into the entry block, a null dst the virtual edge out of
+    // an exit block.
+    struct EdgeCounter {
+        BasicBlock *src;
+        BasicBlock *dst;
+        uint64_t value_index;  // Index into nugget_edge_values
+        int64_t inst_weight;   // Clock advance when the edge is taken
+    };
+
+    // Inline instrumentation settings taken from the pass options.
+    struct InlineConfig {
+        bool edge_placement;     // placement=edge
+        bool loop_hoist;         // loop_hoist=true
+        bool promote;            // promote=true
+        uint64_t promote_stride; // Latch iterations between flushes, 0 = none
+        bool thread_local_counters; // threading=tls
+        bool touched;            // touched=true
+    };
+
+    // An innermost loop whose block counts are added once at its exit.
+    struct HoistedLoop {
+        BasicBlock *exit;                 // Unique exit, only entered from the latch
+        Value *trip_count;                // i64 iterations, expanded in the preheader
+        std::vector<LabeledBlock> blocks; // Labeled blocks of the loop
+        uint64_t loop_size;               // Instructions per iteration
+    };
+
+    // An innermost loop whose counters live in registers between flushes.
+    // The insertion points are recorded before any block is split.
+    struct PromotedLoop {
+        std::vector<LabeledBlock> blocks;       // Labeled blocks of the loop
+        Instruction *preheader_point;           // Preheader terminator
+        Instruction *latch_point;               // Latch terminator
+        std::vector<Instruction*> exit_points;  // First insertion point of each exit
+    };
+
     std::vector<Options> options_;
-    bool instrumentAllIRBasicBlocks(Module &M, 
-                  int64_t &total_basic_block_count, const uint64_t threshold);
+    bool instrumentAllIRBasicBlocks(Module &M,
+                  const BBIdAnalysis::Result &bb_ids,
+                  int64_t &total_basic_block_count,
+                  GlobalVariable *id_base_global);
+    bool instrumentAllIRBasicBlocksInline(Module &M, ModuleAnalysisManager &MAM,
+                  int64_t &total_basic_block_count, const uint64_t threshold,
+                  const InlineConfig &config);
+    std::vector<LabeledBlock> collectLabeledBlocks(
+                  const BBIdAnalysis::Result &bb_ids);
+    bool planFunctionEdges(Function &F,
+                  const DenseMap<BasicBlock*, LabeledBlock> &labels,
+                  BlockFrequencyInfo &BFI, BranchProbabilityInfo &BPI,
+                  uint64_t &num_edge_values,
+                  std::vector<EdgeCounter> &edge_counters,
+                  std::vector<uint32_t> &edge_ops,
+                  std::vector<uint32_t> &bb_ops);
+    void planLoopHoisting(Function &F,
+                  const DenseMap<BasicBlock*, LabeledBlock> &labels,
+                  LoopInfo &LI, DominatorTree &DT, ScalarEvolution &SE,
+                  std::vector<HoistedLoop> &hoisted_loops);
+    void planLoopPromotion(const DenseMap<BasicBlock*, LabeledBlock> &labels,
+                  LoopInfo &LI, std::vector<PromotedLoop> &promoted_loops);
+    void emitPromotedLoop(IRBuilder<> &builder, const PromotedLoop &loop,
+                  const InlineCounters &counters, uint64_t promote_stride,
+                  std::vector<AllocaInst*> &allocas);
+    Function *createEdgeFlush(Module &M, const InlineCounters &counters,
+                  uint64_t num_edge_values,
+                  const std::vector<uint32_t> &edge_ops,
+                  const std::vector<uint32_t> &bb_ops);
+    Function *createIntervalFlush(Module &M, const InlineCounters &counters);
+    void emitIntervalHookCall(IRBuilder<> &builder,
+                  const InlineCounters &counters, Value *inst_count);
+    void emitClockUpdate(IRBuilder<> &builder, Instruction *insert_point,
+                  const InlineCounters &counters, Value *inst_delta);
+    void emitCounterAdd(IRBuilder<> &builder, const InlineCounters &counters,
+                  uint64_t bb_id, Value *delta, bool delta_may_be_zero);
+    void emitModuleFingerprint(Module &M);
+    void emitBBTable(Module &M, const BBIdAnalysis::Result &bb_ids);
+    void emitModuleRegistration(Module &M, GlobalVariable *id_base_global,
+                  uint64_t id_base);
+    void emitBlockCounterUpdate(IRBuilder<> &builder,
+                  const LabeledBlock &block, const InlineCounters &counters);
   
   public:
-    PreservedAnalyses run(Module &M, ModuleAnalysisManager &);
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM);
 };
 
 #endif // _PHASEANALYSISPASS_HH_
\ No newline at end of file
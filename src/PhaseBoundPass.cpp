@@ -29,195 +29,365 @@
 
 #include "PhaseBoundPass.hh"
 
-// Instrument the marker basic blocks with the corresponding marker functions
+// Count down nugget_marker_countdowns[index] before insert_point and call
+// the marker hook on the cold path once it reaches zero:
+//   if (--nugget_marker_countdowns[index] == 0)  // cold
+//     hook(hook_args)
+static void emitCountdown(Instruction *insert_point,
+        GlobalVariable *countdowns, uint64_t index, Function *hook,
+        ArrayRef<Value*> hook_args, bool atomic_countdown) {
+    LLVMContext &C = insert_point->getContext();
+    Type *i64_type = Type::getInt64Ty(C);
+    IRBuilder<> builder(insert_point);
+    Value *countdown = builder.CreateConstInBoundsGEP2_64(
+                        countdowns->getValueType(), countdowns, 0, index);
+    Value *one = ConstantInt::get(i64_type, 1);
+    Value *remaining;
+    if (atomic_countdown) {
+        Value *old = builder.CreateAtomicRMW(AtomicRMWInst::Sub, countdown,
+                            one, MaybeAlign(8), AtomicOrdering::Monotonic);
+        remaining = builder.CreateSub(old, one);
+    } else {
+        remaining = builder.CreateSub(
+                            builder.CreateLoad(i64_type, countdown), one);
+        builder.CreateStore(remaining, countdown);
+    }
+    Value *reached = builder.CreateICmpEQ(remaining,
+                                          ConstantInt::get(i64_type, 0));
+    MDNode *unlikely = MDBuilder(C).createBranchWeights(1, (1U << 20) - 1);
+    Instruction *then_term = SplitBlockAndInsertIfThen(reached, insert_point,
+                                          /*Unreachable=*/false, unlikely);
+    builder.SetInsertPoint(then_term);
+    builder.CreateCall(hook, hook_args);
+}
+
+// Instrument the marker basic blocks with the corresponding marker functions,
+// or with countdowns that call them when countdowns is set
 bool PhaseBoundPass::instrumentMarkerBBs(Module &M,
+        const BBIdAnalysis::Result &bb_ids,
         const uint64_t warmup_marker_bb_id,
         const uint64_t start_marker_bb_id,
         const uint64_t end_marker_bb_id,
-        bool no_warmup_marker) {
+        bool no_warmup_marker,
+        GlobalVariable *countdowns,
+        bool atomic_countdown) {
     
-    Function* warmup_marker_hook_function = M.getFunction(
-                                        "nugget_warmup_marker_hook");
-    if (!warmup_marker_hook_function && !no_warmup_marker) {
-        errs() << "Function nugget_warmup_marker_hook not found\n";
-        return false;
+    FunctionType *marker_hook_type = FunctionType::get(
+                            Type::getVoidTy(M.getContext()), false);
+    Function* warmup_marker_hook_function = nullptr;
+    if (!no_warmup_marker) {
+        warmup_marker_hook_function = getOrDeclareRuntimeFunction(M,
+                            "nugget_warmup_marker_hook", marker_hook_type);
+        if (!warmup_marker_hook_function) {
+            return false;
+        }
     }
-    Function* start_marker_hook_function = M.getFunction(
-                                        "nugget_start_marker_hook");
+    Function* start_marker_hook_function = getOrDeclareRuntimeFunction(M,
+                            "nugget_start_marker_hook", marker_hook_type);
     if (!start_marker_hook_function) {
-        errs() << "Function nugget_start_marker_hook not found\n";
         return false;
     }
-    Function* end_marker_hook_function = M.getFunction(
-                                        "nugget_end_marker_hook");
+    Function* end_marker_hook_function = getOrDeclareRuntimeFunction(M,
+                            "nugget_end_marker_hook", marker_hook_type);
     if (!end_marker_hook_function) {
-        errs() << "Function nugget_end_marker_hook not found\n";
         return false;
     }
 
-    std::vector<std::pair<uint64_t, Function*>> markers_to_instrument = {
-        {start_marker_bb_id, start_marker_hook_function},
-        {end_marker_bb_id, end_marker_hook_function}
-    };
-    
+    // Markers that share a block are inserted in warmup, start, end order.
+    // The countdown index of a marker is its position in that order.
+    std::vector<std::tuple<uint64_t, Function*, uint64_t>>
+                                                    markers_to_instrument;
     if (!no_warmup_marker) {
         markers_to_instrument.push_back(
-            {warmup_marker_bb_id, warmup_marker_hook_function});
+            {warmup_marker_bb_id, warmup_marker_hook_function, 0});
     }
+    markers_to_instrument.push_back(
+        {start_marker_bb_id, start_marker_hook_function, 1});
+    markers_to_instrument.push_back(
+        {end_marker_bb_id, end_marker_hook_function, 2});
 
-    // Find the basic blocks with the given bb_ids and instrument them
-    LLVMContext &Context = M.getContext();
-    IRBuilder<> builder(Context);
-    int64_t bb_id = -1;
-    for (Function &F : M) {
-        if (F.isDeclaration()) continue;
-
-        if (std::find(nugget_functions.begin(), nugget_functions.end(),
-                      F.getName().str()) != nugget_functions.end()) {
-            continue;
+    // Find the terminators of the marker blocks first: a countdown splits
+    // its block, which moves the terminator to a new block
+    std::vector<Instruction*> insert_points;
+    for (const auto &marker : markers_to_instrument) {
+        BasicBlock *BB = bb_ids.lookup(std::get<0>(marker));
+        if (!BB) {
+            return false;
         }
-        
-        for (BasicBlock &BB : F) {
-            // Get the bb_id metadata
-            bb_id = -1;
-            Instruction *T = BB.getTerminator();
-            if (T) {
-                MDNode* bb_id_md = T->getMetadata(kBbIdKey);
-                if (!bb_id_md) {
-                    continue;
-                }
-                
-                // Cast operand to MDString and extract the value
-                MDString *bb_id_str = dyn_cast<MDString>(
-                                                    bb_id_md->getOperand(0));
-                if (!bb_id_str) {
-                    continue;
-                }
-                bb_id = std::stoll(bb_id_str->getString().str());
-            } else {
-                continue;
-            }
-            assert(bb_id != -1 && "bb_id should have been set from metadata");
-
-            for (const auto &marker : markers_to_instrument) {
-                if (bb_id == marker.first) {
-                    // Instrument this basic block with the corresponding hook
-                    builder.SetInsertPoint(T);
-                    builder.CreateCall(marker.second, {});
-                    markers_to_instrument.erase(
-                        std::remove_if(
-                            markers_to_instrument.begin(),
-                            markers_to_instrument.end(),
-                            [&](const std::pair<uint64_t, 
-                                    Function*> &m) {
-                                return m.first == bb_id;
-                            }),
-                        markers_to_instrument.end());
-                }
-            }
+        insert_points.push_back(BB->getTerminator());
+    }
 
-            if (markers_to_instrument.empty()) {
-                return true; // All markers have been instrumented
-            }
-        }
-        if (markers_to_instrument.empty()) {
-            return true; // All markers have been instrumented
+    IRBuilder<> builder(M.getContext());
+    for (size_t i = 0; i < markers_to_instrument.size(); i++) {
+        Function *hook = std::get<1>(markers_to_instrument[i]);
+        if (countdowns) {
+            emitCountdown(insert_points[i], countdowns,
+                          std::get<2>(markers_to_instrument[i]), hook, {},
+                          atomic_countdown);
+        } else {
+            builder.SetInsertPoint(insert_points[i]);
+            builder.CreateCall(hook, {});
         }
     }
-
-    // If we reach here, some markers were not found
-    return false;
+    return true;
 }
 
 // Label the marker basic blocks with inline assembly markers
 bool PhaseBoundPass::labelMarkerBBs(Module &M,
+    const BBIdAnalysis::Result &bb_ids,
     const uint64_t warmup_marker_bb_id,
     const uint64_t start_marker_bb_id,
     const uint64_t end_marker_bb_id,
     bool no_warmup_marker) {
 
-    std::vector<std::pair<uint64_t, std::string>> markers_to_instrument = {
-        {start_marker_bb_id, "nugget_start_marker:\n\tnop\n"},
-        {end_marker_bb_id, "nugget_end_marker:\n\tnop\n"}
-    };
-    
+    std::vector<std::pair<uint64_t, std::string>> markers_to_instrument;
     if (!no_warmup_marker) {
         markers_to_instrument.push_back(
             {warmup_marker_bb_id, "nugget_warmup_marker:\n\tnop\n"});
     }
+    markers_to_instrument.push_back(
+        {start_marker_bb_id, "nugget_start_marker:\n\tnop\n"});
+    markers_to_instrument.push_back(
+        {end_marker_bb_id, "nugget_end_marker:\n\tnop\n"});
 
-    // Find the basic blocks with the given bb_ids and instrument them
-    LLVMContext &Context = M.getContext();
-    IRBuilder<> builder(Context);
-    int64_t bb_id = -1;
-    for (Function &F : M) {
-        if (F.isDeclaration()) continue;
+    // Find the basic blocks with the given bb_ids and label them
+    IRBuilder<> builder(M.getContext());
+    auto *asmTy = FunctionType::get(builder.getVoidTy(), false);
+    std::string constraints = "~{memory}";
+    for (const auto &marker : markers_to_instrument) {
+        BasicBlock *BB = bb_ids.lookup(marker.first);
+        if (!BB) {
+            return false;
+        }
+        builder.SetInsertPoint(BB->getTerminator());
+        auto *ia = InlineAsm::get(asmTy, marker.second, constraints, /*hasSideEffects=*/true);
+        builder.CreateCall(ia);
+    }
+    return true;
+}
 
-        if (std::find(nugget_functions.begin(), nugget_functions.end(),
-                      F.getName().str()) != nugget_functions.end()) {
+// Parse a markers_file. Blank lines and lines starting with '#' are
+// skipped, as is a first row that names the columns.
+std::vector<MarkerRegion> PhaseBoundPass::readMarkersFile(
+        const std::string &path) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer =
+                                                MemoryBuffer::getFile(path);
+    if (!buffer) {
+        report_fatal_error(Twine("Cannot read markers_file ") + path + ": " +
+                           buffer.getError().message());
+    }
+    std::vector<MarkerRegion> regions;
+    StringRef text = (*buffer)->getBuffer();
+    bool first_row = true;
+    for (unsigned line_number = 1; !text.empty(); line_number++) {
+        StringRef line;
+        std::tie(line, text) = text.split('\n');
+        line = line.trim();
+        if (line.empty() || line.front() == '#') {
             continue;
         }
-        
-        for (BasicBlock &BB : F) {
-            // Get the bb_id metadata
-            bb_id = -1;
-            Instruction *T = BB.getTerminator();
-            if (T) {
-                MDNode* bb_id_md = T->getMetadata(kBbIdKey);
-                if (!bb_id_md) {
-                    continue;
-                }
-                
-                // Cast operand to MDString and extract the value
-                MDString *bb_id_str = dyn_cast<MDString>(
-                                                    bb_id_md->getOperand(0));
-                if (!bb_id_str) {
-                    continue;
-                }
-                bb_id = std::stoll(bb_id_str->getString().str());
-            } else {
-                continue;
+        SmallVector<StringRef, 7> fields;
+        line.split(fields, ',');
+        uint64_t values[7];
+        bool valid = fields.size() == 7;
+        for (size_t i = 0; valid && i < 7; i++) {
+            valid = !fields[i].trim().getAsInteger(10, values[i]);
+        }
+        if (!valid && first_row && !isDigit(line.front())) {
+            first_row = false;
+            continue;
+        }
+        first_row = false;
+        if (!valid) {
+            report_fatal_error(Twine("markers_file ") + path + ":" +
+                Twine(line_number) + ": expected region_id,warmup_bb,"
+                "warmup_cnt,start_bb,start_cnt,end_bb,end_cnt");
+        }
+        for (const MarkerRegion &region : regions) {
+            if (region.region_id == values[0]) {
+                report_fatal_error(Twine("markers_file ") + path + ":" +
+                    Twine(line_number) + ": duplicate region_id " +
+                    Twine(values[0]));
             }
-            assert(bb_id != -1 && "bb_id should have been set from metadata");
+        }
+        regions.push_back({values[0], values[1], values[2], values[3],
+                           values[4], values[5], values[6]});
+    }
+    if (regions.empty()) {
+        report_fatal_error(Twine("markers_file ") + path +
+                           " has no marker regions");
+    }
+    return regions;
+}
 
-            for (const auto &marker : markers_to_instrument) {
-                if (bb_id == marker.first) {
-                    // Instrument this basic block with the corresponding hook
-                    builder.SetInsertPoint(T);
-                    auto *asmTy = FunctionType::get(builder.getVoidTy(), false);
-                    std::string constraints = "~{memory}";
-                    auto *ia = InlineAsm::get(asmTy, marker.second, constraints, /*hasSideEffects=*/true);
-                    builder.CreateCall(ia);
-                    markers_to_instrument.erase(
-                        std::remove_if(
-                            markers_to_instrument.begin(),
-                            markers_to_instrument.end(),
-                            [&](const std::pair<uint64_t, 
-                                    std::string> &m) {
-                                return m.first == bb_id;
-                            }),
-                        markers_to_instrument.end());
-                }
+// Instrument every region of a markers_file. Hooks take the region's index
+// in the table passed to nugget_init_regions; in label_only mode the labels
+// carry the region_id instead, e.g. nugget_start_marker_7. With countdowns,
+// marker kind of region index counts down entry 3 * index + kind.
+bool PhaseBoundPass::instrumentMarkerRegions(Module &M,
+        const BBIdAnalysis::Result &bb_ids,
+        const std::vector<MarkerRegion> &regions,
+        bool label_only,
+        GlobalVariable *countdowns,
+        bool atomic_countdown) {
+    static const char *const kinds[] = {"warmup", "start", "end"};
+    Type *i64_type = Type::getInt64Ty(M.getContext());
+    FunctionType *region_hook_type = FunctionType::get(
+                    Type::getVoidTy(M.getContext()), {i64_type}, false);
+    Function *region_hooks[3] = {};
+    if (!label_only) {
+        for (int kind = 0; kind < 3; kind++) {
+            region_hooks[kind] = getOrDeclareRuntimeFunction(M,
+                Twine("nugget_").concat(kinds[kind])
+                    .concat("_marker_region_hook").str(),
+                region_hook_type);
+            if (!region_hooks[kind]) {
+                return false;
             }
+        }
+    }
 
-            if (markers_to_instrument.empty()) {
-                return true; // All markers have been instrumented
+    // Resolve all marker blocks before a countdown splits any of them
+    struct RegionMarker {
+        size_t index;
+        int kind;
+        Instruction *insert_point;
+    };
+    std::vector<RegionMarker> markers;
+    for (size_t index = 0; index < regions.size(); index++) {
+        const MarkerRegion &region = regions[index];
+        const uint64_t bb_ids_of_region[3] = {
+            region.warmup_bb_id, region.start_bb_id, region.end_bb_id};
+        // Markers that share a block run in warmup, start, end order
+        for (int kind = region.warmup_count == 0 ? 1 : 0; kind < 3; kind++) {
+            BasicBlock *BB = bb_ids.lookup(bb_ids_of_region[kind]);
+            if (!BB) {
+                errs() << "Region " << region.region_id << ": " << kinds[kind]
+                       << " marker bb_id " << bb_ids_of_region[kind]
+                       << " not found\n";
+                return false;
             }
-        }
-        if (markers_to_instrument.empty()) {
-            return true; // All markers have been instrumented
+            markers.push_back({index, kind, BB->getTerminator()});
         }
     }
 
-    // If we reach here, some markers were not found
-    return false;
+    IRBuilder<> builder(M.getContext());
+    auto *asmTy = FunctionType::get(builder.getVoidTy(), false);
+    for (const RegionMarker &marker : markers) {
+        const MarkerRegion &region = regions[marker.index];
+        const int kind = marker.kind;
+        Value *index_arg = ConstantInt::get(i64_type, marker.index);
+        builder.SetInsertPoint(marker.insert_point);
+        if (label_only) {
+            std::string label = (Twine("nugget_") + kinds[kind] +
+                "_marker_" + Twine(region.region_id) + ":\n\tnop\n").str();
+            builder.CreateCall(InlineAsm::get(asmTy, label, "~{memory}",
+                                              /*hasSideEffects=*/true));
+        } else if (countdowns) {
+            emitCountdown(marker.insert_point, countdowns,
+                          3 * marker.index + kind, region_hooks[kind],
+                          {index_arg}, atomic_countdown);
+        } else {
+            builder.CreateCall(region_hooks[kind], {index_arg});
+        }
+    }
+    return true;
+}
 
+// Create nugget_marker_countdowns with three unarmed entries per region
+static GlobalVariable *createCountdowns(Module &M, uint64_t num_regions) {
+    Type *i64_type = Type::getInt64Ty(M.getContext());
+    ArrayType *countdowns_type = ArrayType::get(i64_type, 3 * num_regions);
+    std::vector<Constant*> unarmed(3 * num_regions,
+                                   ConstantInt::get(i64_type, UINT64_MAX));
+    return new GlobalVariable(M, countdowns_type, /*isConstant=*/false,
+        GlobalValue::InternalLinkage,
+        ConstantArray::get(countdowns_type, unarmed),
+        "nugget_marker_countdowns");
 }
 
 PreservedAnalyses PhaseBoundPass::run(Module &M,
                                       ModuleAnalysisManager &MAM) {
     LLVMContext &Context = M.getContext();
-    
+    bool label_only =
+        GetOptionValue(options_, "label_only") == "true" ? true : false;
+    std::string countdown = GetOptionValue(options_, "countdown");
+    if (countdown != "none" && countdown != "inline" &&
+        countdown != "atomic") {
+        report_fatal_error(Twine("Unknown phase-bound-pass countdown: ") +
+                           countdown);
+    }
+    bool use_countdown = countdown != "none" && !label_only;
+    bool atomic_countdown = countdown == "atomic";
+
+    // Hook calls and labels only insert instructions before terminators, so
+    // the CFG and the block labels are unchanged. Countdowns split the
+    // marker blocks.
+    PreservedAnalyses preserved;
+    if (use_countdown) {
+        preserved = PreservedAnalyses::none();
+    } else {
+        preserved.preserveSet<CFGAnalyses>();
+        preserved.preserve<BBIdAnalysis>();
+    }
+
+    // With a markers_file, pass the regions to the runtime as a table
+    //   [N x [4 x i64]] (region_id, warmup_cnt, start_cnt, end_cnt)
+    // in nugget_init_regions(N, table)
+    static const char *const marker_options[] = {
+        "warmup_marker_bb_id", "warmup_marker_count",
+        "start_marker_bb_id", "start_marker_count",
+        "end_marker_bb_id", "end_marker_count"};
+    std::string markers_file = GetOptionValue(options_, "markers_file");
+    if (markers_file != "none") {
+        for (const char *name : marker_options) {
+            if (GetOptionValue(options_, name) != "none") {
+                report_fatal_error(Twine("phase-bound-pass: ") + name +
+                                   " cannot be combined with markers_file");
+            }
+        }
+        std::vector<MarkerRegion> regions = readMarkersFile(markers_file);
+        Type *i64_type = Type::getInt64Ty(Context);
+        ArrayType *row_type = ArrayType::get(i64_type, 4);
+        std::vector<Constant*> rows;
+        for (const MarkerRegion &region : regions) {
+            rows.push_back(ConstantArray::get(row_type, {
+                ConstantInt::get(i64_type, region.region_id),
+                ConstantInt::get(i64_type, region.warmup_count),
+                ConstantInt::get(i64_type, region.start_count),
+                ConstantInt::get(i64_type, region.end_count)}));
+        }
+        ArrayType *table_type = ArrayType::get(row_type, rows.size());
+        auto *table = new GlobalVariable(M, table_type, /*isConstant=*/true,
+            GlobalValue::PrivateLinkage, ConstantArray::get(table_type, rows),
+            "nugget_marker_regions");
+        Value *table_arg = ConstantExpr::getPointerCast(table,
+                                        PointerType::getUnqual(i64_type));
+        std::vector<Value*> args = {
+            ConstantInt::get(i64_type, regions.size()), table_arg};
+        GlobalVariable *countdowns = nullptr;
+        if (use_countdown) {
+            countdowns = createCountdowns(M, regions.size());
+            args.push_back(ConstantExpr::getPointerCast(countdowns,
+                                        PointerType::getUnqual(i64_type)));
+        }
+        if (!instrumentRoiBegin(M, args, countdowns
+                ? "nugget_init_regions_countdown" : "nugget_init_regions")) {
+            report_fatal_error("Error instrumenting nugget_roi_begin_");
+        }
+        if (!instrumentMarkerRegions(M, MAM.getResult<BBIdAnalysis>(M),
+                regions, label_only, countdowns, atomic_countdown)) {
+            report_fatal_error("Error instrumenting marker regions");
+        }
+        return preserved;
+    }
+    for (const char *name : marker_options) {
+        if (GetOptionValue(options_, name) == "none") {
+            report_fatal_error(Twine("phase-bound-pass: missing required "
+                                     "option: ") + name);
+        }
+    }
+
     uint64_t warmup_marker_bb_id = std::stoull(
         GetOptionValue(options_, "warmup_marker_bb_id"));
     uint64_t warmup_marker_count = std::stoull(
@@ -230,8 +400,6 @@ PreservedAnalyses PhaseBoundPass::run(Module &M,
         GetOptionValue(options_, "end_marker_bb_id"));
     uint64_t end_marker_count = std::stoull(
         GetOptionValue(options_, "end_marker_count"));
-    bool label_only =
-        GetOptionValue(options_, "label_only") == "true" ? true : false;
     DEBUG_PRINT("PhaseBoundPass options:"
         << "\n  warmup_marker_bb_id: " << warmup_marker_bb_id
         << "\n  warmup_marker_count: " << warmup_marker_count
@@ -240,6 +408,7 @@ PreservedAnalyses PhaseBoundPass::run(Module &M,
         << "\n  end_marker_bb_id: " << end_marker_bb_id
         << "\n  end_marker_count: " << end_marker_count
         << "\n  label_only: " << (label_only ? "true" : "false")
+        << "\n  countdown: " << countdown
     );
 
     // Instrument the `nugget_init` function to `nugget_roi_begin_` with the
@@ -251,23 +420,32 @@ PreservedAnalyses PhaseBoundPass::run(Module &M,
             ConstantInt::get(Type::getInt64Ty(Context), start_marker_count));
     args.push_back(
             ConstantInt::get(Type::getInt64Ty(Context), end_marker_count));
-    if (!instrumentRoiBegin(M, args)) {
+    GlobalVariable *countdowns = nullptr;
+    if (use_countdown) {
+        countdowns = createCountdowns(M, 1);
+        args.push_back(ConstantExpr::getPointerCast(countdowns,
+                            PointerType::getUnqual(Type::getInt64Ty(Context))));
+    }
+    if (!instrumentRoiBegin(M, args,
+            countdowns ? "nugget_init_countdown" : "nugget_init")) {
         report_fatal_error("Error instrumenting nugget_roi_begin_");
     }
 
     // Instrument the marker basic blocks with the corresponding marker 
     // functions
+    const BBIdAnalysis::Result &bb_ids = MAM.getResult<BBIdAnalysis>(M);
     if (label_only) {
         if (!labelMarkerBBs(
-            M, warmup_marker_bb_id, start_marker_bb_id, end_marker_bb_id, warmup_marker_count == 0)) {
+            M, bb_ids, warmup_marker_bb_id, start_marker_bb_id, end_marker_bb_id, warmup_marker_count == 0)) {
             report_fatal_error("Error labeling marker basic blocks");
         }
-        return PreservedAnalyses::all();
+        return preserved;
     }
     // Otherwise, instrument the marker BBs
     if (!instrumentMarkerBBs(
-            M, warmup_marker_bb_id, start_marker_bb_id, end_marker_bb_id, warmup_marker_count == 0)) {
+            M, bb_ids, warmup_marker_bb_id, start_marker_bb_id, end_marker_bb_id, warmup_marker_count == 0,
+            countdowns, atomic_countdown)) {
         report_fatal_error("Error instrumenting marker basic blocks");
     }
-    return PreservedAnalyses::all();
+    return preserved;
 }
@@ -31,28 +31,60 @@
 #ifndef _PHASEBOUNDPASS_HH_
 #define _PHASEBOUNDPASS_HH_
 
+#include "BBIdAnalysis.hh"
 #include "common.hh"
 
 const std::vector<Options> PhaseBoundPassOptions = {
+    // The six marker options below are required unless markers_file is set
     // The BB ID of the warmup marker basic block
-    {"warmup_marker_bb_id", ""},
+    {"warmup_marker_bb_id", "none"},
     // Number of executions of the warmup marker basic block before the warmup
     // point is reached
-    {"warmup_marker_count", ""},
+    {"warmup_marker_count", "none"},
     // The BB ID of the start marker basic block
-    {"start_marker_bb_id", ""},
+    {"start_marker_bb_id", "none"},
     // Number of executions of the start marker basic block before the start
     // point is reached
-    {"start_marker_count", ""},
+    {"start_marker_count", "none"},
     // The BB ID of the end marker basic block
-    {"end_marker_bb_id", ""},
+    {"end_marker_bb_id", "none"},
     // Number of executions of the end marker basic block before the end
     // point is reached
-    {"end_marker_count", ""},
+    {"end_marker_count", "none"},
     // If only labeling marker BBs without instrumentation
     {"label_only", "false"},
+    // CSV file with any number of marker regions, one per row:
+    //   region_id,warmup_bb,warmup_cnt,start_bb,start_cnt,end_bb,end_cnt
+    // replaces the six single-region options above
+    {"markers_file", "none"},
+    // How the marker blocks count their executions (ignored by label_only):
+    //   none   - call the marker hook on every execution
+    //   inline - decrement a pass-created counter inline and only call the
+    //            hook on the cold path where it reaches zero
+    //   atomic - like inline, with an atomic decrement for markers that
+    //            several threads execute
+    {"countdown", "none"},
 };
 
+// One row of a markers_file. A warmup_count of 0 means the region has no
+// warmup marker.
+struct MarkerRegion {
+    uint64_t region_id;
+    uint64_t warmup_bb_id;
+    uint64_t warmup_count;
+    uint64_t start_bb_id;
+    uint64_t start_count;
+    uint64_t end_bb_id;
+    uint64_t end_count;
+};
+
+// With countdown the pass creates
+//   nugget_marker_countdowns - [3 * N x i64] remaining executions of the
+//                              warmup, start and end marker of each of the N
+//                              regions (N = 1 without markers_file)
+// initialized to UINT64_MAX, i.e. unarmed. nugget_roi_begin_ passes it to
+// nugget_init_countdown or nugget_init_regions_countdown, and the runtime
+// arms each marker with its count once the marker before it was reached.
 class PhaseBoundPass : public PassInfoMixin<PhaseBoundPass> {
   public:
     PhaseBoundPass(std::vector<Options> Options)
@@ -63,15 +95,26 @@ class PhaseBoundPass : public PassInfoMixin<PhaseBoundPass> {
   private:
     std::vector<Options> options_;
     bool instrumentMarkerBBs(Module &M,
+            const BBIdAnalysis::Result &bb_ids,
             const uint64_t warmup_marker_bb_id,
             const uint64_t start_marker_bb_id,
             const uint64_t end_marker_bb_id,
-            bool no_warmup_marker);
+            bool no_warmup_marker,
+            GlobalVariable *countdowns,
+            bool atomic_countdown);
     bool labelMarkerBBs(Module &M,
+          const BBIdAnalysis::Result &bb_ids,
           const uint64_t warmup_marker_bb_id,
           const uint64_t start_marker_bb_id,
           const uint64_t end_marker_bb_id,
           bool no_warmup_marker);
+    static std::vector<MarkerRegion> readMarkersFile(const std::string &path);
+    bool instrumentMarkerRegions(Module &M,
+          const BBIdAnalysis::Result &bb_ids,
+          const std::vector<MarkerRegion> &regions,
+          bool label_only,
+          GlobalVariable *countdowns,
+          bool atomic_countdown);
   public:
     PreservedAnalyses run(Module &M, ModuleAnalysisManager &);
 };
@@ -28,6 +28,7 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 
+#include "BBIdAnalysis.hh"
 #include "IRBBLabelPass.hh"
 #include "PhaseAnalysisPass.hh"
 #include "PhaseBoundPass.hh"
@@ -47,8 +48,100 @@
 //   4. When -passes="..." is parsed, callback checks for registered pass names
 //   5. If match found, instantiates pass and adds to pipeline
 //
+// The plugin also registers extension point callbacks so the passes can run
+// inside a default pipeline (clang -O2 -fpass-plugin=..., opt
+// -passes='default<O2>'). They are driven by two options that hold pass
+// pipelines in -passes syntax and are empty (disabled) by default:
+//   -nugget-pipeline-start  run before the optimization pipeline
+//   -nugget-optimizer-last  run after the optimization pipeline
+//
 // Currently registered passes:
 //   - ir-bb-label-pass: Basic block labeling and instrumentation
+//   - phase-analysis-pass: Basic block vector collection hooks
+//   - phase-bound-pass: Warmup/start/end marker hooks
+//
+// Currently registered analyses:
+//   - bb-id-analysis (BBIdAnalysis): bb_id <-> BasicBlock maps shared by the
+//     passes above; `require<bb-id-analysis>` computes it in a pipeline
+
+// Pipelines added at the extension points of the default pipelines.
+static cl::opt<std::string> NuggetPipelineStart("nugget-pipeline-start",
+    cl::desc("Nugget passes to run at the start of the default pipeline "
+             "(-passes syntax, e.g. ir-bb-label-pass<output_csv=bb.csv>)"),
+    cl::init(""));
+static cl::opt<std::string> NuggetOptimizerLast("nugget-optimizer-last",
+    cl::desc("Nugget passes to run at the end of the default optimization "
+             "pipeline (-passes syntax, e.g. "
+             "phase-analysis-pass<interval_length=10000>)"),
+    cl::init(""));
+
+// Result of matching a pipeline element against one Nugget pass.
+enum class PassMatch { Added, ParseError, NotMatched };
+
+// Adds PassT to MPM if Name is PassName, with or without <params>.
+//
+// Parameter errors are only reported when the pass name matched, so
+// unrelated pass names in the pipeline do not spam errors.
+template <typename PassT>
+static PassMatch addPassIfMatched(StringRef Name, StringRef PassName,
+                                  const std::vector<Options> &PassOptions,
+                                  ModulePassManager &MPM) {
+    // MatchParamPass handles both forms:
+    //   1. "ir-bb-label-pass" (uses default options)
+    //   2. "ir-bb-label-pass<output_csv=custom.csv>" (parsed options)
+    auto E = MatchParamPass(Name, PassName, PassOptions);
+    if (E) {
+        MPM.addPass(PassT(*E));
+        return PassMatch::Added;
+    }
+    std::string ErrorMsg = toString(E.takeError());
+    if (ErrorMsg.find("name not matched") == std::string::npos) {
+        errs() << PassName << " param parse error: " << ErrorMsg << "\n";
+        return PassMatch::ParseError;
+    }
+    return PassMatch::NotMatched;
+}
+
+// Adds the Nugget pass named by a -passes pipeline element to MPM.
+//
+// Returns:
+//   true if Name is a Nugget pass and was added, false if it is not a
+//   Nugget pass (so other plugins can handle it) or its parameters are
+//   invalid
+static bool addNuggetPass(StringRef Name, ModulePassManager &MPM) {
+    DEBUG_PRINT("Pipeline parsing callback called with Name='" 
+                                                            << Name << "'");
+    PassMatch Match = addPassIfMatched<IRBBLabelPass>(Name,
+                            "ir-bb-label-pass", IRBBLabelPassOptions, MPM);
+    if (Match == PassMatch::NotMatched) {
+        Match = addPassIfMatched<PhaseAnalysisPass>(Name,
+                            "phase-analysis-pass", PhaseAnalysisPassOptions,
+                            MPM);
+    }
+    if (Match == PassMatch::NotMatched) {
+        Match = addPassIfMatched<PhaseBoundPass>(Name,
+                            "phase-bound-pass", PhaseBoundPassOptions, MPM);
+    }
+    return Match == PassMatch::Added;
+}
+
+// Parses the pipeline held by an extension point option into MPM.
+//
+// An invalid pipeline is a fatal error: silently building an
+// uninstrumented binary would be worse.
+static void addOptionPipeline(PassBuilder &PB, ModulePassManager &MPM,
+                              const cl::opt<std::string> &Pipeline) {
+    if (Pipeline.empty()) {
+        return;
+    }
+    DEBUG_PRINT("Adding -" << Pipeline.ArgStr << " pipeline '"
+                                            << Pipeline.getValue() << "'");
+    if (Error Err = PB.parsePassPipeline(MPM, Pipeline.getValue())) {
+        report_fatal_error(Twine("Invalid -") + Pipeline.ArgStr + " '" +
+                           Pipeline.getValue() + "': " +
+                           toString(std::move(Err)));
+    }
+}
 
 // Plugin entry point - provides plugin metadata and registration callbacks.
 //
@@ -75,72 +168,50 @@ extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, ModulePassManager &MPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
-                    DEBUG_PRINT("Pipeline parsing callback called with Name='" 
-                                                            << Name << "'");
-                    
-                    // Attempt to match "ir-bb-label-pass" with optional 
-                    // parameters
-                    // MatchParamPass handles both forms:
-                    //   1. "ir-bb-label-pass" (uses default options)
-                    //   2. "ir-bb-label-pass<output_csv=custom.csv>" 
-                    //       (parsed options)
-                    auto E = MatchParamPass(Name, "ir-bb-label-pass", 
-                                                        IRBBLabelPassOptions);
-                    if (E) {
-                        // Success: add pass to module pass manager with parsed
-                        // options
-                        MPM.addPass(IRBBLabelPass(*E));
-                        return true;
-                    } else {
-                        // Error: check if it was a real error or just name 
-                        // mismatch
-                        std::string ErrorMsg = toString(E.takeError());
-                        // Only report errors if pass name matched but 
-                        // parameter parsing failed
-                        // (Don't spam errors for every unrelated pass name in 
-                        // pipeline)
-                        if (ErrorMsg.find("name not matched") 
-                                                == std::string::npos) {
-                            errs() << "ir-bb-label-pass param parse error: " 
-                                                        << ErrorMsg << "\n";
-                            return false;
-                        }
-                    }
-                    
-                    // Check if it's the PhaseAnalysisPass
-                    auto E2 = MatchParamPass(Name, "phase-analysis-pass", 
-                                              PhaseAnalysisPassOptions);
-                    if (E2) {
-                        MPM.addPass(PhaseAnalysisPass(*E2));
+                    return addNuggetPass(Name, MPM);
+                });
+
+            // Register the shared label analysis with every module
+            // analysis manager, and its name for require<>/invalidate<>
+            PB.registerAnalysisRegistrationCallback(
+                [](ModuleAnalysisManager &MAM) {
+                    MAM.registerPass([] { return BBIdAnalysis(); });
+                });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                    if (Name == "require<bb-id-analysis>") {
+                        MPM.addPass(RequireAnalysisPass<BBIdAnalysis,
+                                                        Module>());
                         return true;
-                    } else {
-                        std::string ErrorMsg = toString(E2.takeError());
-                        if (ErrorMsg.find("name not matched") 
-                                                == std::string::npos) {
-                            errs() << "phase-analysis-pass param parse error: " 
-                                                        << ErrorMsg << "\n";
-                            return false;
-                        }
                     }
-
-                    // Check if it's the PhaseBoundPass
-                    auto E3 = MatchParamPass(Name, "phase-bound-pass",
-                                                PhaseBoundPassOptions);
-                    if (E3) {
-                        MPM.addPass(PhaseBoundPass(*E3));
+                    if (Name == "invalidate<bb-id-analysis>") {
+                        MPM.addPass(InvalidateAnalysisPass<BBIdAnalysis>());
                         return true;
-                    } else {
-                        std::string ErrorMsg = toString(E3.takeError());
-                        if (ErrorMsg.find("name not matched") 
-                                                == std::string::npos) {
-                            errs() << "phase-bound-pass param parse error: " 
-                                                        << ErrorMsg << "\n";
-                            return false;
-                        }
                     }
-                    // Pass name didn't match - let other plugins handle it
                     return false;
                 });
+
+            // Label early, before the optimizer changes the CFG
+            PB.registerPipelineStartEPCallback(
+                [&PB](ModulePassManager &MPM, OptimizationLevel) {
+                    addOptionPipeline(PB, MPM, NuggetPipelineStart);
+                });
+
+            // Instrument late, after inlining and vectorization. LLVM 20
+            // added the LTO phase to the callback signature.
+#if LLVM_VERSION_MAJOR >= 20
+            PB.registerOptimizerLastEPCallback(
+                [&PB](ModulePassManager &MPM, OptimizationLevel,
+                      ThinOrFullLTOPhase) {
+                    addOptionPipeline(PB, MPM, NuggetOptimizerLast);
+                });
+#else
+            PB.registerOptimizerLastEPCallback(
+                [&PB](ModulePassManager &MPM, OptimizationLevel) {
+                    addOptionPipeline(PB, MPM, NuggetOptimizerLast);
+                });
+#endif
         }
     };
 }
@@ -70,6 +70,13 @@
   #include "llvm/Passes/PassPlugin.h"
 #endif
 
+// Triple.h moved to the TargetParser library in LLVM 17
+#if __has_include("llvm/TargetParser/Triple.h")
+  #include "llvm/TargetParser/Triple.h"  // Target triple (object format)
+#else
+  #include "llvm/ADT/Triple.h"           // Target triple (object format)
+#endif
+
 // LLVM IR Representation Headers
 #include "llvm/IR/Module.h"        // LLVM module (translation unit)
 #include "llvm/IR/Function.h"      // Function representation
@@ -79,18 +86,47 @@
 #include "llvm/IR/BasicBlock.h"    // Basic block representation
 #include "llvm/IR/PassManager.h"   // Pass manager infrastructure
 #include "llvm/IR/Instructions.h"  // Instruction classes
+#include "llvm/IR/MDBuilder.h"     // Branch weight metadata
+#include "llvm/IR/IntrinsicInst.h" // Intrinsic call classification
+#include "llvm/IR/Dominators.h"    // Dominator tree
+
+// LLVM Analysis Headers
+#include "llvm/Analysis/BlockFrequencyInfo.h"    // Block execution frequency
+#include "llvm/Analysis/BranchProbabilityInfo.h" // Edge probabilities
+#include "llvm/Analysis/LoopInfo.h"              // Natural loop structure
+#include "llvm/Analysis/ScalarEvolution.h"       // Loop trip counts
+
+// LLVM Transform Utilities
+#include "llvm/Transforms/Utils/BasicBlockUtils.h" // Block splitting helpers
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h" // SCEV to IR
+#include "llvm/Transforms/Utils/PromoteMemToReg.h" // mem2reg utility
+#include "llvm/Transforms/Utils/ModuleUtils.h"     // Global constructors
 
 // LLVM Support Utilities
+#include "llvm/Support/CommandLine.h"   // cl::opt command line options
 #include "llvm/Support/Error.h"         // Error handling (Expected<T>)
 #include "llvm/Support/FileSystem.h"    // File I/O operations
+#include "llvm/Support/MemoryBuffer.h"  // Reading input files
 #include "llvm/Support/raw_ostream.h"   // Stream output (errs(), outs())
+#include "llvm/Support/ThreadPool.h"    // Worker threads (parallel labeling)
 
 // Standard Library Headers
+#include <deque>    // std::deque
+#include <future>   // std::shared_future
+#include <optional> // std::optional
+#include <queue>    // std::priority_queue
 #include <string>   // std::string
 #include <vector>   // std::vector
 
 using namespace llvm;
 
+// LLVM 19 split ThreadPool into an interface and DefaultThreadPool.
+#if LLVM_VERSION_MAJOR >= 19
+using NuggetThreadPool = DefaultThreadPool;
+#else
+using NuggetThreadPool = ThreadPool;
+#endif
+
 // Metadata key for basic block ID annotations.
 //
 // This constant defines the metadata node name used to attach unique
@@ -99,11 +135,78 @@ using namespace llvm;
 //
 // Example IR:
 //   br label %if.then, !bb.id !42
-//   !42 = !{!"5"}
+//   !42 = !{i64 5}
 //
-// The numeric string ("5") represents the unique basic block ID.
+// The i64 constant (5) represents the unique basic block ID. Bitcode
+// labeled by older versions of the pass stores it as a numeric string
+// (!42 = !{!"5"}), which parseBBId still accepts.
 static constexpr const char *kBbIdKey = "bb.id";
 
+static MDNode *makeBBIdMetadata(LLVMContext &C, uint64_t bb_id) {
+  return MDNode::get(C, ConstantAsMetadata::get(
+      ConstantInt::get(Type::getInt64Ty(C), bb_id)));
+}
+
+// Decode a !bb.id node. Returns std::nullopt if it holds neither encoding.
+static std::optional<uint64_t> parseBBId(const MDNode *bb_id_md) {
+  if (bb_id_md->getNumOperands() != 1) {
+    return std::nullopt;
+  }
+  const MDOperand &operand = bb_id_md->getOperand(0);
+  if (auto *value = mdconst::dyn_extract_or_null<ConstantInt>(operand)) {
+    return value->getZExtValue();
+  }
+  if (auto *text = dyn_cast_or_null<MDString>(operand)) {
+    uint64_t bb_id;
+    if (!text->getString().getAsInteger(10, bb_id)) {
+      return bb_id;
+    }
+  }
+  return std::nullopt;
+}
+
+// Named metadata holding the module fingerprint set by IRBBLabelPass.
+//
+// Example IR:
+//   !nugget.fingerprint = !{!7}
+//   !7 = !{i64 -3750763034362895579}
+//
+// The fingerprint is the 64-bit FNV-1a hash of the CSV data rows (every line
+// after the header), so a trace recorded from the instrumented program can
+// be matched against the CSV it belongs to. 0 means unknown.
+static constexpr const char *kFingerprintKey = "nugget.fingerprint";
+
+// 64-bit FNV-1a hash of data, continuing from hash.
+static constexpr uint64_t kFnv1a64Basis = 0xcbf29ce484222325ULL;
+static uint64_t fnv1a64(StringRef data, uint64_t hash = kFnv1a64Basis) {
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static void setModuleFingerprint(Module &M, uint64_t fingerprint) {
+  NamedMDNode *node = M.getOrInsertNamedMetadata(kFingerprintKey);
+  node->clearOperands();
+  node->addOperand(MDNode::get(M.getContext(), ConstantAsMetadata::get(
+      ConstantInt::get(Type::getInt64Ty(M.getContext()), fingerprint))));
+}
+
+// Returns the fingerprint set by IRBBLabelPass, or 0 if the module has none.
+static uint64_t getModuleFingerprint(const Module &M) {
+  NamedMDNode *node = M.getNamedMetadata(kFingerprintKey);
+  if (!node || node->getNumOperands() != 1 ||
+      node->getOperand(0)->getNumOperands() != 1) {
+    return 0;
+  }
+  if (auto *value = mdconst::dyn_extract<ConstantInt>(
+          node->getOperand(0)->getOperand(0))) {
+    return value->getZExtValue();
+  }
+  return 0;
+}
+
 // Option structure for parameterized pass configuration.
 //
 // Stores key-value pairs parsed from pass parameter strings in LLVM's
@@ -137,12 +240,22 @@ struct Options {
 // failures/segfaults.
 const std::vector<std::string> nugget_functions = {
   "nugget_init",
+  "nugget_init_regions",
+  "nugget_init_countdown",
+  "nugget_init_regions_countdown",
   "nugget_roi_begin_",
   "nugget_roi_end_",
   "nugget_bb_hook",
+  "nugget_interval_hook",
+  "nugget_sparse_interval_hook",
+  "nugget_edge_flush",
+  "nugget_flush_interval",
   "nugget_warmup_marker_hook",
   "nugget_start_marker_hook",
-  "nugget_end_marker_hook"
+  "nugget_end_marker_hook",
+  "nugget_warmup_marker_region_hook",
+  "nugget_start_marker_region_hook",
+  "nugget_end_marker_region_hook"
 };
 
 // Helper function to get the option value by name.
@@ -304,17 +417,42 @@ static Expected<std::vector<Options>> MatchParamPass(StringRef Name,
   return ParseOptions(Params, TargetOptions);
 }
 
+// Returns the runtime function Name, declaring it with type FT if the module
+// does not reference it. Declarations are dropped by the optimizer when
+// nothing calls them yet, which is always the case when the passes run from
+// a default pipeline (-nugget-optimizer-last).
+//
+// Returns nullptr (after printing an error) if the module already has a
+// Name with a different type.
+static Function *getOrDeclareRuntimeFunction(Module &M, StringRef Name,
+                                             FunctionType *FT) {
+  FunctionCallee callee = M.getOrInsertFunction(Name, FT);
+  Function *F = dyn_cast<Function>(callee.getCallee());
+  if (!F || F->getFunctionType() != FT) {
+    errs() << "Function " << Name << " has an unexpected type\n";
+    return nullptr;
+  }
+  return F;
+}
+
+// Insert a call init_name(args...) into nugget_roi_begin_.
 static bool instrumentRoiBegin(Module &M,
-                              std::vector<Value*> args) {
+                              std::vector<Value*> args,
+                              StringRef init_name = "nugget_init") {
   // First, find the nugget_roi_begin_ function
   Function* roi_begin_function = M.getFunction("nugget_roi_begin_");
   if (!roi_begin_function) {
     errs() << "Function nugget_roi_begin_ not found\n";
     return false;
   }
-  Function* nugget_init_function = M.getFunction("nugget_init");
+  std::vector<Type*> arg_types;
+  for (Value *arg : args) {
+    arg_types.push_back(arg->getType());
+  }
+  Function* nugget_init_function = getOrDeclareRuntimeFunction(M,
+      init_name, FunctionType::get(Type::getVoidTy(M.getContext()),
+                                       arg_types, false));
   if (!nugget_init_function) {
-    errs() << "Function nugget_init not found\n";
     return false;
   }
   // Insert nugget_init call at the beginning of nugget_roi_begin_
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2026 Zhantong Qiu
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice, this
+#    list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice,
+#    this list of conditions and the following disclaimer in the documentation
+#    and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived
+#    from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+# OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+"""Validates the binary BB database of IRBBLabel pass against its CSV.
+
+With output_db the pass also writes a memory-mappable database (layout in
+src/IRBBLabelPass.hh and tools/BBDatabaseReader.hh). This script checks:
+
+1. The header magic, version and section bounds
+2. One block record per CSV row, indexed by BasicBlockID, with the same
+   function ID, name and instruction count
+3. One function record per FunctionID with the function's name, first
+   block and block count
+4. The fingerprint equals the FNV-1a hash of the CSV data rows
+5. With features=true, the feature records and successor lists equal the
+   CSV's feature columns
+6. With id_scheme=hash, the stable IDs equal the CSV's StableID column and
+   the remap table is sorted by stable ID and points back to each block
+
+Usage:
+    python3 verify_bbdb.py <bb_info.db> <bb_info.csv>
+
+Exit codes:
+    0: Validation passed
+    1: Validation failed (errors reported to stdout)
+"""
+
+import csv
+import struct
+import sys
+
+MAGIC = b'NUGBBDB\0'
+VERSION = 1
+HEADER = struct.Struct('=8sII12Q')
+BLOCK = struct.Struct('=QIIII')
+FUNCTION = struct.Struct('=4Q')
+FEATURES = struct.Struct('=8I2Q')
+REMAP = struct.Struct('=2Q')
+LOOP_HEADER = 1
+FEATURE_COLUMNS = ['Loads', 'Stores', 'Branches', 'Calls', 'FPOps',
+                   'VectorOps', 'LoopDepth']
+
+
+def fnv1a64(data, value=0xcbf29ce484222325):
+    """64-bit FNV-1a, as fnv1a64 in src/common.hh."""
+    for byte in data:
+        value = ((value ^ byte) * 0x100000001b3) & 0xffffffffffffffff
+    return value
+
+
+def read_name(strings, offset, size):
+    """Returns the NUL-terminated name at offset, or None if it is invalid."""
+    if offset + size >= len(strings) or strings[offset + size] != 0:
+        return None
+    return strings[offset:offset + size].decode()
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("Usage: verify_bbdb.py <bb_info.db> <bb_info.csv>")
+        sys.exit(1)
+
+    with open(sys.argv[1], 'rb') as f:
+        db = f.read()
+    with open(sys.argv[2], 'rb') as f:
+        csv_bytes = f.read()
+
+    if len(db) < HEADER.size:
+        print("✗ Database is shorter than its header")
+        sys.exit(1)
+    (magic, version, header_size, fingerprint, num_blocks, num_functions,
+     blocks_offset, functions_offset, strings_offset, strings_size,
+     features_offset, successors_offset, num_successors, stable_ids_offset,
+     remap_offset) = HEADER.unpack_from(db)
+    if magic != MAGIC or version != VERSION or header_size != HEADER.size:
+        print(f"✗ Bad header: magic={magic!r} version={version} "
+              f"header_size={header_size}")
+        sys.exit(1)
+    if (blocks_offset + num_blocks * BLOCK.size > len(db) or
+            functions_offset + num_functions * FUNCTION.size > len(db) or
+            strings_offset + strings_size > len(db) or
+            (features_offset and (
+                features_offset + num_blocks * FEATURES.size > len(db) or
+                successors_offset + num_successors * 8 > len(db))) or
+            (stable_ids_offset and (
+                stable_ids_offset + num_blocks * 8 > len(db) or
+                remap_offset + num_blocks * REMAP.size > len(db)))):
+        print("✗ Sections exceed the file")
+        sys.exit(1)
+    strings = db[strings_offset:strings_offset + strings_size]
+
+    errors = []
+    lines = csv_bytes.decode().splitlines(keepends=True)
+    expected_fingerprint = fnv1a64(''.join(lines[1:]).encode())
+    if fingerprint != expected_fingerprint:
+        errors.append(f"fingerprint 0x{fingerprint:016x} != CSV "
+                      f"0x{expected_fingerprint:016x}")
+
+    rows = list(csv.DictReader(lines))
+    if num_blocks != len(rows):
+        errors.append(f"{num_blocks} block records, {len(rows)} CSV rows")
+    has_features = bool(rows) and 'Successors' in rows[0]
+    if has_features != bool(features_offset):
+        errors.append(f"CSV has features: {has_features}, database has "
+                      f"features: {bool(features_offset)}")
+        has_features = False
+    has_stable_ids = bool(rows) and 'StableID' in rows[0]
+    if has_stable_ids != bool(stable_ids_offset):
+        errors.append(f"CSV has stable IDs: {has_stable_ids}, database has "
+                      f"stable IDs: {bool(stable_ids_offset)}")
+        has_stable_ids = False
+    if has_stable_ids:
+        remap = [REMAP.unpack_from(db, remap_offset + i * REMAP.size)
+                 for i in range(num_blocks)]
+        if remap != sorted(remap):
+            errors.append("remap table is not sorted by stable ID")
+        remapped = {stable_id: bb_id for stable_id, bb_id in remap}
+        if len(remapped) != len(remap):
+            errors.append("remap table has duplicate stable IDs")
+    functions = {}
+    for row in rows:
+        bb_id = int(row['BasicBlockID'])
+        func_id = int(row['FunctionID'])
+        func = functions.setdefault(func_id, [row['FunctionName'], bb_id, 0])
+        func[2] += 1
+        if bb_id >= num_blocks:
+            continue
+        name_offset, name_size, db_func_id, inst_count, _ = BLOCK.unpack_from(
+            db, blocks_offset + bb_id * BLOCK.size)
+        name = read_name(strings, name_offset, name_size)
+        if (db_func_id, name, inst_count) != (
+                func_id, row['BasicBlockName'],
+                int(row['BasicBlockInstCount'])):
+            errors.append(f"bb_id {bb_id}: database ({db_func_id}, {name!r}, "
+                          f"{inst_count}) != CSV ({func_id}, "
+                          f"{row['BasicBlockName']!r}, "
+                          f"{row['BasicBlockInstCount']})")
+        if has_stable_ids:
+            stable_id, = struct.unpack_from('=Q', db,
+                                            stable_ids_offset + bb_id * 8)
+            if stable_id != int(row['StableID']):
+                errors.append(f"bb_id {bb_id}: database stable ID "
+                              f"{stable_id} != CSV {row['StableID']}")
+            if remapped.get(stable_id) != bb_id:
+                errors.append(f"bb_id {bb_id}: remap table gives "
+                              f"{remapped.get(stable_id)}")
+        if not has_features:
+            continue
+        values = FEATURES.unpack_from(
+            db, features_offset + bb_id * FEATURES.size)
+        first_successor, count = values[8], values[9]
+        if first_successor + count > num_successors:
+            errors.append(f"bb_id {bb_id}: successors out of range")
+            continue
+        successors = list(struct.unpack_from(
+            f'={count}Q', db, successors_offset + first_successor * 8))
+        db_features = list(values[:7]) + [
+            1 if values[7] & LOOP_HEADER else 0, successors]
+        csv_features = [int(row[c]) for c in FEATURE_COLUMNS] + [
+            int(row['LoopHeader']),
+            [int(s) for s in row['Successors'].split()]]
+        if db_features != csv_features:
+            errors.append(f"bb_id {bb_id}: database features {db_features} "
+                          f"!= CSV {csv_features}")
+
+    if num_functions != len(functions):
+        errors.append(f"{num_functions} function records, "
+                      f"{len(functions)} CSV functions")
+    for func_id, (func_name, first_bb_id, count) in sorted(functions.items()):
+        if func_id >= num_functions:
+            continue
+        name_offset, name_size, db_first, db_count = FUNCTION.unpack_from(
+            db, functions_offset + func_id * FUNCTION.size)
+        name = read_name(strings, name_offset, name_size)
+        if (name, db_first, db_count) != (func_name, first_bb_id, count):
+            errors.append(f"function {func_id}: database ({name!r}, "
+                          f"{db_first}, {db_count}) != CSV ({func_name!r}, "
+                          f"{first_bb_id}, {count})")
+
+    if errors:
+        print(f"✗ BB database validation FAILED ({len(errors)} errors)")
+        for error in errors[:20]:
+            print(f"  - {error}")
+        sys.exit(1)
+    print("✓ BB database validation PASSED")
+    print(f"  - Functions: {num_functions}")
+    print(f"  - Basic blocks: {num_blocks}")
+    if features_offset:
+        print(f"  - CFG edges: {num_successors}")
+    print(f"  - Fingerprint: 0x{fingerprint:016x}")
+
+
+if __name__ == '__main__':
+    main()
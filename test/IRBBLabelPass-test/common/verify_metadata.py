@@ -44,7 +44,8 @@ The script handles various LLVM IR complexities:
   - Mangled C++ function names (_ZN...)
   - Numeric auto-generated basic block labels (treated as unnamed)
   - Optimized BB names with special characters (._crit_edge, .lr.ph, etc.)
-  - Metadata indirection (!6 = !{!"0"} mappings)
+  - Metadata indirection (!6 = !{i64 0} mappings, or !6 = !{!"0"} in
+    bitcode labeled by older versions)
 
 Usage:
     python3 verify_metadata.py <instrumented.ll> <bb_info.csv>
@@ -107,7 +108,8 @@ def parse_ir_metadata(ir_file):
         - Handles various function linkage types (dso_local, internal, etc.)
         - Recognizes BB labels with alphanumeric, dots, underscores, hyphens, $
         - Numeric-only labels (e.g., "14:") are treated as unnamed blocks
-        - Metadata indirection: !bb.id !6 -> !6 = !{!"0"} -> id = 0
+        - Metadata indirection: !bb.id !6 -> !6 = !{i64 0} -> id = 0
+          (the legacy string form !6 = !{!"0"} is accepted too)
         - Only processes defined functions (skips declarations)
     
     Raises:
@@ -117,11 +119,12 @@ def parse_ir_metadata(ir_file):
     with open(ir_file, 'r') as f:
         content = f.read()
     
-    # Extract metadata mappings from IR footer: !6 = !{!"0"}, !7 = !{!"1"}, etc.
-    # These map metadata references (!6) to actual BB ID strings ("0")
+    # Extract metadata mappings from IR footer: !6 = !{i64 0}, !7 = !{i64 1},
+    # etc. These map metadata references (!6) to actual BB IDs ("0")
     metadata_map = {}
-    for match in re.finditer(r'!(\d+)\s*=\s*!\{!"(\d+)"\}', content):
-        metadata_map[match.group(1)] = match.group(2)
+    for match in re.finditer(r'!(\d+)\s*=\s*!\{(?:i64 (\d+)|!"(\d+)")\}',
+                             content):
+        metadata_map[match.group(1)] = match.group(2) or match.group(3)
     
     # Extract functions and their basic blocks
     functions = {}
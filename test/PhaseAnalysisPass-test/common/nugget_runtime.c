@@ -38,17 +38,20 @@
 
 #include <stdint.h>
 
-// nugget_init - Initialize the runtime with total basic block count.
+// nugget_init - Initialize the runtime with total basic block count and the
+// interval length.
 //
 // Called at the end of nugget_roi_begin_ after PhaseAnalysisPass instruments it.
 // In production, this would allocate data structures for tracking BB execution.
 //
 // Args:
 //   total_bb_count: Total number of basic blocks in the instrumented program
-void nugget_init(uint64_t total_bb_count) {
+//   interval_length: Interval length for phase detection
+void nugget_init(uint64_t total_bb_count, uint64_t interval_length) {
     // Stub implementation - does nothing in test
     // Production would: allocate counters array of size total_bb_count
     (void)total_bb_count;
+    (void)interval_length;
 }
 
 // nugget_roi_begin_ - Mark the beginning of the region of interest.
@@ -76,13 +79,46 @@ void nugget_roi_end_(void) {
 // labeled basic block. This is the main instrumentation hook.
 //
 // Args:
-//   inst_count: Number of instructions in the basic block
-//   bb_id: Unique identifier of the basic block (from IRBBLabelPass)
-//   threshold: Interval length for phase detection
-void nugget_bb_hook(uint64_t inst_count, uint64_t bb_id, uint64_t threshold) {
+//   bb_id: Unique identifier of the basic block (from IRBBLabelPass);
+//          its size is __nugget_bb_table[bb_id].inst_count
+void nugget_bb_hook(uint64_t bb_id) {
     // Stub implementation - does nothing in test
-    // Production would: accumulate inst_count, record bb_id execution
-    (void)inst_count;
+    // Production would: look up the block size, record bb_id execution
     (void)bb_id;
-    (void)threshold;
+}
+
+// nugget_interval_hook - Called when an interval closes in inline mode.
+//
+// With phase-analysis-pass<mode=inline> the pass keeps the per-block counters
+// itself and only calls this function on the cold path where the running
+// instruction count reaches the interval threshold.
+//
+// Args:
+//   bb_counters: Pass-owned array of per-bb_id execution counts
+//   num_counters: Number of entries in bb_counters
+//   inst_count: Number of IR instructions executed in the interval
+void nugget_interval_hook(uint64_t *bb_counters, uint64_t num_counters,
+                          uint64_t inst_count) {
+    // Stub implementation - production would emit and zero bb_counters
+    (void)bb_counters;
+    (void)num_counters;
+    (void)inst_count;
+}
+
+// nugget_sparse_interval_hook - Called when an interval closes with
+// phase-analysis-pass<mode=inline;touched=true>.
+//
+// Args:
+//   bb_counters: Pass-owned array of per-bb_id execution counts
+//   touched_ids: bb_ids with a non-zero counter, each listed once
+//   num_touched: Number of entries in touched_ids
+//   inst_count: Number of IR instructions executed in the interval
+void nugget_sparse_interval_hook(uint64_t *bb_counters, uint32_t *touched_ids,
+                                 uint64_t num_touched, uint64_t inst_count) {
+    // Stub implementation - production would emit and zero the touched
+    // counters only
+    (void)bb_counters;
+    (void)touched_ids;
+    (void)num_touched;
+    (void)inst_count;
 }
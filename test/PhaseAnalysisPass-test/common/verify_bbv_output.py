@@ -0,0 +1,330 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2026 Zhantong Qiu
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice, this
+#    list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice,
+#    this list of conditions and the following disclaimer in the documentation
+#    and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived
+#    from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+# OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+"""Validates the basic block vector file written by libnugget_rt.
+
+Decodes the trace format (see runtime/nugget_rt.h) and checks the file
+header and that every interval record is well formed (bb_ids in range and
+strictly increasing, non-zero counts). The module table must have disjoint
+bb_id ranges that cover every recorded bb_id; module records (modules
+registered after nugget_init) must each start at the counters so far. When
+more files are given, every run must have the same per-block totals and
+instruction count as the first, e.g. the mode=call and mode=inline builds of
+one program. With --csv, the fingerprint in every header must match the
+bb_info CSV; for a program of several modules, --csv can be repeated and
+every CSV must match one module.
+
+Runs may differ in their module records, e.g. when one of them dlopens an
+uninstrumented build of a library: only the bb_ids of the header's modules
+are compared then, and the instruction totals without the instructions of
+the recorded modules, which takes the CSV of each of them. The CSV of a
+recorded module need not match the runs without it.
+
+Usage:
+    python3 verify_bbv_output.py [--csv <bb_info.csv> ...]
+                                 <bbv.bin> [<other_bbv.bin> ...]
+
+Exit codes:
+    0: Validation passed
+    1: Validation failed
+"""
+
+import csv
+import struct
+import sys
+from collections import defaultdict
+from pathlib import Path
+
+VERSION = 1
+FILE_HEADER = struct.Struct('=8sIIQQQQQ')     # struct nugget_file_header
+MODULE = struct.Struct('=3Q')                 # Module table entry
+MODULE_RECORD = 2**64 - 1                     # NUGGET_MODULE_RECORD
+
+
+class Truncated(Exception):
+    pass
+
+
+def read_varint(data, offset):
+    """Decode an unsigned LEB128 varint, returning (value, next offset)."""
+    value = 0
+    shift = 0
+    while True:
+        if offset >= len(data):
+            raise Truncated()
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7f) << shift
+        if not byte & 0x80:
+            return value, offset
+        shift += 7
+
+
+def csv_fingerprint(path):
+    """FNV-1a 64 of the CSV lines after the header, as IRBBLabelPass computes."""
+    fingerprint = 0xcbf29ce484222325
+    lines = Path(path).read_bytes().split(b'\n', 1)
+    for byte in lines[1] if len(lines) > 1 else b'':
+        fingerprint ^= byte
+        fingerprint = (fingerprint * 0x100000001b3) & 0xffffffffffffffff
+    return fingerprint
+
+
+def csv_block_sizes(path):
+    """Instructions of every bb_id of a bb_info CSV."""
+    with open(path, newline='') as f:
+        return {int(row['BasicBlockID']): int(row['BasicBlockInstCount'])
+                for row in csv.DictReader(f)}
+
+
+def read_bbv(path):
+    """Parse a BBV file, returning (header, records, errors)."""
+    data = Path(path).read_bytes()
+    errors = []
+    if len(data) < FILE_HEADER.size:
+        return None, [], [f"{path}: file too short for the header"]
+    (magic, version, header_size, fingerprint, num_counters, metrics,
+     interval_length, num_modules) = FILE_HEADER.unpack_from(data, 0)
+    if magic != b'NUGGETBB':
+        return None, [], [f"{path}: bad magic {magic!r}"]
+    if version != VERSION:
+        return None, [], [f"{path}: unsupported version {version}"]
+    if header_size != FILE_HEADER.size + num_modules * MODULE.size or \
+            header_size > len(data):
+        return None, [], [f"{path}: {num_modules} modules do not fit "
+                          f"header size {header_size}"]
+    if interval_length == 0:
+        errors.append(f"{path}: no interval length in the header")
+    modules = [MODULE.unpack_from(data, FILE_HEADER.size + i * MODULE.size)
+               for i in range(num_modules)]
+    for (fp_a, base_a, blocks_a), (fp_b, base_b, _) in zip(modules,
+                                                          modules[1:]):
+        if base_a + blocks_a > base_b:
+            errors.append(f"{path}: bb_ids of modules {fp_a:#018x} and "
+                          f"{fp_b:#018x} overlap")
+    for module_fingerprint, base, blocks in modules:
+        if base + blocks > num_counters:
+            errors.append(f"{path}: module {module_fingerprint:#018x} ends "
+                          f"past {num_counters} counters")
+    header = {'fingerprint': fingerprint, 'num_counters': num_counters,
+              'metrics': metrics, 'interval_length': interval_length,
+              'modules': modules, 'laid_out': num_counters, 'recorded': []}
+
+    records = []
+    offset = header_size
+    clock = 0
+    while offset < len(data):
+        interval = len(records)
+        try:
+            thread, offset = read_varint(data, offset)
+            if thread == MODULE_RECORD:
+                module = []
+                for _ in range(3):
+                    value, offset = read_varint(data, offset)
+                    module.append(value)
+                module_fingerprint, base, blocks = module
+                if base != num_counters:
+                    errors.append(f"{path}: module {module_fingerprint:#018x} "
+                                  f"recorded at bb_id {base}, not at the "
+                                  f"{num_counters} counters so far")
+                modules.append(tuple(module))
+                header['recorded'].append(tuple(module))
+                num_counters = base + blocks
+                header['num_counters'] = num_counters
+                continue
+            inst_count, offset = read_varint(data, offset)
+            metric_values = []
+            for _ in range(bin(metrics).count('1')):
+                value, offset = read_varint(data, offset)
+                metric_values.append(value)
+            num_entries, offset = read_varint(data, offset)
+            entries = {}
+            bb_id = 0
+            for i in range(num_entries):
+                delta, offset = read_varint(data, offset)
+                count, offset = read_varint(data, offset)
+                if i > 0 and delta == 0:
+                    errors.append(f"{path}: interval {interval}: bb_ids not "
+                                  f"strictly increasing after {bb_id}")
+                bb_id += delta
+                if bb_id >= num_counters:
+                    errors.append(f"{path}: interval {interval}: bb_id "
+                                  f"{bb_id} >= {num_counters}")
+                elif modules and not any(
+                        base <= bb_id < base + blocks
+                        for _, base, blocks in modules):
+                    errors.append(f"{path}: interval {interval}: bb_id "
+                                  f"{bb_id} is in no module")
+                if count == 0:
+                    errors.append(f"{path}: interval {interval}: zero count "
+                                  f"for bb_id {bb_id}")
+                entries[bb_id] = count
+        except Truncated:
+            errors.append(f"{path}: truncated record {interval}")
+            break
+        clock += inst_count
+        records.append({'interval': interval, 'thread': thread,
+                        'inst_count': inst_count, 'clock': clock,
+                        'metrics': metric_values, 'entries': entries})
+    return header, records, errors
+
+
+def check_records(path, records):
+    """Check that every interval did some work."""
+    errors = []
+    if not records:
+        errors.append(f"{path}: no intervals recorded")
+    for record in records:
+        if record['inst_count'] == 0 and record['entries']:
+            errors.append(f"{path}: interval {record['interval']}: blocks "
+                          f"executed but no instructions counted")
+    return errors
+
+
+def recorded_insts(header, bb_totals, block_sizes):
+    """Instructions of the blocks of the modules of module records."""
+    insts = 0
+    for fingerprint, base, blocks in header['recorded']:
+        if fingerprint not in block_sizes:
+            return None
+        sizes = block_sizes[fingerprint]
+        for bb_id in range(base, base + blocks):
+            insts += bb_totals.get(bb_id, 0) * sizes.get(bb_id - base, 0)
+    return insts
+
+
+def totals(records):
+    bb_totals = defaultdict(int)
+    for record in records:
+        for bb_id, count in record['entries'].items():
+            bb_totals[bb_id] += count
+    return bb_totals, sum(r['inst_count'] for r in records)
+
+
+def main():
+    args = sys.argv[1:]
+    csv_paths = []
+    while len(args) >= 2 and args[0] == '--csv':
+        csv_paths.append(args[1])
+        args = args[2:]
+    if not args:
+        print("Usage: verify_bbv_output.py [--csv <bb_info.csv> ...] "
+              "<bbv.bin> [<other_bbv.bin> ...]")
+        sys.exit(1)
+
+    expected_fingerprints = {}
+    for csv_path in csv_paths:
+        if not Path(csv_path).exists():
+            print(f"ERROR: CSV file not found: {csv_path}")
+            sys.exit(1)
+        expected_fingerprints[csv_path] = csv_fingerprint(csv_path)
+
+    errors = []
+    runs = []
+    for path in args:
+        if not Path(path).exists():
+            print(f"ERROR: BBV file not found: {path}")
+            sys.exit(1)
+        header, records, read_errors = read_bbv(path)
+        errors.extend(read_errors)
+        if header is None:
+            continue
+        errors.extend(check_records(path, records))
+        runs.append((path, header, records))
+
+    recorded = {module[0] for _, header, _ in runs
+                for module in header['recorded']}
+    for path, header, _ in runs:
+        fingerprints = {header['fingerprint']}
+        fingerprints.update(module[0] for module in header['modules'])
+        for csv_path, expected in expected_fingerprints.items():
+            if expected not in fingerprints and expected not in recorded:
+                errors.append(f"{path}: fingerprint "
+                              f"{header['fingerprint']:#018x} does not match "
+                              f"{csv_path} ({expected:#018x})")
+
+    if len(runs) > 1 and not errors:
+        block_sizes = {expected_fingerprints[csv_path]:
+                       csv_block_sizes(csv_path) for csv_path in csv_paths}
+        path_a, header_a, records_a = runs[0]
+        counters_a = header_a['laid_out']
+        bb_a, insts_a = totals(records_a)
+        for path_b, header_b, records_b in runs[1:]:
+            counters_b = header_b['laid_out']
+            if counters_a != counters_b:
+                errors.append(f"num_counters differ: {counters_a} in {path_a}, "
+                              f"{counters_b} in {path_b}")
+            bb_b, insts_b = totals(records_b)
+            late_a = recorded_insts(header_a, bb_a, block_sizes)
+            late_b = recorded_insts(header_b, bb_b, block_sizes)
+            if late_a is None or late_b is None:
+                errors.append(f"Instruction totals of {path_a} and {path_b} "
+                              f"need the CSV of every recorded module")
+            elif insts_a - late_a != insts_b - late_b:
+                errors.append(f"Instruction totals differ: {insts_a - late_a} "
+                              f"in {path_a}, {insts_b - late_b} in {path_b}"
+                              + (" without the recorded modules"
+                                 if late_a or late_b else ""))
+            for bb_id in sorted(set(bb_a) | set(bb_b)):
+                if bb_id >= counters_a:
+                    continue
+                if bb_a.get(bb_id, 0) != bb_b.get(bb_id, 0):
+                    errors.append(f"bb_id {bb_id}: {bb_a.get(bb_id, 0)} "
+                                  f"executions in {path_a}, "
+                                  f"{bb_b.get(bb_id, 0)} in {path_b}")
+
+    if errors:
+        print("✗ BBV output validation FAILED")
+        for error in errors:
+            print(f"  - {error}")
+        sys.exit(1)
+
+    print("✓ BBV output validation PASSED")
+    for path, header, records in runs:
+        _, insts = totals(records)
+        threads = len({r['thread'] for r in records})
+        print(f"  - {path}: {len(records)} intervals of "
+              f"{header['interval_length']} instructions, {threads} "
+              f"thread(s), {insts} instructions, {header['num_counters']} "
+              f"counters")
+        for module in header['modules']:
+            fingerprint, base, blocks = module
+            print(f"    module {fingerprint:#018x}: bb_ids {base} to "
+                  f"{base + blocks - 1}"
+                  + (" (module record)" if module in header['recorded']
+                     else ""))
+    if len(runs) > 1:
+        print("  - Per-block totals match")
+    for csv_path in csv_paths:
+        print(f"  - Fingerprints match {csv_path}")
+    sys.exit(0)
+
+
+if __name__ == '__main__':
+    main()
@@ -30,11 +30,26 @@
 """Validates PhaseAnalysisPass instrumentation.
 
 This script verifies that the PhaseAnalysisPass correctly instruments:
-1. nugget_init_ call inserted at the end of nugget_roi_begin_
+1. nugget_init_ call inserted at the end of nugget_roi_begin_ with the BB
+   count and the interval length
 2. nugget_bb_hook_ calls inserted at the end of each labeled basic block
+   with the block sizes in __nugget_bb_table (mode=call), inline nugget_bb_counters updates guarded by a
+   nugget_interval_hook call (mode=inline), or spanning-tree edge counters
+   reconstructed by nugget_edge_flush (mode=inline, placement=edge); with
+   loop_hoist=true (mode 'hoist') counted loops update their blocks once at
+   the loop exit; with promote=true (mode 'promote') loops keep their counts
+   in registers and flush them at exits; when the passes run from the
+   default pipeline extension points (mode 'late') blocks may be merged or
+   deleted after labeling, so only a subset of the labeled blocks is counted;
+   with threading=tls (mode 'tls') the inline counters are thread_local;
+   with touched=true (mode 'touched') the first update of a block in an
+   interval appends it to nugget_touched_ids for nugget_sparse_interval_hook;
+   with id_base=auto (mode 'id_base', a module without nugget_roi_begin_)
+   every hook adds the runtime-assigned nugget_id_base and a constructor
+   registers the module with nugget_register_module
 
 Usage:
-    python3 verify_instrumentation.py <instrumented.ll> <bb_info.csv> <expected_threshold>
+    python3 verify_instrumentation.py <instrumented.ll> <bb_info.csv> <expected_threshold> [call|inline|edge|hoist|promote|late|tls|touched|id_base]
 
 Exit codes:
     0: Validation passed
@@ -47,6 +62,9 @@ import csv
 from pathlib import Path
 from collections import defaultdict
 
+# Optional thread_local marker of the inline counter globals (threading=tls)
+TLS_PREFIX = r'(?:thread_local(?:\(\w+\))? )?'
+
 
 def parse_csv(csv_file):
     """Parse CSV file to get basic block information."""
@@ -64,8 +82,8 @@ def parse_csv(csv_file):
     return bb_info
 
 
-def check_nugget_init_in_roi_begin(ir_content, total_bb_count):
-    """Check that nugget_init is called in nugget_roi_begin_ with correct arg."""
+def check_nugget_init_in_roi_begin(ir_content, total_bb_count, expected_threshold):
+    """Check that nugget_init is called in nugget_roi_begin_ with correct args."""
     errors = []
     
     # Find nugget_roi_begin_ function
@@ -80,15 +98,18 @@ def check_nugget_init_in_roi_begin(ir_content, total_bb_count):
     
     roi_begin_body = roi_begin_match.group(1)
     
-    # Check for nugget_init call with the correct total_bb_count argument
-    init_call_pattern = rf'call\s+void\s+@nugget_init\s*\(\s*i64\s+{total_bb_count}\s*\)'
+    # Check for nugget_init call with the correct total_bb_count and
+    # interval_length arguments
+    init_call_pattern = (rf'call\s+void\s+@nugget_init\s*\(\s*i64\s+{total_bb_count}'
+                         rf'\s*,\s*i64\s+{expected_threshold}\s*\)')
     if not re.search(init_call_pattern, roi_begin_body):
         # Try to find any nugget_init call to report what was found
         any_init_call = re.search(r'call\s+void\s+@nugget_init\s*\([^)]*\)', roi_begin_body)
         if any_init_call:
             errors.append(
-                f"nugget_init called but with wrong argument. "
-                f"Expected total_bb_count={total_bb_count}, found: {any_init_call.group(0)}"
+                f"nugget_init called but with wrong arguments. "
+                f"Expected total_bb_count={total_bb_count}, "
+                f"interval_length={expected_threshold}, found: {any_init_call.group(0)}"
             )
         else:
             errors.append("nugget_init is NOT called in nugget_roi_begin_")
@@ -96,7 +117,7 @@ def check_nugget_init_in_roi_begin(ir_content, total_bb_count):
     return errors
 
 
-def check_bb_hooks(ir_content, bb_info, expected_threshold):
+def check_bb_hooks(ir_content, bb_info):
     """Check that all labeled basic blocks have nugget_bb_hook_ calls."""
     errors = []
     
@@ -133,28 +154,11 @@ def check_bb_hooks(ir_content, bb_info, expected_threshold):
         
         # Find all nugget_bb_hook calls in this function
         hook_pattern = re.compile(
-            r'call\s+void\s+@nugget_bb_hook\s*\(\s*i64\s+(\d+)\s*,\s*i64\s+(\d+)\s*,\s*i64\s+(\d+)\s*\)'
+            r'call\s+void\s+@nugget_bb_hook\s*\(\s*i64\s+(\d+)\s*\)'
         )
         
         for hook_match in hook_pattern.finditer(func_body):
-            inst_count = int(hook_match.group(1))
-            bb_id = int(hook_match.group(2))
-            threshold = int(hook_match.group(3))
-            
-            found_bb_hook_calls.add(bb_id)
-            
-            # Verify threshold
-            if threshold != expected_threshold:
-                errors.append(
-                    f"BB ID {bb_id}: wrong threshold. Expected {expected_threshold}, got {threshold}"
-                )
-            
-            # Verify inst_count matches CSV
-            for bb in bb_info:
-                if bb['bb_id'] == bb_id:
-                    # Note: inst_count in instrumented IR may differ slightly due to added instructions
-                    # We just verify the call exists with a reasonable inst_count
-                    break
+            found_bb_hook_calls.add(int(hook_match.group(1)))
     
     # Check all expected BBs have hook calls
     missing_hooks = expected_bb_ids - found_bb_hook_calls
@@ -169,14 +173,332 @@ def check_bb_hooks(ir_content, bb_info, expected_threshold):
     return errors
 
 
+def check_bb_table(ir_content, bb_info):
+    """Check __nugget_bb_table against the CSV.
+
+    The runtime reads the instruction count of a block from the table, so
+    every labeled block needs an entry with its CSV BasicBlockInstCount and
+    the function names must cover every function_id.
+    """
+    errors = []
+    table_match = re.search(
+        r'@__nugget_bb_table\s*=.*?constant\s+\[(\d+)\s+x\s+\{\s*i32,\s*i32,\s*i32\s*\}\]\s*(.*)',
+        ir_content)
+    if not table_match:
+        return ["__nugget_bb_table definition not found"]
+    entries = [tuple(int(v) for v in m.groups()) for m in re.finditer(
+        r'\{\s*i32\s+(\d+),\s*i32\s+(\d+),\s*i32\s+(\d+)\s*\}',
+        table_match.group(2))]
+    # Labeled blocks are never empty, so no entry is a zeroinitializer
+    if int(table_match.group(1)) != len(bb_info) or len(entries) != len(bb_info):
+        errors.append(f"__nugget_bb_table has {table_match.group(1)} entries, "
+                      f"expected {len(bb_info)}")
+        return errors
+    function_ids = set()
+    for bb in bb_info:
+        inst_count, function_id, _flags = entries[bb['bb_id']]
+        function_ids.add(function_id)
+        if inst_count != bb['inst_count']:
+            errors.append(f"__nugget_bb_table[{bb['bb_id']}]: inst_count "
+                          f"{inst_count}, CSV has {bb['inst_count']}")
+    names_match = re.search(r'@__nugget_function_names\s*=.*?constant\s+\[(\d+)\s+x',
+                            ir_content)
+    if not names_match:
+        errors.append("__nugget_function_names definition not found")
+    elif function_ids and max(function_ids) >= int(names_match.group(1)):
+        errors.append(f"__nugget_function_names has {names_match.group(1)} "
+                      f"names, function_id {max(function_ids)} used")
+    return errors
+
+
+def check_id_base_hooks(ir_content, bb_info):
+    """Check the hooks and registration of an id_base=auto module.
+
+    Every labeled block must call nugget_bb_hook(nugget_id_base + bb_id), and
+    a global constructor must pass the module to nugget_register_module.
+    """
+    errors = []
+    bases = set(re.findall(
+        r'(%[\w.]+) = load i64, (?:i64\*|ptr) @nugget_id_base', ir_content))
+    ids = {}
+    for result, operand, bb_id in re.findall(
+            r'(%[\w.]+) = add i64 (%[\w.]+), (\d+)', ir_content):
+        if operand in bases:
+            ids[result] = int(bb_id)
+    found_bb_ids = set()
+    for argument in re.findall(r'call void @nugget_bb_hook\(i64 ([^)]+)\)',
+                               ir_content):
+        if argument not in ids:
+            errors.append(f"nugget_bb_hook({argument}) does not add "
+                          f"nugget_id_base")
+            continue
+        found_bb_ids.add(ids[argument])
+    expected_bb_ids = {bb['bb_id'] for bb in bb_info}
+    missing = expected_bb_ids - found_bb_ids
+    if missing:
+        errors.append(f"Missing nugget_bb_hook calls for BB IDs: {sorted(missing)}")
+    extra = found_bb_ids - expected_bb_ids
+    if extra:
+        errors.append(f"Unexpected nugget_bb_hook calls for BB IDs: {sorted(extra)}")
+    if not re.search(r'@llvm\.global_ctors = .*@nugget_register_module_ctor',
+                     ir_content):
+        errors.append("nugget_register_module_ctor is not a global constructor")
+    if not re.search(r'call void @nugget_register_module\(', ir_content):
+        errors.append("nugget_register_module is NOT called")
+    if re.search(r'call void @nugget_init\(', ir_content):
+        errors.append("nugget_init must not be called without nugget_roi_begin_")
+    return errors
+
+
+def check_inline_counters(ir_content, bb_info, expected_threshold, batched=False):
+    """Check that all labeled basic blocks update nugget_bb_counters inline.
+
+    With batched=True (loop_hoist or promote) the blocks of some loops share
+    one threshold check at the loop exit, where their counters grow by the
+    trip count or by the promoted local count.
+    """
+    errors = []
+
+    helper_funcs = {
+        'nugget_init', 'nugget_roi_begin_', 'nugget_roi_end_',
+        'nugget_bb_hook', 'nugget_interval_hook',
+        'nugget_warmup_marker_hook', 'nugget_start_marker_hook',
+        'nugget_end_marker_hook'
+    }
+    expected_bb_ids = {
+        bb['bb_id']
+        for bb in bb_info
+        if bb['function_name'] not in helper_funcs
+    }
+
+    if not re.search(rf'@nugget_bb_counters\s*=\s*internal {TLS_PREFIX}global '
+                     r'\[\d+ x i64\]', ir_content):
+        errors.append("nugget_bb_counters global not found")
+        return errors
+
+    # The counter address is a constant GEP; depending on the LLVM version it
+    # is printed either as an array index or as a byte offset. Index 0 folds
+    # to the global itself.
+    found = set()
+    for m in re.finditer(
+            r'\[\d+ x i64\], ptr @nugget_bb_counters, i64 0, i64 (\d+)\)',
+            ir_content):
+        found.add(int(m.group(1)))
+    for m in re.finditer(r'i8, ptr @nugget_bb_counters, i64 (\d+)\)',
+                         ir_content):
+        found.add(int(m.group(1)) // 8)
+    if re.search(r'load i64, ptr @nugget_bb_counters\b', ir_content):
+        found.add(0)
+
+    missing = expected_bb_ids - found
+    if missing:
+        errors.append(f"Missing inline counter updates for BB IDs: {sorted(missing)}")
+    extra = found - expected_bb_ids
+    if extra:
+        errors.append(f"Unexpected inline counter updates for BB IDs: {sorted(extra)}")
+
+    # Every block compares the running instruction count to the threshold and
+    # calls the interval hook on the cold path. nugget_flush_interval calls the
+    # hook once more without a compare.
+    counted_ir = re.sub(r'define weak void @nugget_flush_interval\(\).*?\n\}',
+                        '', ir_content, flags=re.DOTALL)
+    compares = len(re.findall(rf'icmp uge i64 %\w+, {expected_threshold}\b',
+                              counted_ir))
+    hooks = len(re.findall(r'call void @nugget_(?:sparse_)?interval_hook\(',
+                           counted_ir))
+    if batched:
+        if compares != hooks or compares == 0:
+            errors.append(
+                f"Expected one nugget_interval_hook call per threshold compare, "
+                f"found {compares} compares and {hooks} hook calls")
+        increments = re.findall(
+            r'= load i64, ptr (?:getelementptr inbounds \([^)]*@nugget_bb_counters'
+            r'[^)]*\)|@nugget_bb_counters)[^\n]*\n\s*%[\w.]+ = add i64 %[\w.]+, '
+            r'(%[\w.]+|\d+)', ir_content)
+        if not [inc for inc in increments if inc != '1']:
+            errors.append("No counter is incremented by a loop trip count or local count")
+    else:
+        if compares != len(expected_bb_ids):
+            errors.append(f"Expected {len(expected_bb_ids)} threshold compares, found {compares}")
+        if hooks != len(expected_bb_ids):
+            errors.append(f"Expected {len(expected_bb_ids)} nugget_interval_hook calls, found {hooks}")
+    if re.search(r'call void @nugget_bb_hook\(', ir_content):
+        errors.append("nugget_bb_hook must not be called in inline mode")
+
+    return errors
+
+
+def check_late_instrumentation(ir_content, bb_info):
+    """Check instrumentation done at the end of the optimization pipeline.
+
+    Labeling runs before optimization, so blocks may be merged, duplicated or
+    deleted afterwards: the counted blocks must be a non-empty subset of the
+    labeled ones and nugget_init only has to be present.
+    """
+    errors = []
+    roi_begin_match = re.search(
+        r'define\s+(?:dso_local\s+)?void\s+@nugget_roi_begin_\s*\([^)]*\)\s*[^{]*\{(.*?)\n\}',
+        ir_content, re.DOTALL
+    )
+    if not roi_begin_match or not re.search(
+            r'call\s+void\s+@nugget_init\s*\(\s*i64\s+\d+\s*,\s*i64\s+\d+\s*\)',
+            roi_begin_match.group(1)):
+        errors.append("nugget_init is NOT called in nugget_roi_begin_")
+
+    labeled_ids = {bb['bb_id'] for bb in bb_info}
+    found = set()
+    for m in re.finditer(
+            r'\[\d+ x i64\], ptr @nugget_bb_counters, i64 0, i64 (\d+)\)',
+            ir_content):
+        found.add(int(m.group(1)))
+    for m in re.finditer(r'i8, ptr @nugget_bb_counters, i64 (\d+)\)',
+                         ir_content):
+        found.add(int(m.group(1)) // 8)
+    if re.search(r'load i64, ptr @nugget_bb_counters\b', ir_content):
+        found.add(0)
+    if not found:
+        errors.append("No inline counter updates found")
+    extra = found - labeled_ids
+    if extra:
+        errors.append(f"Counter updates for unlabeled BB IDs: {sorted(extra)}")
+    if not re.search(r'call void @nugget_interval_hook\(', ir_content):
+        errors.append("nugget_interval_hook is never called")
+    return errors
+
+
+def check_promoted_counters(ir_content):
+    """Check that promoted loop counters were turned into SSA registers."""
+    errors = []
+    if re.search(r'%nugget\.(?:count|insts|iters)[\w.]* = alloca', ir_content):
+        errors.append("Promoted loop counters were left in allocas")
+    if not re.search(r'%nugget\.(?:count|insts)[\w.]* = phi i64', ir_content):
+        errors.append("No promoted loop counter found")
+    return errors
+
+
+def check_thread_local_counters(ir_content):
+    """Check that the inline counters and interval clock are thread_local."""
+    errors = []
+    for name in ('nugget_bb_counters', 'nugget_inst_counter'):
+        if not re.search(rf'@{name}\s*=\s*internal thread_local', ir_content):
+            errors.append(f"{name} is not thread_local")
+    if not re.search(r'define weak void @nugget_flush_interval\(\)', ir_content):
+        errors.append("nugget_flush_interval definition not found")
+    return errors
+
+
+def check_touched_list(ir_content, bb_info):
+    """Check that every labeled block records itself in nugget_touched_ids."""
+    errors = []
+    helper_funcs = {
+        'nugget_init', 'nugget_roi_begin_', 'nugget_roi_end_',
+        'nugget_bb_hook', 'nugget_interval_hook', 'nugget_sparse_interval_hook',
+        'nugget_warmup_marker_hook', 'nugget_start_marker_hook',
+        'nugget_end_marker_hook'
+    }
+    expected_bb_ids = {
+        bb['bb_id']
+        for bb in bb_info
+        if bb['function_name'] not in helper_funcs
+    }
+    for name, elem in (('nugget_touched_ids', r'\[\d+ x i32\]'),
+                       ('nugget_num_touched', 'i64')):
+        if not re.search(rf'@{name}\s*=\s*internal {TLS_PREFIX}global {elem}',
+                         ir_content):
+            errors.append(f"{name} global not found")
+    if errors:
+        return errors
+
+    found = {
+        int(m.group(1))
+        for m in re.finditer(
+            r'getelementptr inbounds \[\d+ x i32\], ptr @nugget_touched_ids, '
+            r'i64 0, i64 %[\w.]+\n\s*store i32 (\d+), ptr', ir_content)
+    }
+    missing = expected_bb_ids - found
+    if missing:
+        errors.append(f"Blocks never added to nugget_touched_ids: {sorted(missing)}")
+    if re.search(r'call void @nugget_interval_hook\(', ir_content):
+        errors.append("nugget_interval_hook must not be called with touched=true")
+    if not re.search(r'call void @nugget_sparse_interval_hook\(', ir_content):
+        errors.append("nugget_sparse_interval_hook is never called")
+    return errors
+
+
+def check_edge_counters(ir_content, bb_info, expected_threshold):
+    """Check that every labeled basic block is reconstructed by nugget_edge_flush.
+
+    A block is covered either by the (bb_id, edge) pairs of the nugget_bb_ops
+    table or, for functions that fell back to block placement, by a direct
+    nugget_bb_counters update.
+    """
+    errors = []
+
+    helper_funcs = {
+        'nugget_init', 'nugget_roi_begin_', 'nugget_roi_end_',
+        'nugget_bb_hook', 'nugget_interval_hook',
+        'nugget_warmup_marker_hook', 'nugget_start_marker_hook',
+        'nugget_end_marker_hook'
+    }
+    expected_bb_ids = {
+        bb['bb_id']
+        for bb in bb_info
+        if bb['function_name'] not in helper_funcs
+    }
+
+    for name in ('nugget_bb_counters', 'nugget_edge_values'):
+        if not re.search(rf'@{name}\s*=\s*internal {TLS_PREFIX}global '
+                         r'\[\d+ x i64\]', ir_content):
+            errors.append(f"{name} global not found")
+    flush_match = re.search(
+        r'define internal void @nugget_edge_flush\(i64[^)]*\)[^{]*\{(.*?)\n\}',
+        ir_content, re.DOTALL)
+    if not flush_match:
+        errors.append("nugget_edge_flush definition not found")
+    elif 'call void @nugget_interval_hook(' not in flush_match.group(1):
+        errors.append("nugget_edge_flush does not call nugget_interval_hook")
+    if errors:
+        return errors
+
+    found = set()
+    ops_match = re.search(
+        r'@nugget_bb_ops = private constant \[\d+ x i32\] \[([^\]]*)\]',
+        ir_content)
+    if ops_match:
+        values = [int(v) for v in re.findall(r'i32 (-?\d+)', ops_match.group(1))]
+        found.update(values[0::2])
+    # Functions that fell back to block placement
+    for m in re.finditer(
+            r'\[\d+ x i64\], ptr @nugget_bb_counters, i64 0, i64 (\d+)\)',
+            ir_content):
+        found.add(int(m.group(1)))
+
+    missing = expected_bb_ids - found
+    if missing:
+        errors.append(f"Blocks not reconstructed by nugget_edge_flush: {sorted(missing)}")
+    extra = found - expected_bb_ids
+    if extra:
+        errors.append(f"Unexpected BB IDs in nugget_bb_ops: {sorted(extra)}")
+
+    # Edge counters compare signed: a fundamental cycle may have a negative
+    # instruction weight.
+    if not re.search(rf'icmp sge i64 %\w+, {expected_threshold}\b', ir_content):
+        errors.append("No threshold compare found for edge counters")
+    if re.search(r'call void @nugget_bb_hook\(', ir_content):
+        errors.append("nugget_bb_hook must not be called in inline mode")
+
+    return errors
+
+
 def main():
     if len(sys.argv) < 4:
-        print("Usage: verify_instrumentation.py <instrumented.ll> <bb_info.csv> <expected_threshold>")
+        print("Usage: verify_instrumentation.py <instrumented.ll> <bb_info.csv> <expected_threshold> [call|inline|edge|hoist|promote|late|tls|touched|id_base]")
         sys.exit(1)
     
     ir_file = sys.argv[1]
     csv_file = sys.argv[2]
     expected_threshold = int(sys.argv[3])
+    mode = sys.argv[4] if len(sys.argv) > 4 else 'call'
     
     # Verify files exist
     if not Path(ir_file).exists():
@@ -197,10 +519,32 @@ def main():
     errors = []
     
     # Check 1: nugget_init_ is called in nugget_roi_begin_
-    errors.extend(check_nugget_init_in_roi_begin(ir_content, total_bb_count))
+    if mode not in ('late', 'id_base'):
+        errors.extend(check_nugget_init_in_roi_begin(ir_content, total_bb_count,
+                                                     expected_threshold))
     
-    # Check 2: All labeled BBs have nugget_bb_hook_ calls
-    errors.extend(check_bb_hooks(ir_content, bb_info, expected_threshold))
+    # Check 2: All labeled BBs are counted
+    if mode == 'late':
+        errors.extend(check_late_instrumentation(ir_content, bb_info))
+    elif mode in ('inline', 'tls', 'touched'):
+        errors.extend(check_inline_counters(ir_content, bb_info, expected_threshold))
+        if mode == 'tls':
+            errors.extend(check_thread_local_counters(ir_content))
+        if mode == 'touched':
+            errors.extend(check_touched_list(ir_content, bb_info))
+    elif mode in ('hoist', 'promote'):
+        errors.extend(check_inline_counters(ir_content, bb_info, expected_threshold,
+                                            batched=True))
+        if mode == 'promote':
+            errors.extend(check_promoted_counters(ir_content))
+    elif mode == 'edge':
+        errors.extend(check_edge_counters(ir_content, bb_info, expected_threshold))
+    elif mode == 'id_base':
+        errors.extend(check_id_base_hooks(ir_content, bb_info))
+        errors.extend(check_bb_table(ir_content, bb_info))
+    else:
+        errors.extend(check_bb_hooks(ir_content, bb_info))
+        errors.extend(check_bb_table(ir_content, bb_info))
     
     if errors:
         print("✗ Instrumentation validation FAILED")
@@ -209,8 +553,20 @@ def main():
         sys.exit(1)
     else:
         print("✓ Instrumentation validation PASSED")
-        print(f"  - nugget_init called with total_bb_count={total_bb_count}")
-        print(f"  - {total_bb_count} basic blocks instrumented with nugget_bb_hook")
+        if mode not in ('late', 'id_base'):
+            print(f"  - nugget_init called with total_bb_count={total_bb_count}")
+        hook = {'inline': 'inline counters',
+                'edge': 'spanning-tree edge counters',
+                'hoist': 'inline counters (counted loops hoisted)',
+                'promote': 'inline counters (loop counters promoted)',
+                'late': 'inline counters at the end of the pipeline',
+                'tls': 'thread-local inline counters',
+                'touched': 'inline counters and a touched list',
+                'id_base': 'nugget_bb_hook(nugget_id_base + bb_id)'}.get(mode, 'nugget_bb_hook')
+        if mode == 'late':
+            print(f"  - {total_bb_count} basic blocks labeled, surviving ones counted with {hook}")
+        else:
+            print(f"  - {total_bb_count} basic blocks instrumented with {hook}")
         print(f"  - threshold={expected_threshold}")
         sys.exit(0)
 
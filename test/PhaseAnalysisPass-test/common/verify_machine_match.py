@@ -12,10 +12,11 @@
 #
 # Verification checks:
 #   1. Each hook in the assembly has a valid bb_id from the IR
-#   2. The (inst_count, bb_id, interval) arguments in ASM match the IR
+#   2. The bb_id argument of every hook in ASM can be resolved
 #   3. Missing hooks (IR -> ASM) are explained with evidence of optimization
 #   4. No spurious hooks appear in unexpected places
-#   5. nugget_init is called in nugget_roi_begin_
+#   5. nugget_init is called in nugget_roi_begin_, and the IR passes it
+#      interval_length
 #
 # Usage:
 #   python3 verify_machine_match.py <instrumented.ll> <disassembly.txt> <bb_info.csv> <interval_length>
@@ -36,7 +37,7 @@ class ArchHandler(ABC):
     
     @abstractmethod
     def get_arg_registers(self):
-        """Return tuple of (arg1_reg, arg2_reg, arg3_reg) canonical names."""
+        """Return tuple of (arg1_reg,) canonical names."""
         pass
     
     @abstractmethod
@@ -82,7 +83,7 @@ class X86_64Handler(ArchHandler):
     """Handler for x86-64 architecture."""
     
     def get_arg_registers(self):
-        return ('rdi', 'rsi', 'rdx')
+        return ('rdi',)
     
     def get_register_aliases(self, reg_name):
         aliases = {
@@ -122,7 +123,7 @@ class AArch64Handler(ArchHandler):
     """Handler for AArch64 (ARM64) architecture."""
     
     def get_arg_registers(self):
-        return ('x0', 'x1', 'x2')
+        return ('x0',)
     
     def get_register_aliases(self, reg_name):
         # w0-w30 are 32-bit views of x0-x30
@@ -226,7 +227,7 @@ def parse_ir_hooks(ir_path):
     # Patterns for parsing IR
     func_pattern = re.compile(r'^define\s+.*@(\w+)\s*\(')
     bb_pattern = re.compile(r'^([a-zA-Z0-9_.]+):\s*;?\s*preds')
-    hook_pattern = re.compile(r'call void @nugget_bb_hook\(i64\s+(\d+),\s*i64\s+(\d+),\s*i64\s+(\d+)\)')
+    hook_pattern = re.compile(r'call void @nugget_bb_hook\(i64\s+(\d+)\)')
     
     with open(ir_path, 'r') as f:
         for line in f:
@@ -246,13 +247,9 @@ def parse_ir_hooks(ir_path):
             # Check for hook call
             hook_match = hook_pattern.search(line)
             if hook_match and current_function:
-                inst_count = int(hook_match.group(1))
-                bb_id = int(hook_match.group(2))
-                interval = int(hook_match.group(3))
+                bb_id = int(hook_match.group(1))
                 ir_hooks[bb_id] = {
-                    'inst_count': inst_count,
                     'bb_id': bb_id,
-                    'interval': interval,
                     'function': current_function,
                     'bb_name': current_bb
                 }
@@ -263,7 +260,7 @@ def parse_ir_hooks(ir_path):
 def parse_disassembly_hooks_detailed(disasm_path, arch_handler):
     """
     Parse disassembly and extract nugget_bb_hook calls with their arguments.
-    Returns list of dicts with function, address, inst_count, bb_id, interval.
+    Returns list of dicts with function, address, bb_id.
     
     This parser works by reading the file, storing all lines, and then for each
     hook call, it looks backwards to find the register assignments.
@@ -283,7 +280,7 @@ def parse_disassembly_hooks_detailed(disasm_path, arch_handler):
     branch_target_pattern = arch_handler.get_branch_target_pattern()
     addr_pattern = re.compile(r'^\s*([0-9a-f]+):')
     
-    arg1_reg, arg2_reg, arg3_reg = arch_handler.get_arg_registers()
+    arg1_reg, = arch_handler.get_arg_registers()
     
     # First pass: find all function boundaries and jump targets
     func_ranges = []  # (start_line, func_name)
@@ -400,21 +397,25 @@ def parse_disassembly_hooks_detailed(disasm_path, arch_handler):
             address = call_match.group(1)
             current_function = get_function_at_line(i)
             
-            inst_count = find_register_value_backwards(lines, i, arg1_reg)
-            bb_id = find_register_value_backwards(lines, i, arg2_reg)
-            interval = find_register_value_backwards(lines, i, arg3_reg)
+            bb_id = find_register_value_backwards(lines, i, arg1_reg)
             
             asm_hooks.append({
                 'function': current_function,
                 'address': address,
-                'inst_count': inst_count,
-                'bb_id': bb_id,
-                'interval': interval
+                'bb_id': bb_id
             })
     
     return asm_hooks
 
 
+def parse_ir_interval_length(ir_path):
+    """Return the interval_length the IR passes to nugget_init, or None."""
+    init_pattern = re.compile(r'call void @nugget_init\(i64\s+\d+,\s*i64\s+(\d+)\)')
+    with open(ir_path, 'r') as f:
+        match = init_pattern.search(f.read())
+    return int(match.group(1)) if match else None
+
+
 def verify_init_call(disasm_path, arch_handler):
     """Verify nugget_init is called in nugget_roi_begin_."""
     in_roi_begin = False
@@ -511,6 +512,15 @@ def main():
     else:
         errors.append("nugget_init not found in nugget_roi_begin_")
         print("✗ nugget_init NOT found in nugget_roi_begin_")
+
+    ir_interval = parse_ir_interval_length(ir_path)
+    if ir_interval == interval_length:
+        print(f"✓ nugget_init receives interval_length={interval_length}")
+    else:
+        errors.append(f"nugget_init interval_length mismatch - "
+                      f"expected {interval_length}, IR={ir_interval}")
+        print(f"✗ nugget_init interval_length in IR is {ir_interval}, "
+              f"expected {interval_length}")
     
     print()
     print("-" * 70)
@@ -555,41 +565,19 @@ def main():
     
     print()
     print("-" * 70)
-    print("Verification Step 4: Verify hook arguments match")
+    print("Verification Step 4: Verify hook arguments are resolved")
     print("-" * 70)
     
-    arg_mismatches = []
-    for h in valid_asm_hooks:
-        bb_id = h['bb_id']
-        ir_hook = ir_hooks[bb_id]
-        
-        # Check inst_count
-        if h['inst_count'] != ir_hook['inst_count']:
-            arg_mismatches.append({
-                'bb_id': bb_id,
-                'field': 'inst_count',
-                'ir_val': ir_hook['inst_count'],
-                'asm_val': h['inst_count'],
-                'address': h['address']
-            })
-        
-        # Check interval
-        if h['interval'] != ir_hook['interval']:
-            arg_mismatches.append({
-                'bb_id': bb_id,
-                'field': 'interval',
-                'ir_val': ir_hook['interval'],
-                'asm_val': h['interval'],
-                'address': h['address']
-            })
-    
-    if arg_mismatches:
-        print(f"Argument mismatches: {len(arg_mismatches)}")
-        for m in arg_mismatches:
-            errors.append(f"bb_id {m['bb_id']}: {m['field']} mismatch - IR={m['ir_val']}, ASM={m['asm_val']}")
-            print(f"  ✗ bb_id {m['bb_id']}: {m['field']} mismatch - IR={m['ir_val']}, ASM={m['asm_val']}")
+    # The block sizes live in __nugget_bb_table, so the bb_id is the only
+    # argument; it cannot be compared when the register load is not found.
+    unresolved = [h for h in asm_hooks if h['bb_id'] < 0]
+    if unresolved:
+        print(f"Unresolved bb_id arguments: {len(unresolved)}")
+        for h in unresolved:
+            warnings.append(f"Hook at {h['address']} in {h['function']}: bb_id not resolved")
+            print(f"  ⚠ addr={h['address']} func={h['function']}")
     else:
-        print("✓ All hook arguments match between IR and ASM")
+        print("✓ Every ASM hook passes a constant bb_id")
     
     print()
     print("-" * 70)
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Test Case 10: Separately instrumented modules
+//
+// Purpose: Verify that an executable and a shared library, each labeled by
+// its own IRBBLabelPass run (so both number their blocks from 0), record
+// disjoint bb_ids when built with PhaseAnalysisPass id_base:
+//   1. This executable is built with id_base=0 and keeps its ids
+//   2. test10_modules_lib.c is built with id_base=auto and gets the range
+//      after it from the runtime
+//   3. The trace lists both modules with their fingerprints and ranges
+//
+// The program defines nugget_roi_begin_ itself; the library does not, so
+// only the executable calls nugget_init.
+
+#include <stdio.h>
+
+extern void nugget_roi_end_(void);
+extern long lib_checksum(const long *values, int n);
+extern long lib_max(const long *values, int n);
+
+__attribute__((noinline)) void nugget_roi_begin_(void) {
+    __asm__ volatile("" ::: "memory");
+}
+
+static long data[256];
+
+int main() {
+    nugget_roi_begin_();
+
+    for (int i = 0; i < 256; i++) {
+        data[i] = (i * 37) % 101;
+    }
+    long total = 0;
+    for (int rep = 0; rep < 40; rep++) {
+        total += lib_checksum(data, 256 - rep);
+        if (rep % 4 == 0) {
+            total += lib_max(data, 256);
+        }
+    }
+    printf("Total: %ld\n", total);
+
+    nugget_roi_end_();
+    return 0;
+}
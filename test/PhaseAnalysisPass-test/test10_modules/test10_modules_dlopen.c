@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Test Case 10: Module loaded after nugget_init
+//
+// Purpose: Verify that a module registered after nugget_init is counted in
+// bb_ids of its own rather than added to the blocks of another module:
+//   1. This executable is built with id_base=0 and is the only module laid
+//      out by nugget_init
+//   2. After nugget_roi_begin_ it dlopens the library named by argv[1] and
+//      calls its late_checksum
+//   3. Run with libtest10_modules_late.so, built from test10_modules_late.c
+//      with id_base=0, the library would count into this executable's
+//      bb_ids had the runtime not laid it out past them. Run with the
+//      uninstrumented build of the same source, the executable's own blocks
+//      give the reference counts.
+
+#include <dlfcn.h>
+#include <stdio.h>
+
+extern void nugget_roi_end_(void);
+
+__attribute__((noinline)) void nugget_roi_begin_(void) {
+    __asm__ volatile("" ::: "memory");
+}
+
+static long data[256];
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <library>\n", argv[0]);
+        return 1;
+    }
+    nugget_roi_begin_();
+
+    for (int i = 0; i < 256; i++) {
+        data[i] = (i * 37) % 101;
+    }
+    void *library = dlopen(argv[1], RTLD_NOW);
+    if (!library) {
+        fprintf(stderr, "%s\n", dlerror());
+        return 1;
+    }
+    long (*late_checksum)(const long *, int) =
+        (long (*)(const long *, int))dlsym(library, "late_checksum");
+    if (!late_checksum) {
+        fprintf(stderr, "%s\n", dlerror());
+        return 1;
+    }
+    long total = 0;
+    for (int rep = 0; rep < 40; rep++) {
+        total += late_checksum(data, 256 - rep);
+    }
+    printf("Total: %ld\n", total);
+
+    nugget_roi_end_();
+    return 0;
+}
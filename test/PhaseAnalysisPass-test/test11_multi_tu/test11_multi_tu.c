@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Test Case 11: Separately instrumented translation units, static link
+//
+// Purpose: Verify that two translation units labeled and instrumented on
+// their own without id_base, as the per-file clang -fpass-plugin flow does,
+// link statically into one program:
+//   1. This unit defines nugget_roi_begin_, so only its nugget_roi_begin_
+//      calls nugget_init
+//   2. test11_multi_tu_work.c defines the kernels and no ROI
+//   3. Both define the weak __nugget_bb_table globals and
+//      nugget_module_fingerprint; the linker keeps one unit's
+
+#include <stdio.h>
+
+extern void nugget_roi_end_(void);
+extern long work_sum(const long *values, int n);
+extern long work_max(const long *values, int n);
+
+__attribute__((noinline)) void nugget_roi_begin_(void) {
+    __asm__ volatile("" ::: "memory");
+}
+
+static long data[256];
+
+int main() {
+    nugget_roi_begin_();
+
+    for (int i = 0; i < 256; i++) {
+        data[i] = (i * 53) % 97;
+    }
+    long total = 0;
+    for (int rep = 0; rep < 40; rep++) {
+        total += work_sum(data, 256 - rep);
+        if (rep % 4 == 0) {
+            total += work_max(data, 256);
+        }
+    }
+    printf("Total: %ld\n", total);
+
+    nugget_roi_end_();
+    return 0;
+}
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//
+// Test Case 3: PhaseAnalysisPass inline counting mode
+//
+// Purpose: Verify that phase-analysis-pass<mode=inline> correctly:
+//   1. Inserts nugget_init call at the end of nugget_roi_begin_
+//   2. Replaces per-block nugget_bb_hook calls with inline counter updates
+//   3. Calls nugget_interval_hook when the interval threshold is crossed
+//
+// The loops run long enough to cross the (small) interval threshold many
+// times so the cold path is exercised when the executable runs.
+
+#include <stdio.h>
+
+extern void nugget_roi_begin_(void);
+extern void nugget_roi_end_(void);
+
+static long data[256];
+
+long reduce(int n) {
+    long sum = 0;
+    for (int i = 0; i < n; i++) {
+        if (data[i] & 1) {
+            sum += data[i];
+        } else {
+            sum -= data[i] / 2;
+        }
+    }
+    return sum;
+}
+
+int main() {
+    nugget_roi_begin_();
+
+    for (int i = 0; i < 256; i++) {
+        data[i] = i * 7 + 3;
+    }
+
+    long total = 0;
+    for (int rep = 0; rep < 100; rep++) {
+        total += reduce(256);
+    }
+    printf("Total: %ld\n", total);
+
+    nugget_roi_end_();
+    return 0;
+}
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//
+// Test Case 4: PhaseAnalysisPass spanning-tree edge placement
+//
+// Purpose: Verify that phase-analysis-pass<mode=inline;placement=edge>
+// correctly:
+//   1. Inserts nugget_init call at the end of nugget_roi_begin_
+//   2. Counts only the edges outside each function's spanning tree
+//   3. Reconstructs the block counts in nugget_edge_flush before calling
+//      nugget_interval_hook
+//
+// The program mixes loops, a switch with shared targets, early returns and
+// recursion so the spanning trees contain critical edges, multiple exits
+// and fundamental cycles of differing weight.
+
+#include <stdio.h>
+
+extern void nugget_roi_begin_(void);
+extern void nugget_roi_end_(void);
+
+static long data[256];
+
+long classify(long v) {
+    switch (v % 6) {
+    case 0:
+    case 1:
+        return v * 3;
+    case 2:
+        return v - 7;
+    case 4:
+        if (v > 500) {
+            return v / 3;
+        }
+        break;
+    default:
+        break;
+    }
+    return v + 1;
+}
+
+long collatz(long v) {
+    long steps = 0;
+    while (v > 1) {
+        v = (v & 1) ? v * 3 + 1 : v / 2;
+        steps++;
+    }
+    return steps;
+}
+
+long fib(int n) {
+    if (n < 2) {
+        return n;
+    }
+    return fib(n - 1) + fib(n - 2);
+}
+
+int main() {
+    nugget_roi_begin_();
+
+    for (int i = 0; i < 256; i++) {
+        data[i] = i * 7 + 3;
+    }
+
+    long total = 0;
+    for (int rep = 0; rep < 50; rep++) {
+        for (int i = 0; i < 256; i++) {
+            total += classify(data[i]);
+            total += collatz(data[i] + rep);
+        }
+        total += fib(12);
+    }
+    printf("Total: %ld\n", total);
+
+    nugget_roi_end_();
+    return 0;
+}
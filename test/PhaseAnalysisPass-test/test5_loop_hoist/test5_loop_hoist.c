@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//
+// Test Case 5: PhaseAnalysisPass loop hoisting
+//
+// Purpose: Verify that phase-analysis-pass<mode=inline;loop_hoist=true>
+// correctly:
+//   1. Inserts nugget_init call at the end of nugget_roi_begin_
+//   2. Leaves counted loop bodies free of counter updates
+//   3. Adds the loop trip count to the block counters at the loop exit
+//
+// scale() and dot() are counted loops with a runtime trip count; the loop in
+// main() calls a function and must keep its per-block updates.
+
+#include <stdio.h>
+
+extern void nugget_roi_begin_(void);
+extern void nugget_roi_end_(void);
+
+static long a[1024];
+static long b[1024];
+
+void scale(long *dst, const long *src, long k, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = src[i] * k;
+    }
+}
+
+long dot(const long *x, const long *y, int n) {
+    long sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+int main() {
+    nugget_roi_begin_();
+
+    for (int i = 0; i < 1024; i++) {
+        a[i] = i % 13;
+    }
+
+    long total = 0;
+    for (int rep = 1; rep < 200; rep++) {
+        scale(b, a, rep, 1024 - rep);
+        total += dot(a, b, 1024 - rep);
+    }
+    printf("Total: %ld\n", total);
+
+    nugget_roi_end_();
+    return 0;
+}
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//
+// Test Case 6: PhaseAnalysisPass loop counter promotion
+//
+// Purpose: Verify that phase-analysis-pass<mode=inline;promote=true>
+// correctly:
+//   1. Inserts nugget_init call at the end of nugget_roi_begin_
+//   2. Keeps the counters of loops in registers instead of memory
+//   3. Flushes them at loop exits and every promote_stride iterations
+//
+// collatz() has no computable trip count and filter() branches inside its
+// body, so neither loop can be hoisted by trip count; both are promoted.
+
+#include <stdio.h>
+
+extern void nugget_roi_begin_(void);
+extern void nugget_roi_end_(void);
+
+static long data[512];
+
+long collatz(long v) {
+    long steps = 0;
+    while (v > 1) {
+        v = (v & 1) ? v * 3 + 1 : v / 2;
+        steps++;
+    }
+    return steps;
+}
+
+long filter(int n) {
+    long sum = 0;
+    for (int i = 0; i < n; i++) {
+        if (data[i] % 3 == 0) {
+            sum += data[i];
+        }
+    }
+    return sum;
+}
+
+int main() {
+    nugget_roi_begin_();
+
+    for (int i = 0; i < 512; i++) {
+        data[i] = i * 11 + 5;
+    }
+
+    long total = 0;
+    for (int rep = 0; rep < 100; rep++) {
+        total += collatz(data[rep] + rep);
+        total += filter(512 - rep);
+    }
+    printf("Total: %ld\n", total);
+
+    nugget_roi_end_();
+    return 0;
+}
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//
+// Test Case 7: Nugget passes at the default pipeline extension points
+//
+// Purpose: Verify that -nugget-pipeline-start / -nugget-optimizer-last:
+//   1. Label the basic blocks before the O2 pipeline
+//   2. Instrument the optimized (inlined, vectorized) code afterwards
+//   3. Produce an executable that runs to completion
+//
+// scale() is small and hot so the O2 pipeline inlines and vectorizes it
+// before the instrumentation is inserted.
+
+#include <stdio.h>
+
+extern void nugget_roi_begin_(void);
+extern void nugget_roi_end_(void);
+
+static long data[1024];
+
+static void scale(long *v, long k, int n) {
+    for (int i = 0; i < n; i++) {
+        v[i] = v[i] * k + 1;
+    }
+}
+
+int main() {
+    nugget_roi_begin_();
+
+    for (int i = 0; i < 1024; i++) {
+        data[i] = i;
+    }
+
+    long total = 0;
+    for (int rep = 0; rep < 100; rep++) {
+        scale(data, 3, 1024);
+        total += data[rep];
+    }
+    printf("Total: %ld\n", total);
+
+    nugget_roi_end_();
+    return 0;
+}
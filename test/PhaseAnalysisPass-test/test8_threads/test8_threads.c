@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Test Case 8: PhaseAnalysisPass thread-local counters
+//
+// Purpose: Verify that phase-analysis-pass<mode=inline;threading=tls>
+// correctly:
+//   1. Makes nugget_bb_counters and nugget_inst_counter thread_local
+//   2. Keeps the inline counter updates and interval cold path
+//   3. Produces an executable whose worker threads each count into their
+//      own basic block vector
+//
+// The workers run different kernels so their per-thread vectors differ.
+
+#include <pthread.h>
+#include <stdio.h>
+
+extern void nugget_roi_begin_(void);
+extern void nugget_roi_end_(void);
+
+#define NUM_THREADS 4
+
+static long data[NUM_THREADS][256];
+static long results[NUM_THREADS];
+
+long scale(long *values, int n, long factor) {
+    long sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += values[i] * factor;
+    }
+    return sum;
+}
+
+long parity(long *values, int n) {
+    long sum = 0;
+    for (int i = 0; i < n; i++) {
+        if (values[i] & 1) {
+            sum += values[i];
+        } else {
+            sum -= values[i] / 2;
+        }
+    }
+    return sum;
+}
+
+void *worker(void *arg) {
+    long id = (long)arg;
+    for (int i = 0; i < 256; i++) {
+        data[id][i] = i * (id + 3) + 1;
+    }
+    long total = 0;
+    for (int rep = 0; rep < 100; rep++) {
+        total += (id & 1) ? parity(data[id], 256)
+                          : scale(data[id], 256, id + 1);
+    }
+    results[id] = total;
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[NUM_THREADS];
+
+    nugget_roi_begin_();
+
+    for (long id = 0; id < NUM_THREADS; id++) {
+        pthread_create(&threads[id], NULL, worker, (void *)id);
+    }
+    long total = 0;
+    for (long id = 0; id < NUM_THREADS; id++) {
+        pthread_join(threads[id], NULL);
+        total += results[id];
+    }
+    printf("Total: %ld\n", total);
+
+    nugget_roi_end_();
+    return 0;
+}
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//
+//
+// Test Case 9: Reference runtime library
+//
+// Purpose: Verify that runtime/nugget_rt.c records the same basic block
+// vectors for the mode=call, mode=inline and mode=inline;touched=true
+// builds of this program:
+//   1. Every build writes a well-formed BBV file (NUGGET_OUTPUT)
+//   2. The per-block totals and instruction counts of all files match
+//   3. The partial interval at ROI end is flushed in every mode
+//
+// The program defines nugget_roi_begin_ itself and gets nugget_roi_end_ from
+// the runtime. noinline and the asm barrier keep -O2 from inlining or
+// deleting the empty call, so the nugget_init call the pass inserts into it
+// runs where the ROI starts.
+
+#include <stdio.h>
+
+extern void nugget_roi_end_(void);
+
+__attribute__((noinline)) void nugget_roi_begin_(void) {
+    __asm__ volatile("" ::: "memory");
+}
+
+static long data[512];
+
+long collatz_steps(long n) {
+    long steps = 0;
+    while (n != 1) {
+        n = (n & 1) ? 3 * n + 1 : n / 2;
+        steps++;
+    }
+    return steps;
+}
+
+long histogram(int n) {
+    long buckets[8] = {0};
+    for (int i = 0; i < n; i++) {
+        buckets[data[i] & 7]++;
+    }
+    long max = 0;
+    for (int i = 0; i < 8; i++) {
+        if (buckets[i] > max) {
+            max = buckets[i];
+        }
+    }
+    return max;
+}
+
+int main() {
+    nugget_roi_begin_();
+
+    for (int i = 0; i < 512; i++) {
+        data[i] = collatz_steps(i + 1);
+    }
+
+    long total = 0;
+    for (int rep = 0; rep < 50; rep++) {
+        total += histogram(512 - rep);
+    }
+    printf("Total: %ld\n", total);
+
+    nugget_roi_end_();
+    return 0;
+}
@@ -60,3 +60,57 @@ void nugget_start_marker_hook(void) {
 void nugget_end_marker_hook(void) {
     // Stub implementation
 }
+
+// nugget_init_regions - Initialize the runtime with a markers_file table.
+//
+// Called instead of nugget_init when PhaseBoundPass runs with markers_file.
+//
+// Args:
+//   count: Number of marker regions
+//   table: count rows of {region_id, warmup_count, start_count, end_count}
+void nugget_init_regions(uint64_t count, const uint64_t *table) {
+    // Stub implementation
+    (void)count;
+    (void)table;
+}
+
+// nugget_*_marker_region_hook - Called at the marker basic blocks of a
+// markers_file region.
+//
+// Args:
+//   region_index: Row of the region in the nugget_init_regions table
+void nugget_warmup_marker_region_hook(uint64_t region_index) {
+    (void)region_index;
+}
+
+void nugget_start_marker_region_hook(uint64_t region_index) {
+    (void)region_index;
+}
+
+void nugget_end_marker_region_hook(uint64_t region_index) {
+    (void)region_index;
+}
+
+// nugget_init_countdown / nugget_init_regions_countdown - Initialize the
+// runtime in countdown mode.
+//
+// Called instead of nugget_init / nugget_init_regions with countdown=inline
+// or countdown=atomic. countdowns holds three entries per region that the
+// instrumented marker blocks count down; a real runtime arms them with the
+// marker counts.
+void nugget_init_countdown(uint64_t warmup_count, uint64_t start_count,
+                           uint64_t end_count, uint64_t *countdowns) {
+    // Stub implementation
+    (void)warmup_count;
+    (void)start_count;
+    (void)end_count;
+    (void)countdowns;
+}
+
+void nugget_init_regions_countdown(uint64_t count, const uint64_t *table,
+                                   uint64_t *countdowns) {
+    // Stub implementation
+    (void)count;
+    (void)table;
+    (void)countdowns;
+}
@@ -0,0 +1,215 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2026 Zhantong Qiu
+# All rights reserved.
+#
+# verify_marker_output.py
+#
+# Runs a program built with PhaseBoundPass<markers_file=...> and linked with
+# runtime/nugget_bound_rt.c, and validates the marker events it records in
+# NUGGET_MARKER_OUTPUT.
+#
+# Verifies:
+#   1. The program exits with status 0
+#   2. Every region of markers.csv records each of its markers exactly once,
+#      in order: warmup (if it has one), start, end
+#   3. With --fork (NUGGET_FORK=1): the parent records no event, and each
+#      region is recorded by a child process of its own, in
+#      <NUGGET_MARKER_OUTPUT>.<pid>
+#   4. With --perf-events LIST (NUGGET_PERF_EVENTS): NUGGET_PERF_OUTPUT has
+#      a column per event of LIST and exactly one row per region, written
+#      by the process that recorded the region's markers, with a non-zero
+#      value for every event and for both times
+#
+# Usage:
+#   python3 verify_marker_output.py [--fork] [--perf-events LIST] \
+#           <executable> <markers.csv> <marker_output>
+#
+# marker_output is the NUGGET_MARKER_OUTPUT to run with; it and its
+# <marker_output>.<pid> files are removed first. The perf counts go to
+# <marker_output without suffix>_perf.csv.
+
+import csv
+import os
+import subprocess
+import sys
+from pathlib import Path
+
+
+def parse_markers(markers_file):
+    """Map region_id to its expected events, skipping comments."""
+    with open(markers_file, 'r') as f:
+        lines = [line for line in f
+                 if line.strip() and not line.lstrip().startswith('#')]
+    regions = {}
+    for row in csv.DictReader(lines):
+        events = ['start', 'end']
+        if int(row['warmup_cnt']) > 0:
+            events.insert(0, 'warmup')
+        regions[int(row['region_id'])] = events
+    return regions
+
+
+def read_events(path):
+    """Return the (event, region_id) pairs of one marker output file."""
+    events = []
+    with open(path, 'r') as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) != 3:
+                raise ValueError(f"{path}: malformed line {line.rstrip()!r}")
+            events.append((fields[0], int(fields[1])))
+    return events
+
+
+def output_files(path):
+    """Map the pid in the name of path and its .<pid> files to the file,
+    None for path itself."""
+    files = {}
+    for child in path.parent.glob(path.name + '*'):
+        files[None if child == path else int(child.suffix[1:])] = child
+    return files
+
+
+def check_perf(perf_output, perf_events, regions, region_pids):
+    """Check the per-region perf counts. region_pids maps each region to the
+    pid (None for the parent) that recorded its markers."""
+    errors = []
+    expected_header = (['region_id'] + perf_events.split(',') +
+                       ['time_enabled_ns', 'time_running_ns'])
+    rows = {}
+    for pid, path in output_files(perf_output).items():
+        with open(path, 'r') as f:
+            lines = list(csv.reader(f))
+        if not lines or lines[0] != expected_header:
+            errors.append(f"{path.name}: header "
+                          f"{lines[0] if lines else None}, expected "
+                          f"{expected_header}")
+            continue
+        for row in lines[1:]:
+            region_id = int(row[0])
+            if region_id in rows:
+                errors.append(f"Region {region_id}: more than one perf row")
+            rows[region_id] = (pid, row)
+
+    for region_id in regions:
+        if region_id not in rows:
+            errors.append(f"Region {region_id}: no perf row")
+            continue
+        pid, row = rows[region_id]
+        if pid != region_pids.get(region_id):
+            errors.append(f"Region {region_id}: perf row written by "
+                          f"{pid}, markers by {region_pids.get(region_id)}")
+        for name, value in zip(expected_header[1:], row[1:]):
+            if int(value) <= 0:
+                errors.append(f"Region {region_id}: {name} is {value}")
+    for region_id in rows:
+        if region_id not in regions:
+            errors.append(f"Perf row of unknown region {region_id}")
+    return errors
+
+
+def main():
+    args = sys.argv[1:]
+    fork = '--fork' in args
+    args = [arg for arg in args if arg != '--fork']
+    perf_events = None
+    if '--perf-events' in args:
+        index = args.index('--perf-events')
+        if index + 1 < len(args):
+            perf_events = args[index + 1]
+            del args[index:index + 2]
+    if len(args) != 3 or perf_events == '':
+        print("Usage: verify_marker_output.py [--fork] [--perf-events LIST] "
+              "<executable> <markers.csv> <marker_output>")
+        sys.exit(1)
+    executable, markers_file, output = args
+
+    regions = parse_markers(markers_file)
+    output = Path(output)
+    perf_output = output.with_name(output.stem + '_perf.csv')
+    for stale in [*output_files(output).values(),
+                  *output_files(perf_output).values()]:
+        stale.unlink()
+
+    env = dict(os.environ)
+    env['NUGGET_MARKER_OUTPUT'] = str(output)
+    if perf_events:
+        env['NUGGET_PERF_OUTPUT'] = str(perf_output)
+        env['NUGGET_PERF_EVENTS'] = perf_events
+    else:
+        env.pop('NUGGET_PERF_OUTPUT', None)
+    if fork:
+        env['NUGGET_FORK'] = '1'
+    else:
+        env.pop('NUGGET_FORK', None)
+    env.pop('NUGGET_REGION', None)
+    process = subprocess.Popen([executable], env=env)
+    status = process.wait()
+
+    errors = []
+    if status != 0:
+        errors.append(f"{executable} exited with status {status}")
+
+    # pid of the process that wrote each file, None for the parent's
+    recorded = {pid: read_events(path)
+                for pid, path in output_files(output).items()}
+
+    # region_id -> [(pid, event)] in recording order
+    per_region = {region_id: [] for region_id in regions}
+    for pid, events in recorded.items():
+        for event, region_id in events:
+            if region_id not in per_region:
+                errors.append(f"Event {event} of unknown region {region_id}")
+                continue
+            per_region[region_id].append((pid, event))
+
+    for region_id, expected in regions.items():
+        events = [event for _, event in per_region[region_id]]
+        if events != expected:
+            errors.append(f"Region {region_id}: recorded {events}, "
+                          f"expected {expected}")
+        pids = {pid for pid, _ in per_region[region_id]}
+        if fork and (None in pids or len(pids) != 1):
+            errors.append(f"Region {region_id}: recorded by "
+                          f"{sorted(str(pid) for pid in pids)}, expected one "
+                          f"child process")
+
+    if fork:
+        if recorded.get(None):
+            errors.append(f"Parent {process.pid} recorded "
+                          f"{recorded[None]}, expected no events")
+        children = [pid for pid in recorded if pid is not None]
+        if process.pid in children:
+            errors.append(f"Events recorded under the parent's pid "
+                          f"{process.pid}")
+        if len(children) != len(regions):
+            errors.append(f"{len(children)} child processes recorded events "
+                          f"for {len(regions)} regions")
+
+    if perf_events:
+        region_pids = {region_id: events[0][0]
+                       for region_id, events in per_region.items() if events}
+        errors.extend(check_perf(perf_output, perf_events, regions,
+                                 region_pids))
+
+    if errors:
+        print("✗ Marker output validation FAILED")
+        for error in errors:
+            print(f"  - {error}")
+        sys.exit(1)
+
+    print("✓ Marker output validation PASSED")
+    print(f"  - {executable} exited with status 0")
+    print(f"  - {len(regions)} regions, each marker recorded once and in "
+          f"order")
+    if fork:
+        print(f"  - Each region recorded by its own child of pid "
+              f"{process.pid}")
+    if perf_events:
+        print(f"  - One perf row per region with non-zero {perf_events}")
+    sys.exit(0)
+
+
+if __name__ == '__main__':
+    main()
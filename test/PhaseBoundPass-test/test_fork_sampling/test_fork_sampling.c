@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// test_fork_sampling.c - Program for the runtime tests of PhaseBoundPass
+//
+// The marker blocks are the single-block functions defined first, so they
+// are labeled bb 0 (warmup_point), bb 1 (start_point) and bb 2 (end_point)
+// whatever -O2 makes of the rest. Every iteration of the loop in main runs
+// each of them once around a call to work(), which touches fresh pages so
+// a region always takes page faults and time.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void nugget_roi_begin_(void);
+void nugget_roi_end_(void);
+
+#define ITERATIONS 3
+#define WORK_PAGES 64
+
+static volatile uint64_t sink;
+
+__attribute__((noinline)) void warmup_point(uint64_t i) {
+    sink += i;
+}
+
+__attribute__((noinline)) void start_point(uint64_t i) {
+    sink ^= i;
+}
+
+__attribute__((noinline)) void end_point(uint64_t i) {
+    sink -= i;
+}
+
+// Above the malloc mmap threshold, so every call faults its pages in. The
+// buffer is not freed: glibc would raise the threshold and hand the same,
+// already faulted pages to the next call.
+__attribute__((noinline)) uint64_t work(uint64_t pages) {
+    volatile char *buffer = malloc(pages * 4096);
+    if (!buffer) {
+        abort();
+    }
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < pages * 4096; i += 64) {
+        buffer[i] = (char)i;
+        sum += (uint64_t)buffer[i];
+    }
+    return sum;
+}
+
+// PhaseBoundPass inserts nugget_init_regions at the end
+__attribute__((noinline)) void nugget_roi_begin_(void) {
+    __asm__ volatile("" ::: "memory");
+}
+
+int main(void) {
+    uint64_t result = 0;
+
+    nugget_roi_begin_();
+
+    for (uint64_t i = 0; i < ITERATIONS; i++) {
+        warmup_point(i);
+        start_point(i);
+        result += work(WORK_PAGES);
+        end_point(i);
+    }
+
+    nugget_roi_end_();
+
+    printf("Result: %lu\n", (unsigned long)result);
+    return 0;
+}
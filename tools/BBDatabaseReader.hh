@@ -0,0 +1,387 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// BBDatabaseReader - lookups in the binary BB database of IRBBLabelPass
+//
+// Maps the database written with ir-bb-label-pass<output_db=...> read-only.
+// Blocks and functions are fixed-width records indexed by ID, so a lookup
+// is a bounds check and a load, with no parsing:
+//
+//   nugget::BBDatabaseReader db;
+//   if (!db.open("bb_info.db")) {
+//       fprintf(stderr, "%s\n", db.error().c_str());
+//   }
+//   nugget::BBRecord block;
+//   if (db.lookup(bb_id, block)) {
+//       // block.function_name, block.name, block.inst_count
+//   }
+//
+// Databases written with features=true also hold the static features and
+// successors of every block, see features() and successors(). With
+// id_scheme=hash they map between bb.id and the stable IDs that survive
+// rebuilds, see stableId() and findStableId().
+//
+// The reader only depends on the C++17 standard library and POSIX.
+
+#ifndef _BBDATABASEREADER_HH_
+#define _BBDATABASEREADER_HH_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nugget {
+
+// On-disk layout, must match src/IRBBLabelPass.hh
+constexpr char kBBDatabaseMagic[8] = {'N', 'U', 'G', 'B', 'B', 'D', 'B',
+                                      '\0'};
+constexpr uint32_t kBBDatabaseVersion = 1;
+
+struct BBDatabaseHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t fingerprint;
+    uint64_t num_blocks;
+    uint64_t num_functions;
+    uint64_t blocks_offset;
+    uint64_t functions_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t features_offset;
+    uint64_t successors_offset;
+    uint64_t num_successors;
+    uint64_t stable_ids_offset;
+    uint64_t remap_offset;
+};
+
+struct BBDatabaseBlock {
+    uint64_t name_offset;
+    uint32_t name_size;
+    uint32_t function_id;
+    uint32_t inst_count;
+    uint32_t reserved;
+};
+
+struct BBDatabaseFunction {
+    uint64_t name_offset;
+    uint64_t name_size;
+    uint64_t first_bb_id;
+    uint64_t num_blocks;
+};
+
+enum BBDatabaseFeatureFlags : uint32_t {
+    BBDB_LOOP_HEADER = 1 << 0,
+};
+
+struct BBDatabaseFeatures {
+    uint32_t loads;
+    uint32_t stores;
+    uint32_t branches;
+    uint32_t calls;
+    uint32_t fp_ops;
+    uint32_t vector_ops;
+    uint32_t loop_depth;
+    uint32_t flags;             // BBDatabaseFeatureFlags
+    uint64_t first_successor;
+    uint64_t num_successors;
+};
+
+struct BBDatabaseRemap {
+    uint64_t stable_id;
+    uint64_t bb_id;
+};
+
+// One block as a lookup returns it. The names point into the mapping and
+// stay valid until the reader is closed.
+struct BBRecord {
+    uint64_t bb_id;
+    uint64_t function_id;
+    uint64_t inst_count;
+    std::string_view function_name;
+    std::string_view name;  // Empty for most entry blocks
+};
+
+class BBDatabaseReader {
+  public:
+    BBDatabaseReader() = default;
+    BBDatabaseReader(const BBDatabaseReader &) = delete;
+    BBDatabaseReader &operator=(const BBDatabaseReader &) = delete;
+    ~BBDatabaseReader() { close(); }
+
+    // Map path and validate its header and section bounds. Returns false
+    // and sets error() on failure.
+    bool open(const std::string &path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return fail(path + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return fail(path + ": " + std::strerror(errno));
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ < sizeof(BBDatabaseHeader)) {
+            ::close(fd);
+            size_ = 0;
+            return fail(path + ": too short for a BB database header");
+        }
+        void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            size_ = 0;
+            return fail(path + ": " + std::strerror(errno));
+        }
+        data_ = static_cast<const unsigned char *>(data);
+        madvise(data, size_, MADV_RANDOM);
+
+        header_ = {};
+        std::memcpy(&header_, data_, sizeof(header_));
+        if (std::memcmp(header_.magic, kBBDatabaseMagic,
+                        sizeof(header_.magic)) != 0) {
+            return fail(path + ": not a BB database");
+        }
+        if (header_.version != kBBDatabaseVersion) {
+            return fail(path + ": unsupported BB database version " +
+                        std::to_string(header_.version));
+        }
+        if (header_.header_size < sizeof(header_) ||
+            header_.header_size > size_ ||
+            !inFile(header_.blocks_offset, header_.num_blocks,
+                    sizeof(BBDatabaseBlock)) ||
+            !inFile(header_.functions_offset, header_.num_functions,
+                    sizeof(BBDatabaseFunction)) ||
+            !inFile(header_.strings_offset, header_.strings_size, 1) ||
+            header_.blocks_offset % alignof(BBDatabaseBlock) != 0 ||
+            header_.functions_offset % alignof(BBDatabaseFunction) != 0) {
+            return fail(path + ": sections exceed the file or are "
+                        "misaligned");
+        }
+        if (header_.features_offset != 0 &&
+            (!inFile(header_.features_offset, header_.num_blocks,
+                     sizeof(BBDatabaseFeatures)) ||
+             !inFile(header_.successors_offset, header_.num_successors,
+                     sizeof(uint64_t)) ||
+             header_.features_offset % alignof(BBDatabaseFeatures) != 0 ||
+             header_.successors_offset % alignof(uint64_t) != 0)) {
+            return fail(path + ": feature sections exceed the file or are "
+                        "misaligned");
+        }
+        if (header_.stable_ids_offset != 0 &&
+            (!inFile(header_.stable_ids_offset, header_.num_blocks,
+                     sizeof(uint64_t)) ||
+             !inFile(header_.remap_offset, header_.num_blocks,
+                     sizeof(BBDatabaseRemap)) ||
+             header_.stable_ids_offset % alignof(uint64_t) != 0 ||
+             header_.remap_offset % alignof(BBDatabaseRemap) != 0)) {
+            return fail(path + ": stable ID sections exceed the file or "
+                        "are misaligned");
+        }
+        if (header_.stable_ids_offset != 0) {
+            stable_ids_ = reinterpret_cast<const uint64_t *>(
+                data_ + header_.stable_ids_offset);
+            remap_ = reinterpret_cast<const BBDatabaseRemap *>(
+                data_ + header_.remap_offset);
+        }
+        if (header_.features_offset != 0) {
+            features_ = reinterpret_cast<const BBDatabaseFeatures *>(
+                data_ + header_.features_offset);
+            successors_ = reinterpret_cast<const uint64_t *>(
+                data_ + header_.successors_offset);
+        }
+        blocks_ = reinterpret_cast<const BBDatabaseBlock *>(
+            data_ + header_.blocks_offset);
+        functions_ = reinterpret_cast<const BBDatabaseFunction *>(
+            data_ + header_.functions_offset);
+        strings_ = reinterpret_cast<const char *>(
+            data_ + header_.strings_offset);
+        return true;
+    }
+
+    void close() {
+        if (data_) {
+            munmap(const_cast<unsigned char *>(data_), size_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+        header_ = {};
+        blocks_ = nullptr;
+        functions_ = nullptr;
+        features_ = nullptr;
+        successors_ = nullptr;
+        stable_ids_ = nullptr;
+        remap_ = nullptr;
+        strings_ = nullptr;
+        error_.clear();
+    }
+
+    // Fill record with block bb_id. Returns false if there is no such
+    // block or its record points outside the string pool.
+    bool lookup(uint64_t bb_id, BBRecord &record) const {
+        if (bb_id >= header_.num_blocks) {
+            return false;
+        }
+        const BBDatabaseBlock &block = blocks_[bb_id];
+        if (block.function_id >= header_.num_functions ||
+            !name(block.name_offset, block.name_size, record.name) ||
+            !functionName(block.function_id, record.function_name)) {
+            return false;
+        }
+        record.bb_id = bb_id;
+        record.function_id = block.function_id;
+        record.inst_count = block.inst_count;
+        return true;
+    }
+
+    // Name of function function_id. Returns false if there is none.
+    bool functionName(uint64_t function_id, std::string_view &out) const {
+        if (function_id >= header_.num_functions) {
+            return false;
+        }
+        const BBDatabaseFunction &function = functions_[function_id];
+        return name(function.name_offset, function.name_size, out);
+    }
+
+    // Static features of block bb_id, nullptr if the database has none or
+    // there is no such block
+    const BBDatabaseFeatures *features(uint64_t bb_id) const {
+        if (!features_ || bb_id >= header_.num_blocks) {
+            return nullptr;
+        }
+        return &features_[bb_id];
+    }
+
+    // Successor BB IDs of a block's features, count of them in num. Returns
+    // nullptr if the record points outside the successor array.
+    const uint64_t *successors(const BBDatabaseFeatures &features,
+                               uint64_t &num) const {
+        num = 0;
+        if (!successors_ ||
+            features.first_successor > header_.num_successors ||
+            features.num_successors >
+                header_.num_successors - features.first_successor) {
+            return nullptr;
+        }
+        num = features.num_successors;
+        return successors_ + features.first_successor;
+    }
+
+    bool hasFeatures() const { return features_ != nullptr; }
+
+    // Stable ID of block bb_id. Returns false if the database has none or
+    // there is no such block.
+    bool stableId(uint64_t bb_id, uint64_t &stable_id) const {
+        if (!stable_ids_ || bb_id >= header_.num_blocks) {
+            return false;
+        }
+        stable_id = stable_ids_[bb_id];
+        return true;
+    }
+
+    // bb.id of the block with stable_id, e.g. one recorded from another
+    // build. Returns false if no block of this build has it.
+    bool findStableId(uint64_t stable_id, uint64_t &bb_id) const {
+        if (!remap_) {
+            return false;
+        }
+        const BBDatabaseRemap *end = remap_ + header_.num_blocks;
+        const BBDatabaseRemap *it = std::lower_bound(remap_, end, stable_id,
+            [](const BBDatabaseRemap &entry, uint64_t id) {
+                return entry.stable_id < id;
+            });
+        if (it == end || it->stable_id != stable_id ||
+            it->bb_id >= header_.num_blocks) {
+            return false;
+        }
+        bb_id = it->bb_id;
+        return true;
+    }
+
+    bool hasStableIds() const { return stable_ids_ != nullptr; }
+
+    // Raw records, nullptr unless open
+    const BBDatabaseBlock *blocks() const { return blocks_; }
+    const BBDatabaseFunction *functions() const { return functions_; }
+
+    const std::string &error() const { return error_; }
+    // Same as the !nugget.fingerprint of the module and the trace header
+    uint64_t fingerprint() const { return header_.fingerprint; }
+    uint64_t numBlocks() const { return header_.num_blocks; }
+    uint64_t numFunctions() const { return header_.num_functions; }
+
+  private:
+    bool fail(const std::string &message) {
+        close();
+        error_ = message;
+        return false;
+    }
+
+    // Whether count records of size bytes at offset lie within the file
+    bool inFile(uint64_t offset, uint64_t count, uint64_t size) const {
+        return offset <= size_ && count <= (size_ - offset) / size;
+    }
+
+    // The name at offset in the string pool; it must end in a NUL
+    bool name(uint64_t offset, uint64_t size, std::string_view &out) const {
+        if (offset >= header_.strings_size ||
+            size >= header_.strings_size - offset ||
+            strings_[offset + size] != '\0') {
+            return false;
+        }
+        out = std::string_view(strings_ + offset, size);
+        return true;
+    }
+
+    const unsigned char *data_ = nullptr;
+    size_t size_ = 0;
+    BBDatabaseHeader header_ = {};
+    const BBDatabaseBlock *blocks_ = nullptr;
+    const BBDatabaseFunction *functions_ = nullptr;
+    const BBDatabaseFeatures *features_ = nullptr;
+    const uint64_t *successors_ = nullptr;
+    const uint64_t *stable_ids_ = nullptr;
+    const BBDatabaseRemap *remap_ = nullptr;
+    const char *strings_ = nullptr;
+    std::string error_;
+};
+
+} // namespace nugget
+
+#endif // _BBDATABASEREADER_HH_
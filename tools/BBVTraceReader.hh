@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// BBVTraceReader - streaming reader for libnugget_rt traces
+//
+// Maps a trace written by runtime/nugget_rt.c (format in
+// runtime/nugget_rt.h) read-only and decodes one interval at a time, so
+// traces larger than memory can be processed in a single pass:
+//
+//   nugget::BBVTraceReader reader;
+//   if (!reader.open("nugget_bbv.bin")) {
+//       fprintf(stderr, "%s\n", reader.error().c_str());
+//   }
+//   nugget::BBVInterval interval;
+//   while (reader.next(interval)) {
+//       for (const nugget::BBVEntry &entry : interval.entries) { ... }
+//   }
+//   if (!reader.error().empty()) { /* truncated or corrupt trace */ }
+//
+// The reader only depends on the C++17 standard library and POSIX.
+
+#ifndef _BBVTRACEREADER_HH_
+#define _BBVTRACEREADER_HH_
+
+#include "nugget_rt.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nugget {
+
+struct BBVEntry {
+    uint64_t bb_id;
+    uint64_t count;
+};
+
+struct BBVInterval {
+    uint64_t index;       // Position of the record in the trace
+    uint64_t thread;      // Runtime thread index
+    uint64_t inst_count;  // IR instructions executed in the interval
+    uint64_t clock;       // Instructions of all threads up to its end
+    // One value per bit of BBVTraceReader::metrics(), lowest bit first
+    std::vector<uint64_t> metrics;
+    std::vector<BBVEntry> entries;  // Sorted by bb_id
+};
+
+// Name of a NUGGET_METRIC_* bit as NUGGET_METRICS spells it
+inline std::string metricName(uint64_t bit) {
+    switch (bit) {
+    case NUGGET_METRIC_TSC: return "tsc";
+    case NUGGET_METRIC_CYCLES: return "cycles";
+    case NUGGET_METRIC_INSTRUCTIONS: return "instructions";
+    case NUGGET_METRIC_LLC_MISSES: return "llc-misses";
+    }
+    for (unsigned i = 0; i < 64; i++) {
+        if (bit == (uint64_t(1) << i)) {
+            return "metric" + std::to_string(i);
+        }
+    }
+    return "metrics";
+}
+
+class BBVTraceReader {
+  public:
+    BBVTraceReader() = default;
+    BBVTraceReader(const BBVTraceReader &) = delete;
+    BBVTraceReader &operator=(const BBVTraceReader &) = delete;
+    ~BBVTraceReader() { close(); }
+
+    // Map path and validate its header. Returns false and sets error() on
+    // failure.
+    bool open(const std::string &path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return fail(path + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return fail(path + ": " + std::strerror(errno));
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                size_ = 0;
+                return fail(path + ": " + std::strerror(errno));
+            }
+            data_ = static_cast<const unsigned char *>(data);
+            madvise(data, size_, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+
+        nugget_file_header header = {};
+        if (size_ < sizeof(header)) {
+            return fail(path + ": too short for a trace header");
+        }
+        std::memcpy(&header, data_, sizeof(header));
+        if (std::memcmp(header.magic, NUGGET_FILE_MAGIC,
+                        sizeof(header.magic)) != 0) {
+            return fail(path + ": not a nugget trace");
+        }
+        if (header.version != NUGGET_FILE_VERSION) {
+            return fail(path + ": unsupported trace version " +
+                        std::to_string(header.version));
+        }
+        if (header.header_size < sizeof(header) ||
+            header.header_size > size_) {
+            return fail(path + ": invalid header size");
+        }
+        if (header.interval_length == 0) {
+            return fail(path + ": invalid interval length");
+        }
+        if (header.num_modules > (header.header_size - sizeof(header)) /
+                                     sizeof(nugget_file_module)) {
+            return fail(path + ": module table exceeds the header");
+        }
+        modules_.resize(header.num_modules);
+        if (!modules_.empty()) {
+            std::memcpy(modules_.data(), data_ + sizeof(header),
+                        modules_.size() * sizeof(nugget_file_module));
+        }
+        header_modules_ = modules_.size();
+        header_counters_ = header.num_counters;
+        version_ = header.version;
+        fingerprint_ = header.fingerprint;
+        metrics_ = header.metrics;
+        interval_length_ = header.interval_length;
+        num_metrics_ = 0;
+        for (uint64_t bits = metrics_; bits; bits &= bits - 1) {
+            num_metrics_++;
+        }
+        records_ = header.header_size;
+        rewind();
+        return true;
+    }
+
+    void close() {
+        if (data_) {
+            munmap(const_cast<unsigned char *>(data_), size_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+        records_ = 0;
+        position_ = 0;
+        modules_.clear();
+        error_.clear();
+    }
+
+    // Restart from the first interval, with the modules of the header
+    void rewind() {
+        position_ = records_;
+        index_ = 0;
+        clock_ = 0;
+        modules_.resize(header_modules_);
+        num_counters_ = header_counters_;
+    }
+
+    // Decode the next interval into interval. Module records on the way
+    // are added to modules() and numCounters(). Returns false at the end of
+    // the trace, or on a malformed record, in which case error() is set.
+    bool next(BBVInterval &interval) {
+        if (!data_ || !error_.empty()) {
+            return false;
+        }
+        do {
+            if (position_ >= size_) {
+                return false;
+            }
+            if (!readVarint(interval.thread)) {
+                return false;
+            }
+        } while (interval.thread == NUGGET_MODULE_RECORD && readModule());
+        if (!error_.empty()) {
+            return false;
+        }
+        uint64_t num_entries;
+        if (!readVarint(interval.inst_count)) {
+            return false;
+        }
+        interval.metrics.resize(num_metrics_);
+        for (uint64_t &value : interval.metrics) {
+            if (!readVarint(value)) {
+                return false;
+            }
+        }
+        if (!readVarint(num_entries)) {
+            return false;
+        }
+        // Every entry takes at least two bytes
+        if (num_entries > (size_ - position_) / 2) {
+            return corrupt("entry count exceeds the trace size");
+        }
+        interval.entries.resize(num_entries);
+        uint64_t bb_id = 0;
+        for (BBVEntry &entry : interval.entries) {
+            uint64_t delta;
+            if (!readVarint(delta) || !readVarint(entry.count)) {
+                return false;
+            }
+            bb_id += delta;
+            entry.bb_id = bb_id;
+        }
+        clock_ += interval.inst_count;
+        interval.index = index_++;
+        interval.clock = clock_;
+        return true;
+    }
+
+    const std::string &error() const { return error_; }
+    uint32_t version() const { return version_; }
+    uint64_t fingerprint() const { return fingerprint_; }
+    // bb_ids of modules(), which module records add to
+    uint64_t numCounters() const { return num_counters_; }
+    // NUGGET_METRIC_* bits recorded with every interval
+    uint64_t metrics() const { return metrics_; }
+    // Instructions per interval the trace was recorded with
+    uint64_t intervalLength() const { return interval_length_; }
+    // The modules of the program and their bb_id ranges, sorted by id_base:
+    // those of the header, then those of the module records read so far
+    const std::vector<nugget_file_module> &modules() const {
+        return modules_;
+    }
+    // Whether the trace was recorded from the program fingerprint was
+    // labeled for, or has a module labeled for it
+    bool hasFingerprint(uint64_t fingerprint) const {
+        return fingerprint_ == fingerprint ||
+               std::any_of(modules_.begin(), modules_.end(),
+                           [&](const nugget_file_module &module) {
+                               return module.fingerprint == fingerprint;
+                           });
+    }
+
+  private:
+    bool fail(const std::string &message) {
+        close();
+        error_ = message;
+        return false;
+    }
+
+    bool corrupt(const char *what) {
+        error_ = "corrupt record " + std::to_string(index_) + " at offset " +
+                 std::to_string(position_) + ": " + what;
+        return false;
+    }
+
+    // A module registered after nugget_init, see nugget_rt.h
+    bool readModule() {
+        nugget_file_module module;
+        if (!readVarint(module.fingerprint) || !readVarint(module.id_base) ||
+            !readVarint(module.num_blocks)) {
+            return false;
+        }
+        if (module.id_base != num_counters_ ||
+            module.num_blocks > UINT64_MAX - module.id_base) {
+            return corrupt("module record does not follow the counters");
+        }
+        modules_.push_back(module);
+        num_counters_ += module.num_blocks;
+        return true;
+    }
+
+    bool readVarint(uint64_t &value) {
+        value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (position_ >= size_) {
+                return corrupt("truncated");
+            }
+            unsigned char byte = data_[position_++];
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return corrupt("varint longer than 64 bits");
+    }
+
+    const unsigned char *data_ = nullptr;
+    size_t size_ = 0;
+    size_t records_ = 0;
+    size_t position_ = 0;
+    uint64_t index_ = 0;
+    uint64_t clock_ = 0;
+    uint32_t version_ = 0;
+    uint64_t fingerprint_ = 0;
+    uint64_t num_counters_ = 0;
+    uint64_t metrics_ = 0;
+    uint64_t interval_length_ = 0;
+    unsigned num_metrics_ = 0;
+    std::vector<nugget_file_module> modules_;
+    size_t header_modules_ = 0;
+    uint64_t header_counters_ = 0;
+    std::string error_;
+};
+
+} // namespace nugget
+
+#endif // _BBVTRACEREADER_HH_
@@ -0,0 +1,474 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2026 Zhantong Qiu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// nugget-bbv - inspect traces written by libnugget_rt
+//
+// Usage:
+//   nugget-bbv info      <trace> [options]
+//   nugget-bbv dump      <trace> [options]
+//   nugget-bbv simpoint  <trace> [options]
+//   nugget-bbv aggregate <trace> --factor N --output <trace> [options]
+//
+//   info      Header fields, the bb_id range of every module of the program
+//             and totals over all intervals
+//   dump      One line per interval:
+//               <index> <thread> <inst_count> <clock> [<metric>=<value> ...]
+//               <bb_id>:<count> ...
+//   simpoint  SimPoint frequency vectors, one "T:<bb_id+1>:<count> ..." line
+//             per interval (SimPoint numbers blocks from 1)
+//   aggregate Write the intervals of --factor as a new trace
+//
+// Options:
+//   --csv bb_info.csv  Check the trace fingerprint against the bb_info CSV
+//                      the program was labeled with; a mismatch is an error.
+//                      For a program of several modules (PhaseAnalysisPass
+//                      id_base), one of the modules must match, which may
+//                      be one loaded after nugget_init
+//   --db bb_info.db    The same check against the output_db database of
+//                      IRBBLabelPass, without reading the CSV
+//   --factor N         Merge the intervals into ones N times as long before
+//                      processing them
+//
+// Merging mirrors what the runtime would have recorded with an N times
+// longer interval_length: the intervals of each thread are summed until
+// they reach N * interval_length instructions, and the merged interval takes
+// the place of its last one. Block counts, instructions and metrics are
+// summed, so totals are exact; a merged interval can only end where a
+// recorded one ended.
+
+#include "BBDatabaseReader.hh"
+#include "BBVTraceReader.hh"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+
+namespace {
+
+// Must match fnv1a64 in src/common.hh
+uint64_t fnv1a64(const std::string &data, uint64_t hash) {
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Fingerprint of a bb_info CSV: FNV-1a of every line after the header.
+bool csvFingerprint(const std::string &path, uint64_t &fingerprint) {
+    std::ifstream csv(path, std::ios::binary);
+    if (!csv) {
+        return false;
+    }
+    std::string line;
+    std::getline(csv, line);
+    fingerprint = 0xcbf29ce484222325ULL;
+    while (std::getline(csv, line)) {
+        fingerprint = fnv1a64(line + "\n", fingerprint);
+    }
+    return true;
+}
+
+// Whether the trace was recorded from the program fingerprint was labeled
+// for. A module loaded after nugget_init is only listed by its module
+// record, so look through the trace for it before giving up.
+bool matchesTrace(nugget::BBVTraceReader &reader, uint64_t fingerprint) {
+    if (reader.hasFingerprint(fingerprint)) {
+        return true;
+    }
+    nugget::BBVInterval interval;
+    while (reader.next(interval)) {
+    }
+    bool found = reader.hasFingerprint(fingerprint);
+    reader.rewind();
+    return found;
+}
+
+int usage() {
+    std::fprintf(stderr,
+        "usage: nugget-bbv info|dump|simpoint <trace> [--csv bb_info.csv] "
+        "[--db bb_info.db] [--factor N]\n"
+        "       nugget-bbv aggregate <trace> --factor N --output <trace> "
+        "[--csv bb_info.csv] [--db bb_info.db]\n");
+    return 2;
+}
+
+// Merges the intervals of a trace into intervals factor times as long, see
+// the top of the file. A factor of 1 passes the intervals through.
+class IntervalAggregator {
+  public:
+    IntervalAggregator(nugget::BBVTraceReader &reader, uint64_t factor)
+        : reader_(reader), factor_(factor),
+          length_(factor * reader.intervalLength()) {}
+
+    // Instructions per interval of the output, 0 if unknown
+    uint64_t intervalLength() const { return length_; }
+
+    bool next(nugget::BBVInterval &interval) {
+        if (factor_ == 1) {
+            return reader_.next(interval);
+        }
+        while (ready_.empty()) {
+            if (!reader_.next(fine_)) {
+                if (!reader_.error().empty() || pending_.empty()) {
+                    return false;
+                }
+                flushPending();
+                break;
+            }
+            auto [it, started] = pending_.try_emplace(fine_.thread);
+            Pending &pending = it->second;
+            if (started) {
+                pending.interval = fine_;
+            } else {
+                merge(pending.interval, fine_);
+            }
+            pending.last = fine_.index;
+            if (pending.interval.inst_count >= length_) {
+                ready_.push_back(std::move(pending.interval));
+                pending_.erase(fine_.thread);
+            }
+        }
+        interval = std::move(ready_.front());
+        ready_.pop_front();
+        clock_ += interval.inst_count;
+        interval.index = index_++;
+        interval.clock = clock_;
+        return true;
+    }
+
+  private:
+    struct Pending {
+        nugget::BBVInterval interval;
+        uint64_t last = 0;  // Index of its last recorded interval
+    };
+
+    void merge(nugget::BBVInterval &into, const nugget::BBVInterval &from) {
+        into.inst_count += from.inst_count;
+        for (size_t i = 0; i < into.metrics.size(); i++) {
+            into.metrics[i] += from.metrics[i];
+        }
+        // Both entry lists are sorted by bb_id
+        entries_.clear();
+        size_t a = 0, b = 0;
+        while (a < into.entries.size() || b < from.entries.size()) {
+            if (b == from.entries.size() ||
+                (a < into.entries.size() &&
+                 into.entries[a].bb_id < from.entries[b].bb_id)) {
+                entries_.push_back(into.entries[a++]);
+            } else if (a == into.entries.size() ||
+                       from.entries[b].bb_id < into.entries[a].bb_id) {
+                entries_.push_back(from.entries[b++]);
+            } else {
+                entries_.push_back({into.entries[a].bb_id,
+                                    into.entries[a].count +
+                                        from.entries[b].count});
+                a++;
+                b++;
+            }
+        }
+        into.entries.swap(entries_);
+    }
+
+    // End of the trace: emit the partial intervals in the order they ended
+    void flushPending() {
+        std::map<uint64_t, nugget::BBVInterval *> by_last;
+        for (auto &[thread, pending] : pending_) {
+            by_last[pending.last] = &pending.interval;
+        }
+        for (auto &[last, interval] : by_last) {
+            ready_.push_back(std::move(*interval));
+        }
+        pending_.clear();
+    }
+
+    nugget::BBVTraceReader &reader_;
+    uint64_t factor_;
+    uint64_t length_;
+    std::map<uint64_t, Pending> pending_;  // By thread
+    std::deque<nugget::BBVInterval> ready_;
+    nugget::BBVInterval fine_;
+    std::vector<nugget::BBVEntry> entries_;
+    uint64_t index_ = 0;
+    uint64_t clock_ = 0;
+};
+
+void appendVarint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+// Names of the metrics of reader, in record order
+std::vector<std::string> metricNames(const nugget::BBVTraceReader &reader) {
+    std::vector<std::string> names;
+    for (uint64_t bits = reader.metrics(); bits; bits &= bits - 1) {
+        names.push_back(nugget::metricName(bits & -bits));
+    }
+    return names;
+}
+
+int info(nugget::BBVTraceReader &reader, IntervalAggregator &source) {
+    uint64_t intervals = 0;
+    uint64_t entries = 0;
+    uint64_t clock = 0;
+    std::set<uint64_t> threads;
+    std::vector<std::string> metric_names = metricNames(reader);
+    std::vector<uint64_t> metric_totals(metric_names.size());
+    nugget::BBVInterval interval;
+    while (source.next(interval)) {
+        intervals++;
+        entries += interval.entries.size();
+        clock = interval.clock;
+        threads.insert(interval.thread);
+        for (size_t i = 0; i < metric_totals.size(); i++) {
+            metric_totals[i] += interval.metrics[i];
+        }
+    }
+    std::printf("version:      %" PRIu32 "\n", reader.version());
+    std::printf("fingerprint:  0x%016" PRIx64 "\n", reader.fingerprint());
+    std::printf("num_counters: %" PRIu64 "\n", reader.numCounters());
+    for (const nugget_file_module &module : reader.modules()) {
+        std::printf("module:       0x%016" PRIx64 " bb_ids %" PRIu64 "-%" PRIu64
+                    "\n", module.fingerprint, module.id_base,
+                    module.id_base + module.num_blocks - 1);
+    }
+    std::printf("interval:     %" PRIu64 "\n", source.intervalLength());
+    std::printf("intervals:    %" PRIu64 "\n", intervals);
+    std::printf("threads:      %zu\n", threads.size());
+    std::printf("instructions: %" PRIu64 "\n", clock);
+    std::printf("entries:      %" PRIu64 "\n", entries);
+    std::string metrics;
+    for (const std::string &name : metric_names) {
+        metrics += (metrics.empty() ? "" : ",") + name;
+    }
+    std::printf("metrics:      %s\n", metrics.empty() ? "none"
+                                                     : metrics.c_str());
+    for (size_t i = 0; i < metric_names.size(); i++) {
+        std::string label = metric_names[i] + ":";
+        std::printf("%-14s%" PRIu64 "\n", label.c_str(), metric_totals[i]);
+    }
+    return 0;
+}
+
+int dump(nugget::BBVTraceReader &reader, IntervalAggregator &source) {
+    std::vector<std::string> metric_names = metricNames(reader);
+    nugget::BBVInterval interval;
+    while (source.next(interval)) {
+        std::printf("%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64,
+                    interval.index, interval.thread, interval.inst_count,
+                    interval.clock);
+        for (size_t i = 0; i < metric_names.size(); i++) {
+            std::printf(" %s=%" PRIu64, metric_names[i].c_str(),
+                        interval.metrics[i]);
+        }
+        for (const nugget::BBVEntry &entry : interval.entries) {
+            std::printf(" %" PRIu64 ":%" PRIu64, entry.bb_id, entry.count);
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
+
+// Write the intervals of source as a trace in the current format
+int aggregate(nugget::BBVTraceReader &reader, IntervalAggregator &source,
+              const std::string &path) {
+    std::FILE *out = std::fopen(path.c_str(), "wb");
+    if (!out) {
+        std::fprintf(stderr, "nugget-bbv: cannot create %s: %s\n",
+                     path.c_str(), std::strerror(errno));
+        return 1;
+    }
+    const std::vector<nugget_file_module> &modules = reader.modules();
+    nugget_file_header header = {};
+    std::memcpy(header.magic, NUGGET_FILE_MAGIC, sizeof(header.magic));
+    header.version = NUGGET_FILE_VERSION;
+    header.header_size = static_cast<uint32_t>(
+        sizeof(header) + modules.size() * sizeof(nugget_file_module));
+    header.fingerprint = reader.fingerprint();
+    header.num_counters = reader.numCounters();
+    header.metrics = reader.metrics();
+    header.interval_length = source.intervalLength();
+    header.num_modules = modules.size();
+    std::fwrite(&header, sizeof(header), 1, out);
+    std::fwrite(modules.data(), sizeof(nugget_file_module), modules.size(),
+                out);
+
+    // The reader adds the modules of module records to modules() before
+    // the intervals that use them, and so does the output
+    size_t num_written = modules.size();
+    std::string record;
+    auto write_modules = [&]() {
+        for (; num_written < modules.size(); num_written++) {
+            const nugget_file_module &module = modules[num_written];
+            record.clear();
+            appendVarint(record, NUGGET_MODULE_RECORD);
+            appendVarint(record, module.fingerprint);
+            appendVarint(record, module.id_base);
+            appendVarint(record, module.num_blocks);
+            std::fwrite(record.data(), 1, record.size(), out);
+        }
+    };
+    nugget::BBVInterval interval;
+    while (source.next(interval)) {
+        write_modules();
+        record.clear();
+        appendVarint(record, interval.thread);
+        appendVarint(record, interval.inst_count);
+        for (uint64_t value : interval.metrics) {
+            appendVarint(record, value);
+        }
+        appendVarint(record, interval.entries.size());
+        uint64_t previous = 0;
+        for (const nugget::BBVEntry &entry : interval.entries) {
+            appendVarint(record, entry.bb_id - previous);
+            appendVarint(record, entry.count);
+            previous = entry.bb_id;
+        }
+        std::fwrite(record.data(), 1, record.size(), out);
+    }
+    write_modules();
+    if (std::fclose(out) != 0) {
+        std::fprintf(stderr, "nugget-bbv: cannot write %s: %s\n",
+                     path.c_str(), std::strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int simpoint(IntervalAggregator &source) {
+    nugget::BBVInterval interval;
+    while (source.next(interval)) {
+        std::printf("T");
+        for (const nugget::BBVEntry &entry : interval.entries) {
+            std::printf(":%" PRIu64 ":%" PRIu64 " ", entry.bb_id + 1,
+                        entry.count);
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 3 || argc % 2 == 0) {
+        return usage();
+    }
+    std::string command = argv[1];
+    std::string csv_path;
+    std::string db_path;
+    std::string output_path;
+    uint64_t factor = 1;
+    for (int i = 3; i < argc; i += 2) {
+        if (std::strcmp(argv[i], "--csv") == 0) {
+            csv_path = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--db") == 0) {
+            db_path = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--output") == 0) {
+            output_path = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--factor") == 0) {
+            char *end;
+            factor = std::strtoull(argv[i + 1], &end, 10);
+            if (*end != '\0' || factor == 0) {
+                std::fprintf(stderr, "nugget-bbv: invalid factor %s\n",
+                             argv[i + 1]);
+                return 2;
+            }
+        } else {
+            return usage();
+        }
+    }
+    if ((command == "aggregate") != !output_path.empty()) {
+        return usage();
+    }
+
+    nugget::BBVTraceReader reader;
+    if (!reader.open(argv[2])) {
+        std::fprintf(stderr, "nugget-bbv: %s\n", reader.error().c_str());
+        return 1;
+    }
+    if (!csv_path.empty()) {
+        uint64_t expected;
+        if (!csvFingerprint(csv_path, expected)) {
+            std::fprintf(stderr, "nugget-bbv: cannot read %s\n",
+                         csv_path.c_str());
+            return 1;
+        }
+        if (!matchesTrace(reader, expected)) {
+            std::fprintf(stderr, "nugget-bbv: trace fingerprint 0x%016" PRIx64
+                         " does not match %s (0x%016" PRIx64 ")\n",
+                         reader.fingerprint(), csv_path.c_str(), expected);
+            return 1;
+        }
+    }
+    if (!db_path.empty()) {
+        nugget::BBDatabaseReader db;
+        if (!db.open(db_path)) {
+            std::fprintf(stderr, "nugget-bbv: %s\n", db.error().c_str());
+            return 1;
+        }
+        if (!matchesTrace(reader, db.fingerprint())) {
+            std::fprintf(stderr, "nugget-bbv: trace fingerprint 0x%016" PRIx64
+                         " does not match %s (0x%016" PRIx64 ")\n",
+                         reader.fingerprint(), db_path.c_str(),
+                         db.fingerprint());
+            return 1;
+        }
+    }
+
+    IntervalAggregator source(reader, factor);
+    int status;
+    if (command == "info") {
+        status = info(reader, source);
+    } else if (command == "dump") {
+        status = dump(reader, source);
+    } else if (command == "simpoint") {
+        status = simpoint(source);
+    } else if (command == "aggregate") {
+        status = aggregate(reader, source, output_path);
+    } else {
+        return usage();
+    }
+    if (!reader.error().empty()) {
+        std::fprintf(stderr, "nugget-bbv: %s: %s\n", argv[2],
+                     reader.error().c_str());
+        return 1;
+    }
+    return status;
+}